@@ -1,4 +1,5 @@
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 
 // clang-format off
@@ -61,6 +62,145 @@ typedef struct DiscordEventHandlers {
 #define DISCORD_REPLY_YES 1
 #define DISCORD_REPLY_IGNORE 2
 
+/* Outcome of a command sent with one of the *Ex calls */
+#define DISCORD_REQUEST_OK 0
+#define DISCORD_REQUEST_ERROR 1        /* Discord answered with an error, see errorCode/message */
+#define DISCORD_REQUEST_TIMEOUT 2      /* sent, but no answer in time */
+#define DISCORD_REQUEST_DISCONNECTED 3 /* sent, but the connection dropped before the answer */
+#define DISCORD_REQUEST_SUPERSEDED 4   /* a newer presence replaced it before it was sent */
+#define DISCORD_REQUEST_CANCELLED 5    /* the client shut down first */
+
+typedef struct DiscordRequestResult {
+    int status; /* DISCORD_REQUEST_ */
+    int errorCode;
+    const char* message;
+    uint32_t latencyUs; /* send to answer, when there was an answer */
+    const char* data;   /* Discord_SendCommand only: the response's data as JSON, or NULL */
+    size_t dataLength;
+} DiscordRequestResult;
+
+typedef void (*DiscordRequestCallback)(const DiscordRequestResult* result, void* userData);
+
+/* Latency distribution summary, all values in microseconds */
+typedef struct DiscordLatencyStats {
+    uint64_t count;
+    uint64_t minUs;
+    uint64_t maxUs;
+    uint64_t meanUs;
+    uint64_t p50Us;
+    uint64_t p90Us;
+    uint64_t p99Us;
+    uint64_t p999Us;
+} DiscordLatencyStats;
+
+/* Running totals for one client since it was created */
+typedef struct DiscordStats {
+    uint64_t framesIn;
+    uint64_t bytesIn;
+    uint64_t framesOut;
+    uint64_t bytesOut;
+    uint64_t connectAttempts;
+    uint64_t connects;
+    uint64_t disconnects;
+    uint64_t sendQueueHighWater; /* most commands ever waiting to go out at once */
+    uint64_t sendQueueDrops;     /* commands refused because the queue was full */
+    uint64_t joinQueueHighWater;
+    uint64_t joinQueueDrops; /* join requests thrown away because callbacks weren't keeping up */
+    uint64_t presenceSent;
+    uint64_t presenceSuperseded; /* replaced by a newer presence before they went out */
+    uint64_t parseFailures;
+    DiscordLatencyStats ackLatency;    /* command on the wire -> Discord's answer */
+    DiscordLatencyStats dispatchDelay; /* event arriving -> its callback starting */
+    /* Startup, in microseconds. createUs is Discord_Initialize or Discord_CreateClient itself.
+       startUs is getting IO going and registerUs is autoRegister's work; both are part of
+       createUs unless the start is lazy (Discord_SetLazyStart). 0 until they've happened. */
+    uint64_t createUs;
+    uint64_t startUs;
+    uint64_t registerUs;
+} DiscordStats;
+
+typedef struct DiscordConnectionHealth {
+    int connected;
+    uint32_t lastRttUs;     /* latest ping round trip, 0 until the first pong */
+    uint32_t smoothedRttUs; /* moving average of the round trips */
+    uint32_t pingPendingMs; /* how long the current ping has gone unanswered, 0 if none */
+    uint64_t pingsSent;
+    uint64_t pongsReceived;
+    uint64_t livenessTimeouts; /* connections given up on for not answering in time */
+    DiscordLatencyStats rtt;
+} DiscordConnectionHealth;
+
+/* What the library was built to use, in bytes. See memory_config.h for the knobs. ioStackBytes is
+   the one figure here that isn't exact; src/bench/stack_bench.cpp measures it. */
+typedef struct DiscordMemoryFootprint {
+    uint32_t clientBytes;  /* held by each client, the default one included */
+    uint32_t sharedBytes;  /* held once per process while any client exists */
+    uint32_t ioStackBytes; /* estimated most a pass of client IO puts on the stack */
+    uint32_t maxFrameSize;
+    uint32_t maxMessageSize;
+    uint32_t sendQueueSize;
+    uint32_t joinQueueSize;
+    uint32_t parseArenaSize;
+    uint32_t maxPendingRequests;
+} DiscordMemoryFootprint;
+
+/* Every heap allocation the library makes goes through these. Set them before Discord_Initialize
+   or Discord_CreateClient and leave them alone until the last client is gone, since memory is freed
+   with whatever is set at the time. All three or none: NULLs go back to malloc/realloc/free.
+   Returned memory needs malloc's alignment. */
+typedef void* (*DiscordMallocFn)(size_t size, void* userData);
+typedef void* (*DiscordReallocFn)(void* ptr, size_t size, void* userData);
+typedef void (*DiscordFreeFn)(void* ptr, void* userData);
+
+DISCORD_EXPORT void Discord_SetAllocator(DiscordMallocFn mallocFn,
+                                         DiscordReallocFn reallocFn,
+                                         DiscordFreeFn freeFn,
+                                         void* userData);
+
+/* Running totals of the heap calls above, hooked or not. Once connected, presence updates, IO and
+   callbacks shouldn't move these at all; diff two snapshots around a frame to check. */
+typedef struct DiscordAllocationStats {
+    uint64_t allocations;
+    uint64_t reallocations;
+    uint64_t frees;
+    uint64_t bytesRequested;
+} DiscordAllocationStats;
+
+DISCORD_EXPORT void Discord_GetAllocationStats(DiscordAllocationStats* stats);
+
+/* For tests and simulations. With a clock set, every timer and timestamp in the library reads
+   nowUs (microseconds, never going backwards) instead of the system's monotonic clock; with a seed
+   set, reconnect backoff jitter comes from it instead of the time, so a run repeats exactly. Set
+   both before Discord_Initialize or Discord_CreateClient and leave the clock alone while any
+   client exists; NULL and 0 go back to normal. Build with DISCORD_DISABLE_IO_THREAD to go with a
+   simulated clock, since the IO thread's waits are real time whatever the clock says. */
+typedef int64_t (*DiscordClockFn)(void* userData);
+
+DISCORD_EXPORT void Discord_SetClock(DiscordClockFn nowUs, void* userData);
+DISCORD_EXPORT void Discord_SetRandomSeed(uint64_t seed);
+
+/* Where to look for Discord: we try <baseName>0 to <baseName>9, "discord-ipc-" unless told
+   otherwise. Point it at "discord-relay-ipc-" to go through the relay (src/relay) and share its one
+   connection with everything else on the machine. Set it before Discord_Initialize or
+   Discord_CreateClient; NULL goes back to Discord's own. */
+DISCORD_EXPORT void Discord_SetPipeBaseName(const char* baseName);
+
+/* Keeps each application's last presence and event subscriptions in a small memory mapped file in
+   directory (UTF-8, must exist), so a new process for the same application ID -- the game after
+   its launcher, or after a crash -- sends them right after connecting, before its own code gets
+   around to setting a presence. A snapshot more than five minutes old is ignored, and a cleared
+   presence stays cleared. Nothing waits on the disk. Set it before Discord_Initialize or
+   Discord_CreateClient; NULL, the default, turns it off. */
+DISCORD_EXPORT void Discord_SetPresenceSnapshotDirectory(const char* directory);
+
+/* Keeps Discord_Initialize and Discord_CreateClient off your startup path. With lazy start on,
+   autoRegister's registry writes happen on a short-lived thread of their own (in the first
+   Discord_UpdateConnection with DISCORD_DISABLE_IO_THREAD), and no IO thread runs and nothing
+   connects until the first presence update or Discord_UpdateHandlers; a saved presence (see above)
+   waits for that too. Discord_GetStats says what each part cost. Set it before Discord_Initialize
+   or Discord_CreateClient; 0, the default, does it all up front. */
+DISCORD_EXPORT void Discord_SetLazyStart(int lazy);
+
 DISCORD_EXPORT void Discord_Initialize(const char* applicationId,
                                        DiscordEventHandlers* handlers,
                                        int autoRegister,
@@ -73,6 +213,10 @@ DISCORD_EXPORT void Discord_RunCallbacks(void);
 /* If you disable the lib starting its own io thread, you'll need to call this from your own */
 #ifdef DISCORD_DISABLE_IO_THREAD
 DISCORD_EXPORT void Discord_UpdateConnection(void);
+/* How long Discord_UpdateConnection can wait before its next call has anything to do, in ms, or
+   UINT32_MAX if nothing is scheduled. Presence updates, replies and commands don't show up here,
+   so call it after those regardless. Ask from the thread that calls Discord_UpdateConnection. */
+DISCORD_EXPORT uint32_t Discord_NextUpdateDelayMs(void);
 #endif
 
 DISCORD_EXPORT void Discord_UpdatePresence(const DiscordRichPresence* presence);
@@ -80,8 +224,130 @@ DISCORD_EXPORT void Discord_ClearPresence(void);
 
 DISCORD_EXPORT void Discord_Respond(const char* userid, /* DISCORD_REPLY_ */ int reply);
 
+/* Like the calls above, but callback runs from Discord_RunCallbacks once Discord has answered (or
+   the request timed out, was superseded...). Returns 0 if the callback will never run: too many
+   requests are outstanding, or the command couldn't be queued at all. */
+DISCORD_EXPORT int Discord_UpdatePresenceEx(const DiscordRichPresence* presence,
+                                            DiscordRequestCallback callback,
+                                            void* userData);
+DISCORD_EXPORT int Discord_RespondEx(const char* userid,
+                                     /* DISCORD_REPLY_ */ int reply,
+                                     DiscordRequestCallback callback,
+                                     void* userData);
+
+/* Sends any RPC command. argsJson must be a complete JSON object (or NULL for none); it goes into
+   the frame as is, without being parsed or checked. The callback gets the response's data, valid
+   until it returns. Returns 0 if nothing was sent: not connected, the command is too big, or too
+   many commands are queued or outstanding. */
+DISCORD_EXPORT int Discord_SendCommand(const char* command,
+                                       const char* argsJson,
+                                       size_t argsLength,
+                                       DiscordRequestCallback callback,
+                                       void* userData);
+/* The same, for commands that also need a top level evt (SUBSCRIBE and UNSUBSCRIBE, say). NULL
+   leaves it out. */
+DISCORD_EXPORT int Discord_SendCommandEx(const char* command,
+                                         const char* evt,
+                                         const char* argsJson,
+                                         size_t argsLength,
+                                         DiscordRequestCallback callback,
+                                         void* userData);
+
+/* Time from a command hitting the wire to Discord's answer */
+DISCORD_EXPORT void Discord_GetAckLatency(DiscordLatencyStats* stats);
+
+DISCORD_EXPORT void Discord_GetMemoryFootprint(DiscordMemoryFootprint* footprint);
+
+/* Cheap enough to call every frame; counts may trail the IO thread by an update or two */
+DISCORD_EXPORT void Discord_GetStats(DiscordStats* stats);
+
+/* Builds with DISCORD_ENABLE_TRACING only, otherwise this writes nothing and returns 0.
+   Writes the trace events every thread still has buffered as Chrome trace JSON, for
+   chrome://tracing or ui.perfetto.dev. Timestamps are QueryPerformanceCounter microseconds, the
+   same clock most profilers on Windows use. If the buffer runs out, the rest of the events are left
+   out but the JSON is still complete. Returns the length written, not counting the terminator. */
+DISCORD_EXPORT size_t Discord_ExportTrace(char* buffer, size_t bufferSize);
+
+/* Flight recorder: keeps roughly the last sizeBytes (at least 64 KB) of IPC frames in both
+   directions in a memory mapped file at path (UTF-8), overwriting the oldest as it goes. Writing
+   it never waits on the disk. Starting again replaces the file; it takes effect on the next IO
+   update. The replay tool in src/replay plays a recording back through the library. Returns 0 if
+   the file couldn't be created. */
+DISCORD_EXPORT int Discord_StartFlightRecorder(const char* path, uint32_t sizeBytes);
+DISCORD_EXPORT void Discord_StopFlightRecorder(void);
+
+/* While connected we ping Discord every pingIntervalMs (5 s by default). If a ping or the
+   handshake goes unanswered for timeoutMs (15 s), the connection is dropped and the usual
+   reconnect kicks in, with disconnected() reporting why. 0 turns either off. Set any time. */
+DISCORD_EXPORT void Discord_SetHealthCheck(uint32_t pingIntervalMs, uint32_t timeoutMs);
+DISCORD_EXPORT void Discord_GetConnectionHealth(DiscordConnectionHealth* health);
+
 DISCORD_EXPORT void Discord_UpdateHandlers(DiscordEventHandlers* handlers);
 
+/* Independent clients: each one owns its connection, queues and handlers, so you can run as many
+   as you like in one process. The calls above all operate on a default client that
+   Discord_Initialize creates and Discord_Shutdown destroys. Callbacks for a client only ever fire
+   from inside Discord_Client_RunCallbacks for that client. */
+typedef struct DiscordClient DiscordClient;
+
+DISCORD_EXPORT DiscordClient* Discord_CreateClient(const char* applicationId,
+                                                   DiscordEventHandlers* handlers,
+                                                   int autoRegister,
+                                                   const char* optionalSteamId);
+DISCORD_EXPORT void Discord_DestroyClient(DiscordClient* client);
+
+DISCORD_EXPORT void Discord_Client_RunCallbacks(DiscordClient* client);
+
+#ifdef DISCORD_DISABLE_IO_THREAD
+DISCORD_EXPORT void Discord_Client_UpdateConnection(DiscordClient* client);
+DISCORD_EXPORT uint32_t Discord_Client_NextUpdateDelayMs(DiscordClient* client);
+#endif
+
+DISCORD_EXPORT void Discord_Client_UpdatePresence(DiscordClient* client,
+                                                  const DiscordRichPresence* presence);
+DISCORD_EXPORT void Discord_Client_ClearPresence(DiscordClient* client);
+
+DISCORD_EXPORT void Discord_Client_Respond(DiscordClient* client,
+                                           const char* userid,
+                                           /* DISCORD_REPLY_ */ int reply);
+
+DISCORD_EXPORT void Discord_Client_UpdateHandlers(DiscordClient* client,
+                                                  DiscordEventHandlers* handlers);
+
+DISCORD_EXPORT int Discord_Client_UpdatePresenceEx(DiscordClient* client,
+                                                   const DiscordRichPresence* presence,
+                                                   DiscordRequestCallback callback,
+                                                   void* userData);
+DISCORD_EXPORT int Discord_Client_RespondEx(DiscordClient* client,
+                                            const char* userid,
+                                            /* DISCORD_REPLY_ */ int reply,
+                                            DiscordRequestCallback callback,
+                                            void* userData);
+DISCORD_EXPORT int Discord_Client_SendCommand(DiscordClient* client,
+                                              const char* command,
+                                              const char* argsJson,
+                                              size_t argsLength,
+                                              DiscordRequestCallback callback,
+                                              void* userData);
+DISCORD_EXPORT int Discord_Client_SendCommandEx(DiscordClient* client,
+                                                const char* command,
+                                                const char* evt,
+                                                const char* argsJson,
+                                                size_t argsLength,
+                                                DiscordRequestCallback callback,
+                                                void* userData);
+DISCORD_EXPORT void Discord_Client_GetAckLatency(DiscordClient* client, DiscordLatencyStats* stats);
+DISCORD_EXPORT void Discord_Client_GetStats(DiscordClient* client, DiscordStats* stats);
+DISCORD_EXPORT int Discord_Client_StartFlightRecorder(DiscordClient* client,
+                                                      const char* path,
+                                                      uint32_t sizeBytes);
+DISCORD_EXPORT void Discord_Client_StopFlightRecorder(DiscordClient* client);
+DISCORD_EXPORT void Discord_Client_SetHealthCheck(DiscordClient* client,
+                                                  uint32_t pingIntervalMs,
+                                                  uint32_t timeoutMs);
+DISCORD_EXPORT void Discord_Client_GetConnectionHealth(DiscordClient* client,
+                                                       DiscordConnectionHealth* health);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
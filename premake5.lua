@@ -9,6 +9,18 @@ function os.getenv2(env)
     return os.getenv(env) or ""
 end
 
+newoption
+{
+    trigger = "low-memory",
+    description = "Build with the small memory profile (see src/rpc/memory_config.h)"
+}
+
+newoption
+{
+    trigger = "tracing",
+    description = "Build with trace scopes compiled in (see src/rpc/trace.h)"
+}
+
 function DeclareCompilationFlags()
     filter {}   -- reset configuration
 
@@ -28,6 +40,12 @@ function DeclareCompilationFlags()
         "DISCORD_WINDOWS"
     }
 
+    filter "options:low-memory"
+        defines { "DISCORD_LOW_MEMORY" }
+
+    filter "options:tracing"
+        defines { "DISCORD_ENABLE_TRACING" }
+
     filter "configurations:Debug"
         defines { "DISCORD_DEBUG" }
         optimize "Off"
@@ -68,6 +86,9 @@ function GenerateWorkspace()
         -- Include the projects we are going to build
         include "src/rpc"
         include "src/sample"
+        include "src/bench"
+        include "src/replay"
+        include "src/relay"
 end
 
 GenerateWorkspace()
@@ -0,0 +1,449 @@
+/*
+    Allocation audit. Once the library is up and connected it isn't supposed to touch the heap, and
+    this checks it: a warm-up session with the loopback mock of Discord (loopback_server.h) gets
+    the one-time work out of the way, then every allocation is counted through more sessions of
+    connecting, subscribed events and the handlers' answers to them, presence updates and being
+    hung up on. Counted are the global operator new, the library's allocator hooks and the C heap
+    itself, so a plain malloc from anywhere shows up too: on Windows through the CRT's allocation
+    hook, which is why these projects link the debug CRT in every configuration, and with glibc by
+    standing in for malloc and friends. Each allocating call stack is printed once, with how often
+    it came up, and the exit code is 1 if there were any.
+    Usage: alloc_audit [sessions]
+    AllocAudit runs the library's IO thread; AllocAuditManualIO calls Discord_UpdateConnection from
+    the update loop.
+*/
+
+#include "discord_rpc.h"
+
+#include "loopback_server.h"
+
+#include <atomic>
+#include <errno.h>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <crtdbg.h>
+#include <dbghelp.h>
+#include <malloc.h>
+#ifndef _DEBUG
+#error "the allocation hook is only there with the debug CRT; see premake5.lua"
+#endif
+#elif defined(__GLIBC__)
+#include <execinfo.h>
+#else
+#error "no way to see the C heap's allocations on this platform yet"
+#endif
+
+static const int PresenceUpdatesPerSession = 100;
+static const unsigned MaxFrames = 12;
+static const size_t MaxSites = 64;
+
+struct AllocationSite {
+    const char* kind;
+    void* frames[MaxFrames];
+    unsigned frameCount;
+    uint64_t count;
+    uint64_t bytes;
+};
+
+static std::atomic_bool Auditing{false};
+// Above zero while a thread is inside one of our own allocators, so the heap call they make
+// underneath isn't counted twice, and for good on the server thread: it stands in for Discord,
+// what it allocates isn't ours.
+static thread_local int NotCounting{0};
+
+static std::atomic_flag SitesLock = ATOMIC_FLAG_INIT;
+static AllocationSite Sites[MaxSites];
+static size_t SiteCount{0};
+// allocations from stacks that didn't fit in Sites
+static uint64_t Unrecorded{0};
+
+static unsigned CaptureFrames(void** frames, unsigned maxFrames)
+{
+#ifdef _WIN32
+    return ::CaptureStackBackTrace(0, (DWORD)maxFrames, frames, nullptr);
+#else
+    return (unsigned)backtrace(frames, (int)maxFrames);
+#endif
+}
+
+static void NoteAllocation(const char* kind, size_t size)
+{
+    if (!Auditing.load(std::memory_order_relaxed) || NotCounting) {
+        return;
+    }
+    // the unwinder can allocate too, and that's ours, not the library's
+    ++NotCounting;
+    // the first frame is this function
+    void* frames[MaxFrames + 1];
+    const unsigned captured = CaptureFrames(frames, MaxFrames + 1);
+    const unsigned frameCount = captured ? captured - 1 : 0;
+
+    while (SitesLock.test_and_set(std::memory_order_acquire)) {
+    }
+    size_t i = 0;
+    for (; i < SiteCount; ++i) {
+        auto& site = Sites[i];
+        if (site.kind == kind && site.frameCount == frameCount &&
+            memcmp(site.frames, frames + 1, frameCount * sizeof(void*)) == 0) {
+            break;
+        }
+    }
+    if (i == SiteCount && SiteCount < MaxSites) {
+        auto& site = Sites[SiteCount++];
+        site.kind = kind;
+        memcpy(site.frames, frames + 1, frameCount * sizeof(void*));
+        site.frameCount = frameCount;
+    }
+    if (i < SiteCount) {
+        ++Sites[i].count;
+        Sites[i].bytes += size;
+    }
+    else {
+        ++Unrecorded;
+    }
+    SitesLock.clear(std::memory_order_release);
+    --NotCounting;
+}
+
+static void* CountedMalloc(const char* kind, size_t size)
+{
+    NoteAllocation(kind, size);
+    ++NotCounting;
+    void* memory = malloc(size ? size : 1);
+    --NotCounting;
+    return memory;
+}
+
+static void* CountedAlignedMalloc(size_t size, size_t alignment)
+{
+    NoteAllocation("operator new (aligned)", size);
+    ++NotCounting;
+#ifdef _WIN32
+    void* memory = _aligned_malloc(size ? size : 1, alignment);
+#else
+    void* memory = nullptr;
+    if (posix_memalign(&memory, alignment, size ? size : 1) != 0) {
+        memory = nullptr;
+    }
+#endif
+    --NotCounting;
+    return memory;
+}
+
+static void AlignedFree(void* memory)
+{
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+// nothing in here is going to recover from running out, so don't pretend to
+static void* OrAbort(void* memory)
+{
+    if (!memory) {
+        abort();
+    }
+    return memory;
+}
+
+void* operator new(size_t size)
+{
+    return OrAbort(CountedMalloc("operator new", size));
+}
+
+void* operator new[](size_t size)
+{
+    return OrAbort(CountedMalloc("operator new[]", size));
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return CountedMalloc("operator new", size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return CountedMalloc("operator new[]", size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    return OrAbort(CountedAlignedMalloc(size, (size_t)alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return OrAbort(CountedAlignedMalloc(size, (size_t)alignment));
+}
+
+void operator delete(void* memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) noexcept
+{
+    free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+    AlignedFree(memory);
+}
+
+void operator delete[](void* memory, std::align_val_t) noexcept
+{
+    AlignedFree(memory);
+}
+
+void operator delete(void* memory, size_t, std::align_val_t) noexcept
+{
+    AlignedFree(memory);
+}
+
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept
+{
+    AlignedFree(memory);
+}
+
+static void* LibraryMalloc(size_t size, void*)
+{
+    return CountedMalloc("Discord_SetAllocator malloc", size);
+}
+
+static void* LibraryRealloc(void* ptr, size_t size, void*)
+{
+    NoteAllocation("Discord_SetAllocator realloc", size);
+    ++NotCounting;
+    void* memory = realloc(ptr, size);
+    --NotCounting;
+    return memory;
+}
+
+static void LibraryFree(void* ptr, void*)
+{
+    free(ptr);
+}
+
+// everything that comes out of the C heap, whoever asked for it
+#ifdef _WIN32
+static int CrtAllocHook(int allocType, void*, size_t size, int, long, const unsigned char*, int)
+{
+    if (allocType == _HOOK_ALLOC) {
+        NoteAllocation("malloc", size);
+    }
+    else if (allocType == _HOOK_REALLOC) {
+        NoteAllocation("realloc", size);
+    }
+    return TRUE;
+}
+#else
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+
+void* malloc(size_t size) noexcept
+{
+    NoteAllocation("malloc", size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) noexcept
+{
+    NoteAllocation("calloc", count * size);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) noexcept
+{
+    NoteAllocation("realloc", size);
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept
+{
+    NoteAllocation("memalign", size);
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    NoteAllocation("aligned_alloc", size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** memory, size_t alignment, size_t size) noexcept
+{
+    NoteAllocation("posix_memalign", size);
+    *memory = __libc_memalign(alignment, size);
+    return *memory ? 0 : ENOMEM;
+}
+
+// everything above comes from glibc's own heap, so it has to go back there
+void free(void* ptr) noexcept
+{
+    __libc_free(ptr);
+}
+}
+#endif
+
+static void PrintFrames(void* const* frames, unsigned frameCount)
+{
+#ifdef _WIN32
+    HANDLE process = ::GetCurrentProcess();
+    alignas(SYMBOL_INFO) char buffer[sizeof(SYMBOL_INFO) + 256];
+    auto symbol = reinterpret_cast<SYMBOL_INFO*>(buffer);
+    for (unsigned i = 0; i < frameCount; ++i) {
+        const DWORD64 address = (DWORD64)(uintptr_t)frames[i];
+        memset(buffer, 0, sizeof(buffer));
+        symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+        symbol->MaxNameLen = 255;
+        DWORD64 displacement = 0;
+        if (!::SymFromAddr(process, address, &displacement, symbol)) {
+            printf("        %p\n", frames[i]);
+            continue;
+        }
+        IMAGEHLP_LINE64 line;
+        memset(&line, 0, sizeof(line));
+        line.SizeOfStruct = sizeof(line);
+        DWORD lineDisplacement = 0;
+        if (::SymGetLineFromAddr64(process, address, &lineDisplacement, &line)) {
+            printf("        %s (%s:%lu)\n", symbol->Name, line.FileName, line.LineNumber);
+        }
+        else {
+            printf("        %s+0x%llx\n", symbol->Name, (unsigned long long)displacement);
+        }
+    }
+#else
+    fflush(stdout);
+    backtrace_symbols_fd(const_cast<void**>(frames), (int)frameCount, 1);
+#endif
+}
+
+static int Report(int sessions)
+{
+    if (!SiteCount && !Unrecorded) {
+        printf("no allocations in %d sessions after warm-up\n", sessions);
+        return 0;
+    }
+#ifdef _WIN32
+    ::SymSetOptions(SYMOPT_UNDNAME | SYMOPT_DEFERRED_LOADS | SYMOPT_LOAD_LINES);
+    ::SymInitialize(::GetCurrentProcess(), nullptr, TRUE);
+#endif
+    uint64_t total = Unrecorded;
+    for (size_t i = 0; i < SiteCount; ++i) {
+        total += Sites[i].count;
+    }
+    printf("%llu allocations in %d sessions after warm-up, from:\n",
+           (unsigned long long)total,
+           sessions);
+    for (size_t i = 0; i < SiteCount; ++i) {
+        const auto& site = Sites[i];
+        printf("    %s x%llu, %llu bytes\n",
+               site.kind,
+               (unsigned long long)site.count,
+               (unsigned long long)site.bytes);
+        PrintFrames(site.frames, site.frameCount);
+    }
+    if (Unrecorded) {
+        printf("    and %llu more from elsewhere\n", (unsigned long long)Unrecorded);
+    }
+#ifdef _WIN32
+    ::SymCleanup(::GetCurrentProcess());
+#endif
+    return 1;
+}
+
+// the mock stands in for Discord, what it allocates isn't ours
+static void StopCounting()
+{
+    NotCounting = 1;
+}
+
+static void Pump()
+{
+#ifdef DISCORD_DISABLE_IO_THREAD
+    Discord_UpdateConnection();
+#endif
+    Discord_RunCallbacks();
+}
+
+int main(int argc, char** argv)
+{
+    const int sessions = argc > 1 ? atoi(argv[1]) : 5;
+    if (sessions <= 0) {
+        printf("usage: alloc_audit [sessions]\n");
+        return 2;
+    }
+
+    // some platforms load the unwinder the first time round, and that allocates
+    void* frames[MaxFrames];
+    CaptureFrames(frames, MaxFrames);
+#ifdef _WIN32
+    _CrtSetAllocHook(CrtAllocHook);
+#endif
+    Discord_SetAllocator(LibraryMalloc, LibraryRealloc, LibraryFree, nullptr);
+
+    LoopbackMockStart(StopCounting);
+
+    DiscordEventHandlers handlers;
+    memset(&handlers, 0, sizeof(handlers));
+    LoopbackMockHandlers(&handlers);
+    Discord_Initialize("audit", &handlers, 0, nullptr);
+
+    // the first connection and everything that only ever happens once
+    bool ok = RunLoopbackSession(0, PresenceUpdatesPerSession, Pump);
+    if (ok) {
+        Auditing.store(true);
+        for (int session = 1; ok && session <= sessions; ++session) {
+            ok = RunLoopbackSession(session, PresenceUpdatesPerSession, Pump);
+        }
+        Auditing.store(false);
+    }
+
+    Discord_Shutdown();
+    LoopbackMockStop();
+
+    if (!ok) {
+        printf("a session with the stand-in server never finished\n");
+        return 2;
+    }
+#ifdef DISCORD_DISABLE_IO_THREAD
+    printf("manual IO: ");
+#else
+    printf("IO thread: ");
+#endif
+    return Report(sessions);
+}
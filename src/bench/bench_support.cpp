@@ -0,0 +1,44 @@
+#include "bench_support.h"
+
+#include <string.h>
+
+void CopyStringField(const char* json, const char* key, char* out, size_t outSize)
+{
+    out[0] = 0;
+    auto start = strstr(json, key);
+    if (!start) {
+        return;
+    }
+    start += strlen(key);
+    size_t i = 0;
+    for (; start[i] && start[i] != '"' && i + 1 < outSize; ++i) {
+        out[i] = start[i];
+    }
+    out[i] = 0;
+}
+
+#ifdef DISCORD_BENCH_STAND_IN
+
+#include "connection.h"
+
+int GetProcessId()
+{
+    return 1;
+}
+
+/*static*/ BaseConnection* BaseConnection::Create()
+{
+    return new BaseConnection();
+}
+
+/*static*/ void BaseConnection::Destroy(BaseConnection*& c)
+{
+    c->Close();
+    delete c;
+    c = nullptr;
+}
+
+// there's only the one stand-in to talk to
+/*static*/ void BaseConnection::SetPipeBaseName(const char*) {}
+
+#endif // DISCORD_BENCH_STAND_IN
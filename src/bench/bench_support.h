@@ -0,0 +1,12 @@
+#pragma once
+
+// Bits every library bench needs. bench_support.cpp goes into all of them; built with
+// DISCORD_BENCH_STAND_IN, it also brings the parts of BaseConnection that every stand-in for the
+// pipe does the same way, so a stand-in only has to supply ServerAvailable, Open, Close, Read and
+// Write.
+
+#include <stddef.h>
+
+// Copies the string that follows key in json into out, or makes out empty if key isn't there.
+// Good enough for the flat little messages the library sends, not for JSON in general.
+void CopyStringField(const char* json, const char* key, char* out, size_t outSize);
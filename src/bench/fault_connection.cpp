@@ -0,0 +1,377 @@
+#include "fault_connection.h"
+
+#include "bench_support.h"
+#include "connection.h"
+#include "rpc_connection.h"
+#include "timer_wheel.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+namespace {
+enum class Tag {
+    None,
+    Ready,
+    PresenceAck,
+};
+
+// a frame on its way to the library, or what's left of it
+struct Outbound {
+    std::vector<char> bytes;
+    size_t offset{0};
+    int64_t releaseUs{0};
+    Tag tag{Tag::None};
+    bool hangUp{false}; // the pipe breaks once this much has been read
+};
+} // namespace
+
+static const char ReadyMessage[] =
+  "{\"cmd\":\"DISPATCH\",\"data\":{\"v\":1,\"user\":{\"id\":\"1\",\"username\":\"stand-in\","
+  "\"discriminator\":\"0001\"}},\"evt\":\"READY\",\"nonce\":null}";
+
+// The library's IO and the benchmark's own thread both come through here.
+static std::mutex Mutex;
+static std::deque<Outbound> ToLibrary;
+static std::vector<char> FromLibrary; // whatever the library wrote that isn't a whole frame yet
+static bool PipeBroken{false};
+static bool Silent{false};
+static Fault Armed{Fault::None};
+static uint32_t ArmedDelayMs{0};
+static uint32_t ReplyDelayMs{0};
+static char WatchedDetails[128]{};
+static StandInTimeline Timeline{};
+static bool ServerUp{true};
+static uint32_t RateLimitHandshakes{0};
+static int64_t RateLimitWindowUs{0};
+static std::deque<int64_t> HandshakeTimesUs; // within the rate limit window
+
+static const char* FaultNames[] = {
+  "none",
+  "pipe reset",
+  "close frame",
+  "short read",
+  "short write",
+  "corrupt opcode",
+  "eof mid-frame",
+  "drop",
+  "delay",
+};
+static_assert(sizeof(FaultNames) / sizeof(FaultNames[0]) == (size_t)Fault::Count,
+              "a name for every fault");
+
+const char* FaultName(Fault fault)
+{
+    return fault < Fault::Count ? FaultNames[(int)fault] : "?";
+}
+
+// Queues a frame for the library, through whichever fault is armed. Mutex held.
+static void Send(RpcConnection::Opcode opcode, const char* body, Tag tag, bool hangUp = false)
+{
+    if (Silent) {
+        return;
+    }
+    RpcConnection::MessageFrameHeader header{opcode, (uint32_t)strlen(body)};
+    Outbound frame;
+    frame.bytes.resize(sizeof(header) + header.length);
+    memcpy(frame.bytes.data(), &header, sizeof(header));
+    memcpy(frame.bytes.data() + sizeof(header), body, header.length);
+    frame.releaseUs = MonotonicNowUs() + (int64_t)ReplyDelayMs * 1000;
+    frame.tag = tag;
+    frame.hangUp = hangUp;
+
+    // a frame that doesn't arrive whole doesn't count for anything
+    const size_t half = sizeof(header) + header.length / 2;
+    switch (Armed) {
+    case Fault::ShortRead: {
+        Armed = Fault::None;
+        Outbound rest;
+        rest.bytes.assign(frame.bytes.begin() + half, frame.bytes.end());
+        rest.releaseUs = frame.releaseUs + (int64_t)ArmedDelayMs * 1000;
+        rest.tag = tag;
+        rest.hangUp = hangUp;
+        frame.bytes.resize(half);
+        frame.tag = Tag::None;
+        frame.hangUp = false;
+        ToLibrary.push_back(std::move(frame));
+        ToLibrary.push_back(std::move(rest));
+        return;
+    }
+    case Fault::CorruptOpcode: {
+        Armed = Fault::None;
+        const uint32_t bogus = 0x7f;
+        memcpy(frame.bytes.data(), &bogus, sizeof(bogus));
+        frame.tag = Tag::None;
+        break;
+    }
+    case Fault::EofMidFrame:
+        Armed = Fault::None;
+        frame.bytes.resize(half);
+        frame.tag = Tag::None;
+        frame.hangUp = true;
+        break;
+    default:
+        break;
+    }
+    ToLibrary.push_back(std::move(frame));
+}
+
+// The fake Discord's side of things. Mutex held.
+static void Answer(RpcConnection::Opcode opcode, const char* body)
+{
+    switch (opcode) {
+    case RpcConnection::Opcode::Handshake: {
+        ++Timeline.handshakes;
+        const int64_t nowUs = MonotonicNowUs();
+        while (!HandshakeTimesUs.empty() &&
+               nowUs - HandshakeTimesUs.front() >= RateLimitWindowUs) {
+            HandshakeTimesUs.pop_front();
+        }
+        HandshakeTimesUs.push_back(nowUs);
+        if (RateLimitHandshakes && HandshakeTimesUs.size() > RateLimitHandshakes) {
+            ++Timeline.rateLimited;
+            Send(RpcConnection::Opcode::Close,
+                 "{\"code\":4002,\"message\":\"Rate limited\"}",
+                 Tag::None,
+                 true);
+            break;
+        }
+        Send(RpcConnection::Opcode::Frame, ReadyMessage, Tag::Ready);
+        break;
+    }
+    case RpcConnection::Opcode::Frame: {
+        char cmd[64], nonce[32], details[128], reply[256];
+        CopyStringField(body, "\"cmd\":\"", cmd, sizeof(cmd));
+        CopyStringField(body, "\"nonce\":\"", nonce, sizeof(nonce));
+        CopyStringField(body, "\"details\":\"", details, sizeof(details));
+        const bool watched = !strcmp(cmd, "SET_ACTIVITY") && WatchedDetails[0] &&
+          !strcmp(details, WatchedDetails);
+        snprintf(reply,
+                 sizeof(reply),
+                 "{\"cmd\":\"%s\",\"data\":{},\"evt\":null,\"nonce\":\"%s\"}",
+                 cmd,
+                 nonce);
+        Send(RpcConnection::Opcode::Frame, reply, watched ? Tag::PresenceAck : Tag::None);
+        break;
+    }
+    case RpcConnection::Opcode::Ping:
+        Send(RpcConnection::Opcode::Pong, body, Tag::None);
+        break;
+    case RpcConnection::Opcode::Close:
+    default:
+        PipeBroken = true;
+        break;
+    }
+}
+
+/*static*/ bool BaseConnection::ServerAvailable()
+{
+    std::lock_guard<std::mutex> guard(Mutex);
+    return ServerUp;
+}
+
+// Mutex held.
+static void HangUp(BaseConnection* c)
+{
+    if (c->isOpen) {
+        Timeline.closedUs = MonotonicNowUs();
+    }
+    c->isOpen = false;
+    ToLibrary.clear();
+    FromLibrary.clear();
+}
+
+bool BaseConnection::Open()
+{
+    std::lock_guard<std::mutex> guard(Mutex);
+    if (!ServerUp) {
+        return false;
+    }
+    ToLibrary.clear();
+    FromLibrary.clear();
+    PipeBroken = false;
+    // a fresh connection gets a Discord that's paying attention again
+    Silent = false;
+    isOpen = true;
+    return true;
+}
+
+bool BaseConnection::Close()
+{
+    std::lock_guard<std::mutex> guard(Mutex);
+    HangUp(this);
+    return true;
+}
+
+bool BaseConnection::Write(const void* data, size_t length)
+{
+    std::lock_guard<std::mutex> guard(Mutex);
+    if (!isOpen || PipeBroken) {
+        return false;
+    }
+    if (Silent) {
+        return true;
+    }
+    auto bytes = static_cast<const char*>(data);
+    if (Armed == Fault::ShortWrite) {
+        Armed = Fault::None;
+        FromLibrary.insert(FromLibrary.end(), bytes, bytes + length / 2);
+        PipeBroken = true;
+        return false;
+    }
+    FromLibrary.insert(FromLibrary.end(), bytes, bytes + length);
+
+    RpcConnection::MessageFrameHeader header;
+    size_t offset = 0;
+    std::vector<char> body;
+    while (FromLibrary.size() - offset >= sizeof(header)) {
+        memcpy(&header, FromLibrary.data() + offset, sizeof(header));
+        if (FromLibrary.size() - offset - sizeof(header) < header.length) {
+            break;
+        }
+        const char* start = FromLibrary.data() + offset + sizeof(header);
+        body.assign(start, start + header.length);
+        body.push_back(0);
+        offset += sizeof(header) + header.length;
+        Answer(header.opcode, body.data());
+    }
+    FromLibrary.erase(FromLibrary.begin(), FromLibrary.begin() + offset);
+    return true;
+}
+
+// Like a pipe: all of it or nothing, and nothing past a frame that isn't due yet.
+bool BaseConnection::Read(void* data, size_t length)
+{
+    std::lock_guard<std::mutex> guard(Mutex);
+    if (!isOpen) {
+        return false;
+    }
+    if (PipeBroken) {
+        HangUp(this);
+        return false;
+    }
+    const int64_t nowUs = MonotonicNowUs();
+    size_t available = 0;
+    bool hangUpPending = false;
+    for (auto& frame : ToLibrary) {
+        if (frame.releaseUs > nowUs) {
+            break;
+        }
+        available += frame.bytes.size() - frame.offset;
+        if (frame.hangUp) {
+            hangUpPending = true;
+            break;
+        }
+    }
+    if (available < length) {
+        if (hangUpPending) {
+            HangUp(this);
+        }
+        return false;
+    }
+
+    auto out = static_cast<char*>(data);
+    while (length) {
+        auto& frame = ToLibrary.front();
+        const size_t chunk = std::min(length, frame.bytes.size() - frame.offset);
+        memcpy(out, frame.bytes.data() + frame.offset, chunk);
+        out += chunk;
+        length -= chunk;
+        frame.offset += chunk;
+        if (frame.offset < frame.bytes.size()) {
+            continue;
+        }
+        if (frame.tag == Tag::Ready) {
+            Timeline.readyUs = nowUs;
+            ++Timeline.sessions;
+        }
+        else if (frame.tag == Tag::PresenceAck) {
+            Timeline.presenceAckUs = nowUs;
+        }
+        PipeBroken = PipeBroken || frame.hangUp;
+        ToLibrary.pop_front();
+    }
+    return true;
+}
+
+void ArmFault(Fault fault, uint32_t delayMs)
+{
+    std::lock_guard<std::mutex> guard(Mutex);
+    switch (fault) {
+    case Fault::None:
+        break;
+    case Fault::PipeReset:
+        PipeBroken = true;
+        break;
+    case Fault::CloseFrame:
+        Send(RpcConnection::Opcode::Close,
+             "{\"code\":1000,\"message\":\"Stand-in hung up\"}",
+             Tag::None,
+             true);
+        break;
+    case Fault::Drop:
+        Silent = true;
+        break;
+    case Fault::Delay:
+        ReplyDelayMs = delayMs;
+        break;
+    default:
+        Armed = fault;
+        ArmedDelayMs = delayMs;
+        break;
+    }
+}
+
+void ClearFaults()
+{
+    std::lock_guard<std::mutex> guard(Mutex);
+    Armed = Fault::None;
+    ReplyDelayMs = 0;
+    Silent = false;
+}
+
+void SetServerAvailable(bool available)
+{
+    std::lock_guard<std::mutex> guard(Mutex);
+    ServerUp = available;
+    PipeBroken = PipeBroken || !available;
+}
+
+void SetHandshakeRateLimit(uint32_t maxHandshakes, uint32_t windowMs)
+{
+    std::lock_guard<std::mutex> guard(Mutex);
+    RateLimitHandshakes = maxHandshakes;
+    RateLimitWindowUs = (int64_t)windowMs * 1000;
+    HandshakeTimesUs.clear();
+}
+
+void ResetStandIn()
+{
+    std::lock_guard<std::mutex> guard(Mutex);
+    ToLibrary.clear();
+    FromLibrary.clear();
+    HandshakeTimesUs.clear();
+    PipeBroken = false;
+    Silent = false;
+    ServerUp = true;
+    Armed = Fault::None;
+    ReplyDelayMs = 0;
+    RateLimitHandshakes = 0;
+    WatchedDetails[0] = 0;
+    Timeline = StandInTimeline{};
+}
+
+void WatchPresence(const char* details)
+{
+    std::lock_guard<std::mutex> guard(Mutex);
+    snprintf(WatchedDetails, sizeof(WatchedDetails), "%s", details);
+}
+
+void GetStandInTimeline(StandInTimeline* timeline)
+{
+    std::lock_guard<std::mutex> guard(Mutex);
+    *timeline = Timeline;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+// A stand-in for the platform connection with a fake Discord on the other end, in process, and a
+// layer in between that breaks things on request. Benchmarks compile fault_connection.cpp in place
+// of connection_win.cpp, so everything above BaseConnection -- RpcConnection's state machine, the
+// reconnect backoff, restoring the session -- is the real thing.
+//
+// The fake Discord answers the handshake with READY, every command with an empty success reply and
+// every ping with a pong. Faults act on whole frames going either way, the same way a real pipe
+// lets us down: a one-shot fault goes off on the next frame it applies to, the rest hold until
+// ClearFaults or, for Drop, until the library hangs up.
+
+#include <stdint.h>
+
+enum class Fault : int {
+    None,
+    PipeReset,     // the pipe breaks: reads and writes fail from now on
+    CloseFrame,    // Discord sends Close and hangs up
+    ShortRead,     // one-shot: a reply arrives in two pieces, the second delayMs later
+    ShortWrite,    // one-shot: a write only gets half way, and Discord hangs up on the torn frame
+    CorruptOpcode, // one-shot: a reply comes with an opcode nobody has heard of
+    EofMidFrame,   // one-shot: the pipe closes half way through a reply
+    Drop,          // Discord goes quiet: writes vanish and nothing comes back
+    Delay,         // every reply shows up delayMs late
+    Count,
+};
+
+const char* FaultName(Fault fault);
+
+void ArmFault(Fault fault, uint32_t delayMs = 0);
+void ClearFaults();
+
+// What the library's side of the pipe has seen. Times are when it last happened, MonotonicNowUs,
+// or 0 if never.
+struct StandInTimeline {
+    int64_t closedUs;      // it hung up its end, whoever noticed first
+    int64_t readyUs;       // it read all of a READY
+    int64_t presenceAckUs; // it read all of the reply to a SET_ACTIVITY with the watched details
+    uint32_t sessions;     // READYs read
+    uint32_t handshakes;   // handshakes received, rate limited or not
+    uint32_t rateLimited;  // handshakes turned away by SetHandshakeRateLimit
+};
+
+// Whether there's a Discord to connect to at all. Taking it away breaks the pipe too.
+void SetServerAvailable(bool available);
+// Past maxHandshakes in any windowMs, a handshake is answered with Close code 4002, the way Discord
+// turns away clients that connect too often. Turned away handshakes count against the limit too.
+// 0 turns it off.
+void SetHandshakeRateLimit(uint32_t maxHandshakes, uint32_t windowMs);
+// Back to a fresh Discord: available, no faults or limit, an empty timeline.
+void ResetStandIn();
+
+// Replies to SET_ACTIVITY only count towards presenceAckUs while the details match this.
+void WatchPresence(const char* details);
+void GetStandInTimeline(StandInTimeline* timeline);
@@ -0,0 +1,397 @@
+/*
+    End to end latency against a stand-in Discord:
+      presence: Discord_UpdatePresence returning -> the frame arriving at the server
+      join:     the server writing ACTIVITY_JOIN -> our joinGame callback running
+    Usage: latency_bench [updates per second] [seconds]
+    LatencyBench runs the library's IO thread; LatencyBenchManualIO calls Discord_UpdateConnection
+    from the update loop, right after each presence update. Both talk to the server over a named
+    pipe; the Loopback flavours swap the pipe for in-process rings (loopback_connection.h), which
+    leaves just the library's own costs, so the difference between the two is the pipe's.
+    Both sides spin rather than sleep between ticks, so expect two busy cores while it runs.
+*/
+
+#include "discord_rpc.h"
+
+#include "bench_support.h"
+#include "connection.h"
+#include "latency_histogram.h"
+#include "timer_wheel.h"
+
+#ifdef DISCORD_BENCH_LOOPBACK
+#include "loopback_connection.h"
+#else
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#ifdef DISCORD_BENCH_LOOPBACK
+
+// The server's end of the rings.
+struct ServerEnd {
+    bool Listen()
+    {
+        LoopbackListen();
+        return true;
+    }
+
+    bool Accept() { return LoopbackAccept(5000); }
+
+    // false once the library has hung up and there's nothing left to read
+    bool Peek(size_t* available)
+    {
+        *available = LoopbackServerAvailable();
+        return *available > 0 || LoopbackClientConnected();
+    }
+
+    // the library writes whole frames, so once a header is in the rest is right behind it
+    bool ReadExact(void* data, size_t length)
+    {
+        while (!LoopbackServerRead(data, length)) {
+            if (!LoopbackClientConnected() && LoopbackServerAvailable() < length) {
+                return false;
+            }
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    bool Write(const void* data, size_t length) { return LoopbackServerWrite(data, length); }
+
+    // stops accepting, so anything still waiting for the library to connect gives up
+    void Close() { LoopbackServerClose(); }
+};
+
+static const char* TransportName = "loopback";
+
+#else
+
+static const char* PipeBaseName = "discord-bench-ipc-";
+static const wchar_t* PipeName = L"\\\\.\\pipe\\discord-bench-ipc-0";
+
+// The server's end of the named pipe.
+struct ServerEnd {
+    HANDLE pipe{INVALID_HANDLE_VALUE};
+
+    bool Listen()
+    {
+        BaseConnection::SetPipeBaseName(PipeBaseName);
+        pipe = ::CreateNamedPipeW(PipeName,
+                                  PIPE_ACCESS_DUPLEX,
+                                  PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
+                                  1,
+                                  64 * 1024,
+                                  64 * 1024,
+                                  0,
+                                  nullptr);
+        if (pipe == INVALID_HANDLE_VALUE) {
+            printf("couldn't create %ls (%lu)\n", PipeName, ::GetLastError());
+            return false;
+        }
+        return true;
+    }
+
+    bool Accept()
+    {
+        return ::ConnectNamedPipe(pipe, nullptr) || ::GetLastError() == ERROR_PIPE_CONNECTED;
+    }
+
+    bool Peek(size_t* available)
+    {
+        DWORD bytes = 0;
+        if (!::PeekNamedPipe(pipe, nullptr, 0, nullptr, &bytes, nullptr)) {
+            return false;
+        }
+        *available = bytes;
+        return true;
+    }
+
+    bool ReadExact(void* data, size_t length)
+    {
+        auto out = static_cast<char*>(data);
+        while (length) {
+            DWORD read = 0;
+            if (!::ReadFile(pipe, out, (DWORD)length, &read, nullptr) || read == 0) {
+                return false;
+            }
+            out += read;
+            length -= read;
+        }
+        return true;
+    }
+
+    bool Write(const void* data, size_t length)
+    {
+        DWORD written = 0;
+        return ::WriteFile(pipe, data, (DWORD)length, &written, nullptr) && written == length;
+    }
+
+    void Close()
+    {
+        // if the library never got as far as connecting, Accept is still waiting for it
+        HANDLE unblock = ::CreateFileW(
+          PipeName, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (unblock != INVALID_HANDLE_VALUE) {
+            ::CloseHandle(unblock);
+        }
+    }
+
+    ~ServerEnd()
+    {
+        if (pipe != INVALID_HANDLE_VALUE) {
+            ::CloseHandle(pipe);
+        }
+    }
+};
+
+static const char* TransportName = "pipe";
+
+#endif
+
+struct Samples {
+    std::vector<int64_t> sentUs;
+    std::vector<int64_t> arrivedUs;
+
+    void Resize(size_t count)
+    {
+        sentUs.assign(count, 0);
+        arrivedUs.assign(count, 0);
+    }
+};
+
+// indexed by sequence number; each slot is written by one side only
+static Samples Presence;
+static Samples Joins;
+static std::atomic_bool Running{true};
+static std::atomic_bool Ready{false};
+
+static bool WriteFrame(ServerEnd& server, uint32_t opcode, const char* body)
+{
+    char frame[4096];
+    const uint32_t length = (uint32_t)strlen(body);
+    if (length + 8 > sizeof(frame)) {
+        return false;
+    }
+    memcpy(frame, &opcode, 4);
+    memcpy(frame + 4, &length, 4);
+    memcpy(frame + 8, body, length);
+    return server.Write(frame, length + 8);
+}
+
+static void Serve(ServerEnd& server, int joinsPerSecond)
+{
+    static char body[64 * 1024];
+    uint32_t header[2];
+
+    if (!server.ReadExact(header, sizeof(header)) || header[1] >= sizeof(body) ||
+        !server.ReadExact(body, header[1])) {
+        return;
+    }
+    WriteFrame(server,
+               1,
+               "{\"cmd\":\"DISPATCH\",\"data\":{\"v\":1,\"user\":{\"id\":\"1\",\"username\":"
+               "\"bench\",\"discriminator\":\"0001\"}},\"evt\":\"READY\",\"nonce\":null}");
+
+    const int64_t joinIntervalUs = joinsPerSecond > 0 ? 1000000 / joinsPerSecond : 0;
+    int64_t nextJoinUs = MonotonicNowUs() + joinIntervalUs;
+    size_t joinSeq = 0;
+
+    while (Running.load()) {
+        size_t available = 0;
+        if (!server.Peek(&available)) {
+            return;
+        }
+        if (available >= sizeof(header)) {
+            if (!server.ReadExact(header, sizeof(header)) || header[1] >= sizeof(body) ||
+                !server.ReadExact(body, header[1])) {
+                return;
+            }
+            const int64_t nowUs = MonotonicNowUs();
+            body[header[1]] = 0;
+            if (header[0] == 2) {
+                return;
+            }
+            if (header[0] == 3) {
+                WriteFrame(server, 4, body);
+                continue;
+            }
+
+            char seq[32];
+            CopyStringField(body, "\"details\":\"seq ", seq, sizeof(seq));
+            if (seq[0]) {
+                const size_t index = (size_t)atoi(seq);
+                if (index < Presence.arrivedUs.size()) {
+                    Presence.arrivedUs[index] = nowUs;
+                }
+            }
+
+            // answer like Discord would, so nothing sits waiting on a reply
+            char cmd[64], nonce[32], reply[256];
+            CopyStringField(body, "\"cmd\":\"", cmd, sizeof(cmd));
+            CopyStringField(body, "\"nonce\":\"", nonce, sizeof(nonce));
+            snprintf(reply,
+                     sizeof(reply),
+                     "{\"cmd\":\"%s\",\"data\":{},\"evt\":null,\"nonce\":\"%s\"}",
+                     cmd,
+                     nonce);
+            WriteFrame(server, 1, reply);
+            continue;
+        }
+
+        const int64_t nowUs = MonotonicNowUs();
+        if (joinIntervalUs && nowUs >= nextJoinUs && joinSeq < Joins.sentUs.size()) {
+            char join[256];
+            snprintf(join,
+                     sizeof(join),
+                     "{\"cmd\":\"DISPATCH\",\"data\":{\"secret\":\"%u\"},\"evt\":\"ACTIVITY_JOIN\","
+                     "\"nonce\":null}",
+                     (unsigned)joinSeq);
+            Joins.sentUs[joinSeq++] = MonotonicNowUs();
+            if (!WriteFrame(server, 1, join)) {
+                return;
+            }
+            nextJoinUs += joinIntervalUs;
+        }
+        std::this_thread::yield();
+    }
+}
+
+static void HandleReady(const DiscordUser*)
+{
+    Ready.store(true);
+}
+
+static void HandleJoinGame(const char* secret)
+{
+    const int64_t nowUs = MonotonicNowUs();
+    const size_t index = (size_t)atoi(secret);
+    if (index < Joins.arrivedUs.size()) {
+        Joins.arrivedUs[index] = nowUs;
+    }
+}
+
+static void Pump()
+{
+#ifdef DISCORD_DISABLE_IO_THREAD
+    Discord_UpdateConnection();
+#endif
+    Discord_RunCallbacks();
+}
+
+static void Report(const char* name, const Samples& samples, size_t sent)
+{
+    LatencyHistogram histogram;
+    size_t lost = 0;
+    for (size_t i = 0; i < sent; ++i) {
+        if (!samples.sentUs[i]) {
+            continue;
+        }
+        if (samples.arrivedUs[i] >= samples.sentUs[i]) {
+            histogram.Record((uint64_t)(samples.arrivedUs[i] - samples.sentUs[i]));
+        }
+        else {
+            ++lost;
+        }
+    }
+    DiscordLatencyStats stats;
+    histogram.Snapshot(&stats);
+    printf("%-22s n=%-7llu p50=%-8llu p99=%-8llu p999=%-8llu max=%-8llu (us)  missing=%u\n",
+           name,
+           (unsigned long long)stats.count,
+           (unsigned long long)stats.p50Us,
+           (unsigned long long)stats.p99Us,
+           (unsigned long long)stats.p999Us,
+           (unsigned long long)stats.maxUs,
+           (unsigned)lost);
+}
+
+int main(int argc, char** argv)
+{
+    const int updatesPerSecond = argc > 1 ? atoi(argv[1]) : 60;
+    const int seconds = argc > 2 ? atoi(argv[2]) : 10;
+    if (updatesPerSecond <= 0 || seconds <= 0) {
+        printf("usage: latency_bench [updates per second] [seconds]\n");
+        return 1;
+    }
+    const size_t total = (size_t)updatesPerSecond * (size_t)seconds;
+    Presence.Resize(total);
+    Joins.Resize(total);
+
+    static ServerEnd serverEnd;
+    if (!serverEnd.Listen()) {
+        return 1;
+    }
+    std::thread server([updatesPerSecond]() {
+        if (serverEnd.Accept()) {
+            Serve(serverEnd, updatesPerSecond);
+        }
+    });
+
+    DiscordEventHandlers handlers;
+    memset(&handlers, 0, sizeof(handlers));
+    handlers.ready = HandleReady;
+    handlers.joinGame = HandleJoinGame;
+    Discord_Initialize("bench", &handlers, 0, nullptr);
+
+    const int64_t readyDeadlineUs = MonotonicNowUs() + 5 * 1000 * 1000;
+    while (!Ready.load() && MonotonicNowUs() < readyDeadlineUs) {
+        Pump();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!Ready.load()) {
+        printf("never connected to the stand-in server\n");
+        Running.store(false);
+        Discord_Shutdown();
+        serverEnd.Close();
+        server.join();
+        return 1;
+    }
+
+    const int64_t tickUs = 1000000 / updatesPerSecond;
+    int64_t nextTickUs = MonotonicNowUs();
+    char details[32];
+    DiscordRichPresence presence;
+    memset(&presence, 0, sizeof(presence));
+    presence.state = "Benchmarking";
+    presence.details = details;
+    for (size_t seq = 0; seq < total; ++seq) {
+        snprintf(details, sizeof(details), "seq %u", (unsigned)seq);
+        Discord_UpdatePresence(&presence);
+        Presence.sentUs[seq] = MonotonicNowUs();
+        Pump();
+
+        nextTickUs += tickUs;
+        while (MonotonicNowUs() < nextTickUs) {
+            std::this_thread::yield();
+        }
+    }
+    // give the last few a moment to land
+    const int64_t drainUntilUs = MonotonicNowUs() + 100 * 1000;
+    while (MonotonicNowUs() < drainUntilUs) {
+        Pump();
+        std::this_thread::yield();
+    }
+
+    Running.store(false);
+    Discord_Shutdown();
+    server.join();
+    serverEnd.Close();
+
+#ifdef DISCORD_DISABLE_IO_THREAD
+    printf("manual IO over %s, %d updates/s for %ds\n", TransportName, updatesPerSecond, seconds);
+#else
+    printf("IO thread over %s, %d updates/s for %ds\n", TransportName, updatesPerSecond, seconds);
+#endif
+    // a presence replaced before the IO got to it is never sent, so it shows up as missing
+    Report("presence -> wire", Presence, total);
+    Report("wire -> joinGame", Joins, total);
+    return 0;
+}
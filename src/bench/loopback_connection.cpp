@@ -0,0 +1,202 @@
+#include "loopback_connection.h"
+
+#include "connection.h"
+#include "memory_config.h"
+#include "timer_wheel.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+
+namespace {
+// Room for a few of the biggest frames either side can write, so a writer waits on the reader
+// about as often as it would on a pipe.
+constexpr size_t RingSize{4 * DISCORD_MAX_FRAME_SIZE};
+static_assert((RingSize & (RingSize - 1)) == 0, "RingSize has to be a power of two");
+
+// head and tail count bytes ever written and read, so the difference is what's buffered. Each is
+// only stored by its own side, and on its own cache line so the two sides don't fight over it.
+class ByteRing {
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) std::atomic<uint64_t> tail_{0};
+    alignas(64) char data_[RingSize];
+
+public:
+    // only while neither side is using it
+    void Reset()
+    {
+        head_.store(0, std::memory_order_relaxed);
+        tail_.store(0, std::memory_order_relaxed);
+    }
+
+    size_t Readable() const
+    {
+        return (size_t)(head_.load(std::memory_order_acquire) -
+                        tail_.load(std::memory_order_relaxed));
+    }
+
+    size_t Writable() const
+    {
+        return RingSize -
+          (size_t)(head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_acquire));
+    }
+
+    // producer; caller checked Writable
+    void Write(const void* data, size_t length)
+    {
+        const uint64_t head = head_.load(std::memory_order_relaxed);
+        const size_t offset = (size_t)(head & (RingSize - 1));
+        const size_t first = length < RingSize - offset ? length : RingSize - offset;
+        memcpy(data_ + offset, data, first);
+        memcpy(data_, static_cast<const char*>(data) + first, length - first);
+        head_.store(head + length, std::memory_order_release);
+    }
+
+    // consumer; caller checked Readable
+    void Read(void* data, size_t length)
+    {
+        const uint64_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t offset = (size_t)(tail & (RingSize - 1));
+        const size_t first = length < RingSize - offset ? length : RingSize - offset;
+        memcpy(data, data_ + offset, first);
+        memcpy(static_cast<char*>(data) + first, data_, length - first);
+        tail_.store(tail + length, std::memory_order_release);
+    }
+};
+
+enum class LoopbackState : int {
+    Idle,
+    Listening,
+    Connected,
+    HungUp, // by either end; the server goes back to Idle or Listening from here
+};
+} // namespace
+
+static ByteRing ToServer;
+static ByteRing ToClient;
+static std::atomic<LoopbackState> State{LoopbackState::Idle};
+
+/*static*/ bool BaseConnection::ServerAvailable()
+{
+    return State.load() == LoopbackState::Listening;
+}
+
+bool BaseConnection::Open()
+{
+    auto expected = LoopbackState::Listening;
+    if (!State.compare_exchange_strong(expected, LoopbackState::Connected)) {
+        return false;
+    }
+    isOpen = true;
+    return true;
+}
+
+bool BaseConnection::Close()
+{
+    if (isOpen) {
+        auto expected = LoopbackState::Connected;
+        State.compare_exchange_strong(expected, LoopbackState::HungUp);
+    }
+    isOpen = false;
+    return true;
+}
+
+bool BaseConnection::Write(const void* data, size_t length)
+{
+    if (length == 0) {
+        return true;
+    }
+    if (!isOpen || length > RingSize) {
+        return false;
+    }
+    while (ToServer.Writable() < length) {
+        if (State.load() != LoopbackState::Connected) {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    if (State.load() != LoopbackState::Connected) {
+        return false;
+    }
+    ToServer.Write(data, length);
+    return true;
+}
+
+bool BaseConnection::Read(void* data, size_t length)
+{
+    if (!isOpen) {
+        return false;
+    }
+    if (State.load() != LoopbackState::Connected) {
+        // the pipe drops whatever was still in it when the server hangs up
+        Close();
+        return false;
+    }
+    if (ToClient.Readable() < length) {
+        return false;
+    }
+    ToClient.Read(data, length);
+    return true;
+}
+
+void LoopbackListen()
+{
+    ToServer.Reset();
+    ToClient.Reset();
+    State.store(LoopbackState::Listening);
+}
+
+bool LoopbackAccept(int timeoutMs)
+{
+    const int64_t deadlineMs = MonotonicNowMs() + timeoutMs;
+    while (State.load() != LoopbackState::Connected) {
+        if (State.load() == LoopbackState::Idle || MonotonicNowMs() > deadlineMs) {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+bool LoopbackClientConnected()
+{
+    return State.load() == LoopbackState::Connected;
+}
+
+size_t LoopbackServerAvailable()
+{
+    return ToServer.Readable();
+}
+
+bool LoopbackServerRead(void* data, size_t length)
+{
+    if (ToServer.Readable() < length) {
+        return false;
+    }
+    ToServer.Read(data, length);
+    return true;
+}
+
+bool LoopbackServerWrite(const void* data, size_t length)
+{
+    if (length > RingSize) {
+        return false;
+    }
+    while (ToClient.Writable() < length) {
+        if (State.load() != LoopbackState::Connected) {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    if (State.load() != LoopbackState::Connected) {
+        return false;
+    }
+    ToClient.Write(data, length);
+    return true;
+}
+
+void LoopbackServerClose()
+{
+    State.store(LoopbackState::Idle);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+// A stand-in for the platform connection made of two single producer, single consumer byte rings
+// in our own memory, with a mock server thread on the far end. Nothing goes near the kernel, so a
+// benchmark built on it measures RpcConnection, serialization and dispatch and nothing else; run it
+// next to the same benchmark over the real pipe to see what the pipe costs. Compile
+// loopback_connection.cpp in place of connection_win.cpp.
+//
+// It behaves like the pipe where the library can tell: reads are all or nothing and never wait,
+// writes wait for room, and once either end hangs up the other's reads and writes fail. One
+// connection at a time.
+
+#include <stddef.h>
+
+// The mock server's end. Call these from one thread, except LoopbackServerClose.
+
+// Starts accepting a connection; until then the library sees no server.
+void LoopbackListen();
+// Waits up to timeoutMs for the library to connect, or until LoopbackServerClose.
+bool LoopbackAccept(int timeoutMs);
+bool LoopbackClientConnected();
+// Bytes the library has written that we haven't read yet.
+size_t LoopbackServerAvailable();
+// All of it or nothing, without waiting.
+bool LoopbackServerRead(void* data, size_t length);
+// Waits for room while the library is connected; false once it isn't.
+bool LoopbackServerWrite(const void* data, size_t length);
+// Hangs up on the library and stops accepting.
+void LoopbackServerClose();
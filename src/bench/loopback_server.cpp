@@ -0,0 +1,281 @@
+#include "loopback_server.h"
+
+#include "bench_support.h"
+#include "loopback_connection.h"
+#include "timer_wheel.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+// The mock serves a connection each time it's told to listen, until it's told to hang up. It's
+// only told to listen again once the library has seen the hang up, so the rings are never reset
+// under it.
+static std::thread Server;
+static std::atomic_bool Running{false};
+static std::atomic_bool Listen{false};
+static std::atomic_bool HangUp{false};
+// the number in the details of the last presence that came in
+static std::atomic_int LastUpdate{-1};
+
+static std::atomic_int Connects{0};
+static std::atomic_int Disconnects{0};
+
+// the ACTIVITY_ events the library has subscribed to on this connection, as bits
+static const int EventJoin = 1;
+static const int EventSpectate = 2;
+static const int EventJoinRequest = 4;
+static const int AllEvents = EventJoin | EventSpectate | EventJoinRequest;
+static std::atomic_int Subscribed{0};
+// set to have the mock send one of each subscribed event
+static std::atomic_bool PushEvents{false};
+// answers to those events: the handlers' commands arriving at the mock, and their replies
+// getting back to the handlers
+static std::atomic_int Answers{0};
+static std::atomic_int Replies{0};
+
+static bool WriteFrame(uint32_t opcode, const char* body)
+{
+    char frame[4096];
+    const uint32_t length = (uint32_t)strlen(body);
+    if (length + 8 > sizeof(frame)) {
+        return false;
+    }
+    memcpy(frame, &opcode, 4);
+    memcpy(frame + 4, &length, 4);
+    memcpy(frame + 8, body, length);
+    return LoopbackServerWrite(frame, length + 8);
+}
+
+// waits for all of it, unless either end hangs up first
+static bool ReadExact(void* data, size_t length)
+{
+    while (!LoopbackServerRead(data, length)) {
+        if (!LoopbackClientConnected() || HangUp.load()) {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+static void WriteEvents()
+{
+    const int subscribed = Subscribed.load();
+    if (subscribed & EventJoin) {
+        WriteFrame(1,
+                   "{\"cmd\":\"DISPATCH\",\"data\":{\"secret\":\"2\"},\"evt\":\"ACTIVITY_JOIN\","
+                   "\"nonce\":null}");
+    }
+    if (subscribed & EventSpectate) {
+        WriteFrame(1,
+                   "{\"cmd\":\"DISPATCH\",\"data\":{\"secret\":\"3\"},\"evt\":"
+                   "\"ACTIVITY_SPECTATE\",\"nonce\":null}");
+    }
+    if (subscribed & EventJoinRequest) {
+        WriteFrame(1,
+                   "{\"cmd\":\"DISPATCH\",\"data\":{\"user\":{\"id\":\"4\",\"username\":"
+                   "\"asker\",\"discriminator\":\"0004\",\"avatar\":null}},\"evt\":"
+                   "\"ACTIVITY_JOIN_REQUEST\",\"nonce\":null}");
+    }
+}
+
+static void ServeConnection()
+{
+    static char body[64 * 1024];
+    uint32_t header[2];
+
+    if (!ReadExact(header, sizeof(header)) || header[1] >= sizeof(body) ||
+        !ReadExact(body, header[1])) {
+        return;
+    }
+    // before READY, which is what tells the session this connection's begun
+    Subscribed.store(0);
+    WriteFrame(1,
+               "{\"cmd\":\"DISPATCH\",\"data\":{\"v\":1,\"user\":{\"id\":\"1\",\"username\":"
+               "\"bench\",\"discriminator\":\"0001\"}},\"evt\":\"READY\",\"nonce\":null}");
+
+    while (Running.load() && !HangUp.load()) {
+        if (PushEvents.exchange(false)) {
+            WriteEvents();
+        }
+        if (LoopbackServerAvailable() < sizeof(header)) {
+            if (!LoopbackClientConnected()) {
+                return;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        if (!ReadExact(header, sizeof(header)) || header[1] >= sizeof(body) ||
+            !ReadExact(body, header[1])) {
+            return;
+        }
+        body[header[1]] = 0;
+        if (header[0] == 2) {
+            return;
+        }
+        if (header[0] == 3) {
+            WriteFrame(4, body);
+            continue;
+        }
+
+        char update[32], cmd[64], evt[64], nonce[32], reply[256];
+        CopyStringField(body, "\"details\":\"update ", update, sizeof(update));
+        if (update[0]) {
+            LastUpdate.store(atoi(update));
+        }
+        CopyStringField(body, "\"cmd\":\"", cmd, sizeof(cmd));
+        if (strcmp(cmd, "SUBSCRIBE") == 0) {
+            CopyStringField(body, "\"evt\":\"", evt, sizeof(evt));
+            if (strcmp(evt, "ACTIVITY_JOIN") == 0) {
+                Subscribed.fetch_or(EventJoin);
+            }
+            else if (strcmp(evt, "ACTIVITY_SPECTATE") == 0) {
+                Subscribed.fetch_or(EventSpectate);
+            }
+            else if (strcmp(evt, "ACTIVITY_JOIN_REQUEST") == 0) {
+                Subscribed.fetch_or(EventJoinRequest);
+            }
+        }
+        else if (strcmp(cmd, "GET_USER") == 0 || strcmp(cmd, "SEND_ACTIVITY_JOIN_INVITE") == 0) {
+            Answers.fetch_add(1);
+        }
+        CopyStringField(body, "\"nonce\":\"", nonce, sizeof(nonce));
+        snprintf(reply,
+                 sizeof(reply),
+                 "{\"cmd\":\"%s\",\"data\":{},\"evt\":null,\"nonce\":\"%s\"}",
+                 cmd,
+                 nonce);
+        WriteFrame(1, reply);
+    }
+}
+
+static void Serve(void (*onThread)())
+{
+    if (onThread) {
+        onThread();
+    }
+    while (Running.load()) {
+        if (!Listen.exchange(false)) {
+            std::this_thread::yield();
+            continue;
+        }
+        LoopbackListen();
+        while (Running.load() && !HangUp.load() && !LoopbackAccept(100)) {
+        }
+        if (LoopbackClientConnected()) {
+            ServeConnection();
+        }
+        LoopbackServerClose();
+    }
+}
+
+void LoopbackMockStart(void (*onThread)())
+{
+    Running.store(true);
+    Server = std::thread(Serve, onThread);
+}
+
+void LoopbackMockStop()
+{
+    Running.store(false);
+    if (Server.joinable()) {
+        Server.join();
+    }
+}
+
+static void HandleReady(const DiscordUser*)
+{
+    Connects.fetch_add(1);
+}
+
+static void HandleDisconnected(int, const char*)
+{
+    Disconnects.fetch_add(1);
+}
+
+static void HandleReply(const DiscordRequestResult*, void*)
+{
+    Replies.fetch_add(1);
+}
+
+// the secret is the id of whoever's game it is, so look them up
+static void LookUpHost(const char* secret)
+{
+    char args[64];
+    const int length = snprintf(args, sizeof(args), "{\"id\":\"%s\"}", secret);
+    Discord_SendCommand("GET_USER", args, (size_t)length, HandleReply, nullptr);
+}
+
+static void HandleJoinRequest(const DiscordUser* request)
+{
+    Discord_Respond(request->userId, DISCORD_REPLY_YES);
+}
+
+void LoopbackMockHandlers(DiscordEventHandlers* handlers)
+{
+    handlers->ready = HandleReady;
+    handlers->disconnected = HandleDisconnected;
+    handlers->joinGame = LookUpHost;
+    handlers->spectateGame = LookUpHost;
+    handlers->joinRequest = HandleJoinRequest;
+}
+
+// pumps until done() or five seconds are up
+template <typename Fn>
+static bool PumpUntil(void (*pump)(), Fn done)
+{
+    const int64_t deadlineUs = MonotonicNowUs() + 5 * 1000 * 1000;
+    while (!done()) {
+        if (MonotonicNowUs() > deadlineUs) {
+            return false;
+        }
+        pump();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+bool RunLoopbackSession(int session, int presenceUpdates, void (*pump)())
+{
+    HangUp.store(false);
+    Listen.store(true);
+    if (!PumpUntil(pump, [session] { return Connects.load() > session; })) {
+        return false;
+    }
+
+    // the events go out once they're subscribed to, as they would from Discord
+    const int answers = Answers.load() + 3;
+    const int replies = Replies.load() + 2;
+    if (!PumpUntil(pump, [] { return Subscribed.load() == AllEvents; })) {
+        return false;
+    }
+    PushEvents.store(true);
+
+    char details[32];
+    DiscordRichPresence presence;
+    memset(&presence, 0, sizeof(presence));
+    presence.state = "Benchmarking";
+    presence.details = details;
+    int update = -1;
+    for (int i = 0; i < presenceUpdates; ++i) {
+        update = session * presenceUpdates + i;
+        snprintf(details, sizeof(details), "update %d", update);
+        Discord_UpdatePresence(&presence);
+        pump();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!PumpUntil(pump, [update, answers, replies] {
+            return LastUpdate.load() == update && Answers.load() == answers &&
+                   Replies.load() == replies;
+        })) {
+        return false;
+    }
+
+    HangUp.store(true);
+    return PumpUntil(pump, [session] { return Disconnects.load() > session; });
+}
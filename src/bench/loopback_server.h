@@ -0,0 +1,24 @@
+#pragma once
+
+// A mock Discord on the far end of the loopback connection (loopback_connection.h), for benches
+// that only need something there to answer: READY for the handshake, an empty success for every
+// command and a pong for every ping. Once per session it also sends an ACTIVITY_JOIN, an
+// ACTIVITY_SPECTATE and an ACTIVITY_JOIN_REQUEST, which its handlers answer the way a game would.
+// It serves one connection per session, and the library comes back through its usual reconnect
+// once the mock hangs up.
+
+#include "discord_rpc.h"
+
+// Runs the mock on a thread of its own; onThread, if set, runs on that thread before anything else.
+void LoopbackMockStart(void (*onThread)());
+void LoopbackMockStop();
+
+// The handlers RunLoopbackSession goes by: ready and disconnected, and for the events, a
+// Discord_SendCommand from joinGame and spectateGame and a Discord_Respond from joinRequest.
+void LoopbackMockHandlers(DiscordEventHandlers* handlers);
+
+// One session, with pump standing in for the game's update loop: waits for the library to
+// connect and subscribe, sends the events and presenceUpdates presences, waits for the last of
+// them and the answers to the events to arrive, then hangs up and waits for the library to
+// notice. Sessions count up from 0. False if any step takes more than five seconds.
+bool RunLoopbackSession(int session, int presenceUpdates, void (*pump)());
@@ -0,0 +1,186 @@
+/*
+    Microbenchmarks for the hot bits of the library: serialization, parsing, lookups and queues.
+    Prints time and heap traffic per operation. Pass a substring to only run matching benchmarks.
+*/
+
+#include "discord_rpc.h"
+
+#include "msg_queue.h"
+#include "serialization.h"
+#include "trace.h"
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// long enough that timer resolution and a stray context switch don't matter
+static const int64_t MinRunNs = 200 * 1000 * 1000;
+static const uint64_t MaxIterations = 1ull << 32;
+
+static const char* Filter = nullptr;
+// keeps the optimizer from throwing the work away
+static volatile size_t Sink;
+
+template <typename Fn>
+static void Run(const char* name, Fn fn)
+{
+    if (Filter && !strstr(name, Filter)) {
+        return;
+    }
+    fn(); // warm up
+
+    for (uint64_t iterations = 1;; iterations *= 2) {
+        DiscordAllocationStats before, after;
+        Discord_GetAllocationStats(&before);
+        auto start = std::chrono::steady_clock::now();
+        size_t sink = 0;
+        for (uint64_t i = 0; i < iterations; ++i) {
+            sink += fn();
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        Discord_GetAllocationStats(&after);
+        Sink = sink;
+
+        const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        if (ns < MinRunNs && iterations < MaxIterations) {
+            continue;
+        }
+        const double count = (double)iterations;
+        printf("%-34s %12llu %10.1f ns/op %8.1f B/op %6.2f allocs/op\n",
+               name,
+               (unsigned long long)iterations,
+               (double)ns / count,
+               (double)(after.bytesRequested - before.bytesRequested) / count,
+               (double)(after.allocations + after.reallocations - before.allocations -
+                        before.reallocations) /
+                 count);
+        return;
+    }
+}
+
+static const char ReadyFrame[] =
+  "{\"cmd\":\"DISPATCH\",\"data\":{\"v\":1,\"config\":{\"cdn_host\":\"cdn.discordapp.com\","
+  "\"api_endpoint\":\"//discordapp.com/api\",\"environment\":\"production\"},\"user\":{\"id\":"
+  "\"53908232506183680\",\"username\":\"Mason\",\"discriminator\":\"1337\",\"avatar\":"
+  "\"a_bab14f271d565501444b2ca3be944b25\",\"bot\":false,\"flags\":0,\"premium_type\":2}},"
+  "\"evt\":\"READY\",\"nonce\":null}";
+
+static const char JoinRequestFrame[] =
+  "{\"cmd\":\"DISPATCH\",\"data\":{\"user\":{\"id\":\"53908232506183680\",\"username\":"
+  "\"Mason\",\"discriminator\":\"1337\",\"avatar\":\"a_bab14f271d565501444b2ca3be944b25\"}},"
+  "\"evt\":\"ACTIVITY_JOIN_REQUEST\",\"nonce\":null}";
+
+// every field filled in, strings at their documented maximums
+static void FillMaxPresence(DiscordRichPresence* presence)
+{
+    static char longText[129];
+    static char key[33];
+    memset(longText, 'x', sizeof(longText) - 1);
+    memset(key, 'k', sizeof(key) - 1);
+
+    memset(presence, 0, sizeof(*presence));
+    presence->state = longText;
+    presence->details = longText;
+    presence->startTimestamp = 1507665886;
+    presence->endTimestamp = 1507665886 + 5 * 60;
+    presence->largeImageKey = key;
+    presence->largeImageText = longText;
+    presence->smallImageKey = key;
+    presence->smallImageText = longText;
+    presence->partyId = longText;
+    presence->partySize = 3;
+    presence->partyMax = 6;
+    presence->matchSecret = longText;
+    presence->joinSecret = longText;
+    presence->spectateSecret = longText;
+    presence->instance = 1;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1) {
+        Filter = argv[1];
+    }
+
+    static char output[16 * 1024];
+
+    DiscordRichPresence minPresence;
+    memset(&minPresence, 0, sizeof(minPresence));
+    minPresence.state = "In a match";
+    Run("JsonWriteRichPresenceObj/min", [&]() {
+        return JsonWriteRichPresenceObj(output, sizeof(output), 1234, 4321, &minPresence);
+    });
+
+    DiscordRichPresence maxPresence;
+    FillMaxPresence(&maxPresence);
+    Run("JsonWriteRichPresenceObj/max", [&]() {
+        return JsonWriteRichPresenceObj(output, sizeof(output), 1234, 4321, &maxPresence);
+    });
+
+    Run("JsonWriteSubscribeCommand", []() {
+        return JsonWriteSubscribeCommand(output, sizeof(output), 1234, "ACTIVITY_JOIN_REQUEST");
+    });
+
+    // ParseInsitu eats its input, so these include copying the frame back in (a memcpy of a few
+    // hundred bytes, noise next to the parse). Reusing the document is what the read loop does.
+    static JsonDocument document;
+    static char frame[1024];
+    Run("ParseInsitu/READY", []() {
+        memcpy(frame, ReadyFrame, sizeof(ReadyFrame));
+        document.Reset();
+        document.ParseInsitu(frame);
+        return (size_t)document.HasParseError();
+    });
+
+    Run("ParseInsitu/ACTIVITY_JOIN_REQUEST", []() {
+        memcpy(frame, JoinRequestFrame, sizeof(JoinRequestFrame));
+        document.Reset();
+        document.ParseInsitu(frame);
+        return (size_t)document.HasParseError();
+    });
+
+    // the lookups the read loop and OnConnect do on a READY
+    memcpy(frame, ReadyFrame, sizeof(ReadyFrame));
+    document.Reset();
+    document.ParseInsitu(frame);
+    Run("GetStrMember/READY", []() {
+        size_t found = 0;
+        found += GetStrMember(&document, "evt") != nullptr;
+        found += GetStrMember(&document, "nonce") != nullptr;
+        auto user = GetObjMember(GetObjMember(&document, "data"), "user");
+        found += GetStrMember(user, "id") != nullptr;
+        found += GetStrMember(user, "username") != nullptr;
+        found += GetStrMember(user, "discriminator") != nullptr;
+        found += GetStrMember(user, "avatar") != nullptr;
+        return found;
+    });
+
+    struct Message {
+        size_t length;
+        char buffer[16 * 1024];
+    };
+    static MsgQueue<Message, 8> queue;
+    Run("MsgQueue/push+pop", []() {
+        auto message = queue.GetNextAddMessage();
+        message->length = 64;
+        queue.CommitAdd();
+        auto sent = queue.GetNextSendMessage();
+        const size_t length = sent->length;
+        queue.CommitSend();
+        return length;
+    });
+
+    // only measures anything in a --tracing build; a scope should stay under 50 ns
+    Run("TraceScope", []() {
+        DISCORD_TRACE_SCOPE("TraceScope");
+        return (size_t)1;
+    });
+
+    static char copied[256];
+    Run("StringCopy/40", []() {
+        return StringCopy(copied, "a_bab14f271d565501444b2ca3be944b25.png");
+    });
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+-- The benchmarks poke at library internals, so they compile the library sources they need in
+-- directly instead of linking the DLL.
+
+project "Bench"
+    language "C++"
+    targetname("bench")
+    
+    kind "ConsoleApp"
+    
+    includedirs
+    {
+        ".",
+        "../rpc",
+        "../../thirdparty/rapidjson-last/include"
+    }
+
+    vpaths
+    {
+        ["Headers/**"] = "**.h",
+        ["Sources/**"] = "**.cpp",
+        ["*"] = "premake5.lua"
+    }
+
+    files
+    {
+        "premake5.lua",
+        "micro_bench.cpp",
+        "../rpc/allocator.cpp",
+        "../rpc/connection_win.cpp",
+        "../rpc/serialization.cpp",
+        "../rpc/trace.cpp"
+    }
+
+    DeclareCompilationFlags()
+
+    removedefines
+    {
+        "DISCORD_DYNAMIC_LIB"
+    }
+
+-- The IO mode is a compile time switch, so the benches that run the whole library come in both
+-- flavours. With standInConnection set, the sources bring their own BaseConnection in place of
+-- the pipe, with bench_support.cpp filling in the parts every stand-in shares.
+function DeclareLibraryBench(name, sources, useIoThread, standInConnection)
+    project(name)
+        language "C++"
+        targetname(name)
+
+        kind "ConsoleApp"
+
+        includedirs
+        {
+            ".",
+            "../rpc",
+            "../../thirdparty/rapidjson-last/include"
+        }
+
+        vpaths
+        {
+            ["Headers/**"] = "**.h",
+            ["Sources/**"] = "**.cpp",
+            ["*"] = "premake5.lua"
+        }
+
+        files
+        {
+            "premake5.lua",
+            "bench_support.h",
+            "bench_support.cpp",
+            "../rpc/*.h",
+            "../rpc/*.cpp"
+        }
+        files(sources)
+
+        removefiles
+        {
+            "../rpc/dllmain.cpp"
+        }
+
+        if standInConnection then
+            removefiles
+            {
+                "../rpc/connection_win.cpp"
+            }
+            defines { "DISCORD_BENCH_STAND_IN" }
+        end
+
+        DeclareCompilationFlags()
+
+        removedefines
+        {
+            "DISCORD_DYNAMIC_LIB"
+        }
+
+        if useIoThread then
+            removedefines
+            {
+                "DISCORD_DISABLE_IO_THREAD"
+            }
+        end
+end
+
+DeclareLibraryBench("LatencyBench", { "latency_bench.cpp" }, true, false)
+DeclareLibraryBench("LatencyBenchManualIO", { "latency_bench.cpp" }, false, false)
+
+-- the same bench over in-process rings instead of the pipe, for a baseline without the kernel
+LoopbackBenchSources = { "latency_bench.cpp", "loopback_connection.h", "loopback_connection.cpp" }
+DeclareLibraryBench("LatencyBenchLoopback", LoopbackBenchSources, true, true)
+    defines { "DISCORD_BENCH_LOOPBACK" }
+DeclareLibraryBench("LatencyBenchLoopbackManualIO", LoopbackBenchSources, false, true)
+    defines { "DISCORD_BENCH_LOOPBACK" }
+
+RecoveryBenchSources = { "fault_connection.h", "fault_connection.cpp", "recovery_bench.cpp" }
+DeclareLibraryBench("RecoveryBench", RecoveryBenchSources, true, true)
+DeclareLibraryBench("RecoveryBenchManualIO", RecoveryBenchSources, false, true)
+
+-- simulated time needs the IO driven from outside, so there's no IO thread flavour of this one
+ReconnectSimSources = { "fault_connection.h", "fault_connection.cpp", "reconnect_sim.cpp" }
+DeclareLibraryBench("ReconnectSim", ReconnectSimSources, false, true)
+
+-- Counts every heap allocation once the library's warmed up. The call stacks need DbgHelp, and
+-- seeing the C heap's allocations needs the debug CRT's hook, so Release links it too.
+AllocAuditSources =
+{
+    "loopback_connection.h",
+    "loopback_connection.cpp",
+    "loopback_server.h",
+    "loopback_server.cpp",
+    "alloc_audit.cpp"
+}
+DeclareLibraryBench("AllocAudit", AllocAuditSources, true, true)
+    links { "dbghelp" }
+    runtime "Debug"
+DeclareLibraryBench("AllocAuditManualIO", AllocAuditSources, false, true)
+    links { "dbghelp" }
+    runtime "Debug"
+
+-- peak stack of the IO calls a game makes itself, so there's no IO thread flavour of this one
+StackBenchSources =
+{
+    "loopback_connection.h",
+    "loopback_connection.cpp",
+    "loopback_server.h",
+    "loopback_server.cpp",
+    "stack_bench.cpp"
+}
+DeclareLibraryBench("StackBench", StackBenchSources, false, true)
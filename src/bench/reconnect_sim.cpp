@@ -0,0 +1,372 @@
+/*
+    A day (or however long) of Discord coming and going, run against the real library on a
+    simulated clock, so it's over in well under a second. fault_connection.cpp stands in for the
+    pipe, Discord_SetClock makes time whatever we say, and we jump straight to whenever the library
+    or the scenario next has something to do.
+    The scenario, drawn from the seed: the pipe resetting now and then, Discord restarting, Discord
+    wedging until the liveness check gives up on it, and stretches where every connection is
+    dropped right after READY, which is what sets off reconnect storms. Discord's handshake rate
+    limit is on throughout.
+    Usage: reconnect_sim [seed] [hours]
+    Exits non-zero if a check fails, so CI can run it:
+      - never more than StormLimit handshakes in any minute
+      - connected again within OutageRecoveryLimitMs of Discord coming back
+      - a wedged Discord noticed within the ping interval plus the timeout, plus a little
+      - the same seed gives the same run, event for event
+*/
+
+#include "discord_rpc.h"
+
+#include "fault_connection.h"
+#include "latency_histogram.h"
+#include "timer_wheel.h"
+
+#include <chrono>
+#include <deque>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+constexpr int64_t UsPerMs{1000};
+constexpr int64_t UsPerSecond{1000 * UsPerMs};
+constexpr int64_t UsPerMinute{60 * UsPerSecond};
+constexpr int64_t UsPerHour{60 * UsPerMinute};
+
+// what the scenario gets up to, on average
+constexpr int64_t MeanResetIntervalUs{30 * UsPerMinute};
+constexpr int64_t MeanRestartIntervalUs{3 * UsPerHour};
+constexpr int64_t MeanWedgeIntervalUs{6 * UsPerHour};
+constexpr int64_t MeanFlappingIntervalUs{4 * UsPerHour};
+constexpr int64_t PresenceIntervalUs{15 * UsPerSecond};
+constexpr int64_t FlapDropAfterUs{100 * UsPerMs};
+
+constexpr uint32_t RateLimitHandshakes{5};
+constexpr uint32_t RateLimitWindowMs{60 * 1000};
+constexpr uint32_t PingIntervalMs{5000};
+constexpr uint32_t LivenessTimeoutMs{15000};
+
+// the checks
+constexpr size_t StormLimit{15};
+constexpr int64_t OutageRecoveryLimitMs{1000};
+constexpr int64_t WedgeDetectSlackMs{1000};
+
+static int64_t SimNowUs{0};
+
+static int64_t SimClock(void*)
+{
+    return SimNowUs;
+}
+
+namespace {
+struct RunResults {
+    uint64_t digest{14695981039346656037ull}; // FNV-1a over everything that happened, in order
+    uint64_t updates{0};
+    uint32_t readies{0};
+    uint32_t disconnects{0};
+    uint32_t handshakes{0};
+    uint32_t rateLimited{0};
+    uint32_t resets{0};
+    uint32_t restarts{0};
+    uint32_t wedges{0};
+    uint32_t flaps{0};
+    size_t worstMinute{0};
+    int64_t connectedUs{0};
+    LatencyHistogram reconnect;       // disconnected -> ready
+    LatencyHistogram outageRecovery;  // Discord back -> ready
+    LatencyHistogram wedgeDetect;     // wedged -> disconnected
+    double wallMs{0};
+};
+
+// the handlers don't get a user pointer, so the run in progress lives here
+struct RunState {
+    RunResults* results{nullptr};
+    int64_t startUs{0};
+    int64_t disconnectedUs{0};
+    int64_t serverBackUs{0};
+    int64_t wedgedUs{0};
+    int64_t connectedSinceUs{0};
+};
+} // namespace
+
+static RunState Run;
+
+static void Digest(uint64_t kind, int64_t value)
+{
+    const uint64_t words[] = {kind, (uint64_t)(SimNowUs - Run.startUs), (uint64_t)value};
+    for (auto word : words) {
+        for (int i = 0; i < 8; ++i) {
+            Run.results->digest ^= (word >> (i * 8)) & 0xff;
+            Run.results->digest *= 1099511628211ull;
+        }
+    }
+}
+
+static void RecordSince(LatencyHistogram& histogram, int64_t& sinceUs)
+{
+    if (sinceUs) {
+        histogram.Record((uint64_t)(SimNowUs - sinceUs));
+        sinceUs = 0;
+    }
+}
+
+static void HandleReady(const DiscordUser*)
+{
+    auto results = Run.results;
+    ++results->readies;
+    Digest(1, 0);
+    RecordSince(results->reconnect, Run.disconnectedUs);
+    RecordSince(results->outageRecovery, Run.serverBackUs);
+    Run.connectedSinceUs = SimNowUs;
+}
+
+static void HandleDisconnected(int errorCode, const char* /*message*/)
+{
+    auto results = Run.results;
+    ++results->disconnects;
+    Digest(2, errorCode);
+    RecordSince(results->wedgeDetect, Run.wedgedUs);
+    if (Run.connectedSinceUs) {
+        results->connectedUs += SimNowUs - Run.connectedSinceUs;
+        Run.connectedSinceUs = 0;
+    }
+    Run.disconnectedUs = SimNowUs;
+}
+
+static void HandleJoinGame(const char*) {}
+
+static int64_t Exponential(std::mt19937_64& random, int64_t meanUs)
+{
+    std::exponential_distribution<double> distribution(1.0 / (double)meanUs);
+    return 1 + (int64_t)distribution(random);
+}
+
+static int64_t Uniform(std::mt19937_64& random, int64_t lowUs, int64_t highUs)
+{
+    std::uniform_int_distribution<int64_t> distribution(lowUs, highUs);
+    return distribution(random);
+}
+
+static void SimulateDay(uint64_t seed, int64_t durationUs, RunResults* results)
+{
+    Run = RunState{};
+    Run.results = results;
+    Run.startUs = SimNowUs;
+    ResetStandIn();
+    SetHandshakeRateLimit(RateLimitHandshakes, RateLimitWindowMs);
+    Discord_SetRandomSeed(seed);
+    std::mt19937_64 random(seed);
+
+    DiscordEventHandlers handlers;
+    memset(&handlers, 0, sizeof(handlers));
+    handlers.ready = HandleReady;
+    handlers.disconnected = HandleDisconnected;
+    handlers.joinGame = HandleJoinGame;
+    Discord_Initialize("simulated", &handlers, 0, nullptr);
+    Discord_SetHealthCheck(PingIntervalMs, LivenessTimeoutMs);
+
+    char details[64];
+    DiscordRichPresence presence;
+    memset(&presence, 0, sizeof(presence));
+    presence.state = "Simulating";
+    presence.details = details;
+
+    const int64_t endUs = SimNowUs + durationUs;
+    int64_t nextResetUs = SimNowUs + Exponential(random, MeanResetIntervalUs);
+    int64_t nextRestartUs = SimNowUs + Exponential(random, MeanRestartIntervalUs);
+    int64_t nextWedgeUs = SimNowUs + Exponential(random, MeanWedgeIntervalUs);
+    int64_t nextFlappingUs = SimNowUs + Exponential(random, MeanFlappingIntervalUs);
+    int64_t nextPresenceUs = SimNowUs;
+    int64_t serverBackAtUs = 0;
+    int64_t flappingUntilUs = 0;
+    int64_t flapDropAtUs = 0;
+    uint32_t presenceCount = 0;
+    uint32_t sessionsSeen = 0;
+    uint32_t handshakesSeen = 0;
+    std::deque<int64_t> lastMinuteHandshakes;
+
+    const auto wallStart = std::chrono::steady_clock::now();
+    while (SimNowUs < endUs) {
+        // the scenario first, so the library sees it on this update
+        if (SimNowUs >= nextPresenceUs) {
+            snprintf(details, sizeof(details), "update %u", ++presenceCount);
+            Discord_UpdatePresence(&presence);
+            nextPresenceUs += PresenceIntervalUs;
+        }
+        if (SimNowUs >= nextResetUs) {
+            ArmFault(Fault::PipeReset);
+            ++results->resets;
+            Digest(3, 0);
+            nextResetUs = SimNowUs + Exponential(random, MeanResetIntervalUs);
+        }
+        if (SimNowUs >= nextRestartUs && !serverBackAtUs) {
+            SetServerAvailable(false);
+            ++results->restarts;
+            Digest(4, 0);
+            serverBackAtUs = SimNowUs + Uniform(random, 5 * UsPerSecond, 5 * UsPerMinute);
+            nextRestartUs = SimNowUs + Exponential(random, MeanRestartIntervalUs);
+        }
+        if (serverBackAtUs && SimNowUs >= serverBackAtUs) {
+            SetServerAvailable(true);
+            Digest(5, 0);
+            serverBackAtUs = 0;
+            Run.serverBackUs = SimNowUs;
+        }
+        if (SimNowUs >= nextWedgeUs) {
+            // only a live connection can wedge; otherwise it'd just be a slow handshake
+            if (Run.connectedSinceUs && !Run.wedgedUs) {
+                ArmFault(Fault::Drop);
+                ++results->wedges;
+                Digest(6, 0);
+                Run.wedgedUs = SimNowUs;
+            }
+            nextWedgeUs = SimNowUs + Exponential(random, MeanWedgeIntervalUs);
+        }
+        if (SimNowUs >= nextFlappingUs) {
+            ++results->flaps;
+            Digest(7, 0);
+            flappingUntilUs = SimNowUs + Uniform(random, UsPerMinute, 10 * UsPerMinute);
+            nextFlappingUs = SimNowUs + Exponential(random, MeanFlappingIntervalUs);
+        }
+        if (flapDropAtUs && SimNowUs >= flapDropAtUs) {
+            ArmFault(Fault::PipeReset);
+            flapDropAtUs = 0;
+        }
+
+        Discord_UpdateConnection();
+        Discord_RunCallbacks();
+        ++results->updates;
+
+        StandInTimeline timeline;
+        GetStandInTimeline(&timeline);
+        for (; handshakesSeen < timeline.handshakes; ++handshakesSeen) {
+            lastMinuteHandshakes.push_back(SimNowUs);
+            Digest(8, 0);
+        }
+        while (!lastMinuteHandshakes.empty() &&
+               SimNowUs - lastMinuteHandshakes.front() >= UsPerMinute) {
+            lastMinuteHandshakes.pop_front();
+        }
+        if (lastMinuteHandshakes.size() > results->worstMinute) {
+            results->worstMinute = lastMinuteHandshakes.size();
+        }
+        if (timeline.sessions != sessionsSeen) {
+            sessionsSeen = timeline.sessions;
+            if (SimNowUs < flappingUntilUs) {
+                flapDropAtUs = SimNowUs + FlapDropAfterUs;
+            }
+        }
+        results->rateLimited = timeline.rateLimited;
+        results->handshakes = timeline.handshakes;
+
+        // then straight on to whatever's next
+        int64_t nextUs = SimNowUs + (int64_t)Discord_NextUpdateDelayMs() * UsPerMs;
+        const int64_t scenario[] = {
+          nextPresenceUs, nextResetUs, nextRestartUs, nextWedgeUs, nextFlappingUs, endUs};
+        for (auto eventUs : scenario) {
+            nextUs = eventUs < nextUs ? eventUs : nextUs;
+        }
+        if (serverBackAtUs && serverBackAtUs < nextUs) {
+            nextUs = serverBackAtUs;
+        }
+        if (flapDropAtUs && flapDropAtUs < nextUs) {
+            nextUs = flapDropAtUs;
+        }
+        // timers tick in whole milliseconds
+        SimNowUs = nextUs > SimNowUs + UsPerMs ? nextUs : SimNowUs + UsPerMs;
+    }
+    if (Run.connectedSinceUs) {
+        results->connectedUs += SimNowUs - Run.connectedSinceUs;
+    }
+    Discord_Shutdown();
+    results->wallMs =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart)
+        .count();
+}
+
+static void PrintLatency(const char* name, const LatencyHistogram& histogram)
+{
+    DiscordLatencyStats stats;
+    histogram.Snapshot(&stats);
+    printf("  %-18s n=%-6llu p50=%-10.1f p99=%-10.1f max=%-10.1f (ms)\n",
+           name,
+           (unsigned long long)stats.count,
+           (double)stats.p50Us / 1000.0,
+           (double)stats.p99Us / 1000.0,
+           (double)stats.maxUs / 1000.0);
+}
+
+static bool Check(bool ok, const char* what)
+{
+    printf("%s %s\n", ok ? "  ok  " : "  FAIL", what);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    const uint64_t seed = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1;
+    const double hours = argc > 2 ? atof(argv[2]) : 24.0;
+    if (seed == 0 || hours <= 0) {
+        printf("usage: reconnect_sim [seed, not 0] [hours]\n");
+        return 1;
+    }
+    const int64_t durationUs = (int64_t)(hours * (double)UsPerHour);
+
+    // anywhere is fine as a start, as long as it's not 0, which the stand-in uses for never
+    SimNowUs = UsPerHour;
+    Discord_SetClock(SimClock, nullptr);
+
+    static RunResults first, second;
+    SimulateDay(seed, durationUs, &first);
+    SimulateDay(seed, durationUs, &second);
+    Discord_SetClock(nullptr, nullptr);
+
+    const auto& r = first;
+    printf("seed %llu, %.1f simulated hours in %.1f ms of wall time, %llu updates\n",
+           (unsigned long long)seed,
+           hours,
+           r.wallMs,
+           (unsigned long long)r.updates);
+    printf("  %u pipe resets, %u Discord restarts, %u wedges, %u flapping spells\n",
+           r.resets,
+           r.restarts,
+           r.wedges,
+           r.flaps);
+    printf("  %u handshakes, %u rate limited, %u connects, %u disconnects, connected %.3f%%\n",
+           r.handshakes,
+           r.rateLimited,
+           r.readies,
+           r.disconnects,
+           100.0 * (double)r.connectedUs / (double)durationUs);
+    PrintLatency("reconnect", r.reconnect);
+    PrintLatency("after restart", r.outageRecovery);
+    PrintLatency("wedge noticed", r.wedgeDetect);
+
+    DiscordLatencyStats outage, wedge;
+    r.outageRecovery.Snapshot(&outage);
+    r.wedgeDetect.Snapshot(&wedge);
+    char line[128];
+    bool ok = true;
+    snprintf(line,
+             sizeof(line),
+             "at most %u handshakes in a minute (%u seen)",
+             (unsigned)StormLimit,
+             (unsigned)r.worstMinute);
+    ok &= Check(r.worstMinute <= StormLimit, line);
+    snprintf(line,
+             sizeof(line),
+             "back within %lld ms of Discord restarting",
+             (long long)OutageRecoveryLimitMs);
+    ok &= Check(outage.maxUs <= (uint64_t)OutageRecoveryLimitMs * 1000, line);
+    snprintf(line, sizeof(line), "wedges noticed within the ping interval plus timeout");
+    ok &= Check(wedge.maxUs <=
+                  (uint64_t)(PingIntervalMs + LivenessTimeoutMs + WedgeDetectSlackMs) * 1000,
+                line);
+    snprintf(line,
+             sizeof(line),
+             "same seed, same run (%016llx)",
+             (unsigned long long)first.digest);
+    ok &= Check(first.digest == second.digest && first.updates == second.updates, line);
+    return ok ? 0 : 1;
+}
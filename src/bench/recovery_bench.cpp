@@ -0,0 +1,184 @@
+/*
+    How long the library takes to get back on its feet after each kind of fault (see
+    fault_connection.h), measured from the moment the fault hits:
+      detect:    the library hanging up its end of the connection
+      reconnect: the library reading READY on a new connection
+      restored:  the library reading Discord's reply to the presence set right after the fault
+    A fault that doesn't cost the connection (delay) only shows up under restored.
+    Usage: recovery_bench [trials per fault] [ping interval ms] [liveness timeout ms]
+    The reconnect backoff is the real one, so expect most of a second per reconnect; drop is only
+    noticed by the liveness check, so it takes about ping interval + timeout.
+    RecoveryBench runs the library's IO thread; RecoveryBenchManualIO calls Discord_UpdateConnection
+    from the loop.
+*/
+
+#include "discord_rpc.h"
+
+#include "fault_connection.h"
+#include "latency_histogram.h"
+#include "timer_wheel.h"
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+// short reads are split this far apart, and delay holds replies back this long
+constexpr uint32_t FaultDelayMs{20};
+constexpr uint32_t ReplyDelayMs{200};
+// past this a trial counts as never recovering; well over the longest backoff step we should see
+constexpr int64_t TrialTimeoutMs{30 * 1000};
+
+struct FaultResults {
+    LatencyHistogram detect;
+    LatencyHistogram reconnect;
+    LatencyHistogram restored;
+    unsigned unrecovered{0};
+};
+
+static void HandleJoinGame(const char*) {}
+static void HandleSpectateGame(const char*) {}
+
+static void Pump()
+{
+#ifdef DISCORD_DISABLE_IO_THREAD
+    Discord_UpdateConnection();
+#endif
+    Discord_RunCallbacks();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+// Sets the presence and waits for Discord to have acknowledged it, however long that takes.
+static bool SetPresenceAndWait(DiscordRichPresence* presence,
+                               char* details,
+                               size_t detailsSize,
+                               const char* text,
+                               int64_t sinceUs,
+                               StandInTimeline* timeline)
+{
+    snprintf(details, detailsSize, "%s", text);
+    WatchPresence(details);
+    Discord_UpdatePresence(presence);
+    const int64_t deadlineMs = MonotonicNowMs() + TrialTimeoutMs;
+    for (;;) {
+        GetStandInTimeline(timeline);
+        if (timeline->presenceAckUs >= sinceUs) {
+            return true;
+        }
+        if (MonotonicNowMs() > deadlineMs) {
+            return false;
+        }
+        Pump();
+    }
+}
+
+static void RecordSince(LatencyHistogram& histogram, int64_t eventUs, int64_t faultUs)
+{
+    if (eventUs >= faultUs) {
+        histogram.Record((uint64_t)(eventUs - faultUs));
+    }
+}
+
+static void PrintColumn(const LatencyHistogram& histogram)
+{
+    DiscordLatencyStats stats;
+    histogram.Snapshot(&stats);
+    if (stats.count == 0) {
+        printf(" %9s %9s", "-", "-");
+        return;
+    }
+    printf(" %9.1f %9.1f", (double)stats.p50Us / 1000.0, (double)stats.maxUs / 1000.0);
+}
+
+int main(int argc, char** argv)
+{
+    const int trials = argc > 1 ? atoi(argv[1]) : 5;
+    const uint32_t pingIntervalMs = argc > 2 ? (uint32_t)atoi(argv[2]) : 1000;
+    const uint32_t timeoutMs = argc > 3 ? (uint32_t)atoi(argv[3]) : 3000;
+    if (trials <= 0) {
+        printf("usage: recovery_bench [trials per fault] [ping interval ms] [liveness timeout ms]\n");
+        return 1;
+    }
+
+    DiscordEventHandlers handlers;
+    memset(&handlers, 0, sizeof(handlers));
+    // so a restored session has subscriptions to put back, not just the presence
+    handlers.joinGame = HandleJoinGame;
+    handlers.spectateGame = HandleSpectateGame;
+    Discord_Initialize("recovery", &handlers, 0, nullptr);
+    Discord_SetHealthCheck(pingIntervalMs, timeoutMs);
+
+    char details[64];
+    DiscordRichPresence presence;
+    memset(&presence, 0, sizeof(presence));
+    presence.state = "Benchmarking";
+    presence.details = details;
+
+    StandInTimeline timeline;
+    if (!SetPresenceAndWait(
+          &presence, details, sizeof(details), "warm up", MonotonicNowUs(), &timeline)) {
+        printf("never connected to the stand-in\n");
+        Discord_Shutdown();
+        return 1;
+    }
+
+    static FaultResults results[(int)Fault::Count];
+    int sequence = 0;
+    for (int f = (int)Fault::PipeReset; f < (int)Fault::Count; ++f) {
+        const Fault fault = (Fault)f;
+        auto& result = results[f];
+        for (int trial = 0; trial < trials; ++trial) {
+            char text[64];
+            snprintf(text, sizeof(text), "trial %d", ++sequence);
+            const int64_t faultUs = MonotonicNowUs();
+            ArmFault(fault, fault == Fault::Delay ? ReplyDelayMs : FaultDelayMs);
+            const bool recovered =
+              SetPresenceAndWait(&presence, details, sizeof(details), text, faultUs, &timeline);
+            ClearFaults();
+            if (!recovered) {
+                ++result.unrecovered;
+                continue;
+            }
+            RecordSince(result.detect, timeline.closedUs, faultUs);
+            RecordSince(result.reconnect, timeline.readyUs, faultUs);
+            RecordSince(result.restored, timeline.presenceAckUs, faultUs);
+        }
+    }
+
+    DiscordStats stats;
+    Discord_GetStats(&stats);
+    DiscordConnectionHealth health;
+    Discord_GetConnectionHealth(&health);
+    Discord_Shutdown();
+
+#ifdef DISCORD_DISABLE_IO_THREAD
+    printf("manual IO, %d trials per fault, ping every %ums, timeout %ums\n",
+           trials,
+           pingIntervalMs,
+           timeoutMs);
+#else
+    printf("IO thread, %d trials per fault, ping every %ums, timeout %ums\n",
+           trials,
+           pingIntervalMs,
+           timeoutMs);
+#endif
+    printf("%-15s %19s %19s %19s\n", "", "detect (ms)", "reconnect (ms)", "restored (ms)");
+    printf("%-15s %9s %9s %9s %9s %9s %9s\n", "fault", "p50", "max", "p50", "max", "p50", "max");
+    for (int f = (int)Fault::PipeReset; f < (int)Fault::Count; ++f) {
+        printf("%-15s", FaultName((Fault)f));
+        PrintColumn(results[f].detect);
+        PrintColumn(results[f].reconnect);
+        PrintColumn(results[f].restored);
+        if (results[f].unrecovered) {
+            printf("  %u never recovered", results[f].unrecovered);
+        }
+        printf("\n");
+    }
+    printf("%llu connect attempts, %llu connects, %llu liveness timeouts\n",
+           (unsigned long long)stats.connectAttempts,
+           (unsigned long long)stats.connects,
+           (unsigned long long)health.livenessTimeouts);
+    return 0;
+}
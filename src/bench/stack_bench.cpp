@@ -0,0 +1,125 @@
+/*
+    Peak stack use of the library's IO, for sizing the fibers or small threads a game wants to call
+    Discord_UpdateConnection from. Runs sessions with the loopback mock of Discord
+    (loopback_server.h) -- connect, subscribed events and the handlers' answers to them, presence
+    updates and the answers to those, being hung up on and reconnecting -- and before every
+    Discord_UpdateConnection and Discord_RunCallbacks paints the stack below it with a known byte.
+    Whatever got overwritten afterwards is what the call used. The IO thread runs the same code, so
+    this is its figure too, give or take the thread's own frames. Discord_GetMemoryFootprint's
+    ioStackBytes is an estimate; this is the measurement, and the exit code is 1 if it comes out
+    over the estimate.
+    Usage: stack_bench [sessions]
+*/
+
+#include "discord_rpc.h"
+
+#include "loopback_server.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#define STACK_BENCH_NOINLINE __declspec(noinline)
+#define STACK_BENCH_ALLOCA _alloca
+#else
+#include <alloca.h>
+#define STACK_BENCH_NOINLINE __attribute__((noinline))
+#define STACK_BENCH_ALLOCA alloca
+#endif
+
+// well past anything the library should need; any more and it's the finding
+static const size_t PaintBytes = 64 * 1024;
+static const unsigned char PaintByte = 0xCD;
+static const int PresenceUpdatesPerSession = 100;
+
+// lowest address of the painted stretch, which ends just below the caller's frame
+static unsigned char* volatile Painted;
+static size_t PeakUpdateBytes;
+static size_t PeakCallbacksBytes;
+
+// The stretch it paints is popped on return, so the next call the caller makes gets it. Painted
+// through volatile, or the optimizer sees stores to memory nobody reads before it's gone.
+STACK_BENCH_NOINLINE static void PaintBelow()
+{
+    auto stretch = static_cast<volatile unsigned char*>(STACK_BENCH_ALLOCA(PaintBytes));
+    for (size_t i = 0; i < PaintBytes; ++i) {
+        stretch[i] = PaintByte;
+    }
+    Painted = const_cast<unsigned char*>(stretch);
+}
+
+// Counted up from the far end, since the stack grows down into it; a frame may leave a hole or two
+// of untouched bytes, but never a whole run down to the bottom.
+STACK_BENCH_NOINLINE static size_t PaintedBytesUsed()
+{
+    size_t untouched = 0;
+    while (untouched < PaintBytes && Painted[untouched] == PaintByte) {
+        ++untouched;
+    }
+    return PaintBytes - untouched;
+}
+
+STACK_BENCH_NOINLINE static void MeasuredPump()
+{
+    PaintBelow();
+    Discord_UpdateConnection();
+    const size_t update = PaintedBytesUsed();
+
+    PaintBelow();
+    Discord_RunCallbacks();
+    const size_t callbacks = PaintedBytesUsed();
+
+    if (update > PeakUpdateBytes) {
+        PeakUpdateBytes = update;
+    }
+    if (callbacks > PeakCallbacksBytes) {
+        PeakCallbacksBytes = callbacks;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int sessions = argc > 1 ? atoi(argv[1]) : 5;
+    if (sessions <= 0) {
+        printf("usage: stack_bench [sessions]\n");
+        return 1;
+    }
+
+    LoopbackMockStart(nullptr);
+
+    DiscordEventHandlers handlers;
+    memset(&handlers, 0, sizeof(handlers));
+    LoopbackMockHandlers(&handlers);
+    Discord_Initialize("bench", &handlers, 0, nullptr);
+
+    bool ok = true;
+    for (int session = 0; ok && session < sessions; ++session) {
+        ok = RunLoopbackSession(session, PresenceUpdatesPerSession, MeasuredPump);
+    }
+
+    Discord_Shutdown();
+    LoopbackMockStop();
+
+    if (!ok) {
+        printf("a session with the stand-in server never finished\n");
+        return 1;
+    }
+    const size_t peak = PeakUpdateBytes > PeakCallbacksBytes ? PeakUpdateBytes : PeakCallbacksBytes;
+    DiscordMemoryFootprint footprint;
+    Discord_GetMemoryFootprint(&footprint);
+    printf("peak IO stack over %d sessions: %u bytes (Discord_UpdateConnection %u, "
+           "Discord_RunCallbacks %u); ioStackBytes estimates %u\n",
+           sessions,
+           (unsigned)peak,
+           (unsigned)PeakUpdateBytes,
+           (unsigned)PeakCallbacksBytes,
+           (unsigned)footprint.ioStackBytes);
+    if (peak > footprint.ioStackBytes) {
+        printf("over the estimate; raise ioStackBytes or find what got deeper\n");
+        return 1;
+    }
+    return 0;
+}
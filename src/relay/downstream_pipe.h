@@ -0,0 +1,23 @@
+#pragma once
+
+// The relay's end of a local client's pipe: the server side of what BaseConnection is to the
+// library. Nothing here waits, so one thread can look after every client.
+
+#include <stddef.h>
+
+struct DownstreamPipe {
+    // Starts taking clients on the pipe called name ("discord-relay-ipc-0", say). Call it once,
+    // before Accept.
+    static bool Listen(const char* name);
+    static void StopListening();
+    // A client that connected since the last call, or nullptr if there isn't one.
+    static DownstreamPipe* Accept();
+    static void Destroy(DownstreamPipe*&);
+    bool isOpen{false};
+    void Close();
+    // All of it or nothing, like BaseConnection::Read; a client that hung up closes the pipe.
+    bool Read(void* data, size_t length);
+    // A client that isn't reading doesn't get to hold the rest up: if the write doesn't all fit in
+    // the pipe right away, the pipe is closed and this returns false.
+    bool Write(const void* data, size_t length);
+};
@@ -0,0 +1,148 @@
+#include "downstream_pipe.h"
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMCX
+#define NOSERVICE
+#define NOIME
+#include <assert.h>
+#include <windows.h>
+#include <strsafe.h>
+
+// What each side of a client's pipe can hold; a frame is never more than this.
+static const DWORD PipeBufferSize = 64 * 1024;
+
+struct DownstreamPipeWin : public DownstreamPipe {
+    HANDLE pipe{INVALID_HANDLE_VALUE};
+};
+
+static wchar_t PipeName[96]{};
+// the instance waiting for the next client
+static HANDLE Listener{INVALID_HANDLE_VALUE};
+
+static HANDLE CreateInstance()
+{
+    // PIPE_NOWAIT is the old way to poll a pipe, but it's the one that lets a plain loop accept,
+    // read and write without overlapped IO or a thread per client.
+    return ::CreateNamedPipeW(PipeName,
+                              PIPE_ACCESS_DUPLEX,
+                              PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_NOWAIT |
+                                PIPE_REJECT_REMOTE_CLIENTS,
+                              PIPE_UNLIMITED_INSTANCES,
+                              PipeBufferSize,
+                              PipeBufferSize,
+                              0,
+                              nullptr);
+}
+
+/*static*/ bool DownstreamPipe::Listen(const char* name)
+{
+    wchar_t wideName[64];
+    size_t i = 0;
+    for (; name && name[i] && i < sizeof(wideName) / sizeof(wchar_t) - 1; ++i) {
+        wideName[i] = (wchar_t)(unsigned char)name[i];
+    }
+    wideName[i] = 0;
+    StringCbPrintfW(PipeName, sizeof(PipeName), L"\\\\.\\pipe\\%s", wideName);
+    Listener = CreateInstance();
+    return Listener != INVALID_HANDLE_VALUE;
+}
+
+/*static*/ void DownstreamPipe::StopListening()
+{
+    if (Listener != INVALID_HANDLE_VALUE) {
+        ::CloseHandle(Listener);
+        Listener = INVALID_HANDLE_VALUE;
+    }
+}
+
+/*static*/ DownstreamPipe* DownstreamPipe::Accept()
+{
+    if (Listener == INVALID_HANDLE_VALUE) {
+        // we ran out of something making the last one; see if we can now
+        Listener = CreateInstance();
+        if (Listener == INVALID_HANDLE_VALUE) {
+            return nullptr;
+        }
+    }
+    // In nowait mode this never waits, and succeeding only means the instance is ready for a
+    // client; someone being there shows up as ERROR_PIPE_CONNECTED.
+    if (::ConnectNamedPipe(Listener, nullptr)) {
+        return nullptr;
+    }
+    const auto lastError = GetLastError();
+    if (lastError == ERROR_NO_DATA) {
+        // came and went before we noticed; make the instance ready for the next one
+        ::DisconnectNamedPipe(Listener);
+        return nullptr;
+    }
+    if (lastError != ERROR_PIPE_CONNECTED) {
+        return nullptr;
+    }
+    auto self = new DownstreamPipeWin();
+    self->pipe = Listener;
+    self->isOpen = true;
+    Listener = CreateInstance();
+    return self;
+}
+
+/*static*/ void DownstreamPipe::Destroy(DownstreamPipe*& p)
+{
+    auto self = static_cast<DownstreamPipeWin*>(p);
+    self->Close();
+    delete self;
+    p = nullptr;
+}
+
+void DownstreamPipe::Close()
+{
+    auto self = static_cast<DownstreamPipeWin*>(this);
+    if (self->pipe != INVALID_HANDLE_VALUE) {
+        ::DisconnectNamedPipe(self->pipe);
+        ::CloseHandle(self->pipe);
+        self->pipe = INVALID_HANDLE_VALUE;
+    }
+    self->isOpen = false;
+}
+
+bool DownstreamPipe::Read(void* data, size_t length)
+{
+    auto self = static_cast<DownstreamPipeWin*>(this);
+    if (self->pipe == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    DWORD bytesAvailable = 0;
+    if (!::PeekNamedPipe(self->pipe, nullptr, 0, nullptr, &bytesAvailable, nullptr)) {
+        Close();
+        return false;
+    }
+    if (bytesAvailable < length) {
+        return false;
+    }
+    DWORD bytesRead = 0;
+    if (::ReadFile(self->pipe, data, (DWORD)length, &bytesRead, nullptr) != TRUE) {
+        Close();
+        return false;
+    }
+    assert(bytesRead == (DWORD)length);
+    return true;
+}
+
+bool DownstreamPipe::Write(const void* data, size_t length)
+{
+    auto self = static_cast<DownstreamPipeWin*>(this);
+    if (self->pipe == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    if (length == 0) {
+        return true;
+    }
+    const DWORD bytesLength = (DWORD)length;
+    DWORD bytesWritten = 0;
+    if (::WriteFile(self->pipe, data, bytesLength, &bytesWritten, nullptr) != TRUE ||
+        bytesWritten != bytesLength) {
+        // a torn frame is no use to anyone, so the client has to start over
+        Close();
+        return false;
+    }
+    return true;
+}
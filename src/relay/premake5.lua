@@ -0,0 +1,44 @@
+-- The relay is built from the library's own connection code, compiled in directly like the replay
+-- tool's, but it keeps the real pipe: it's what talks to Discord.
+
+project "Relay"
+    language "C++"
+    targetname("relay")
+
+    kind "ConsoleApp"
+
+    includedirs
+    {
+        ".",
+        "../rpc",
+        "../../thirdparty/rapidjson-last/include"
+    }
+
+    vpaths
+    {
+        ["Headers/**"] = "**.h",
+        ["Sources/**"] = "**.cpp",
+        ["*"] = "premake5.lua"
+    }
+
+    files
+    {
+        "premake5.lua",
+        "relay.cpp",
+        "downstream_pipe.h",
+        "downstream_pipe_win.cpp",
+        "../rpc/*.h",
+        "../rpc/*.cpp"
+    }
+
+    removefiles
+    {
+        "../rpc/dllmain.cpp"
+    }
+
+    DeclareCompilationFlags()
+
+    removedefines
+    {
+        "DISCORD_DYNAMIC_LIB"
+    }
@@ -0,0 +1,865 @@
+/*
+    Shares one connection to Discord between any number of local clients. Games and tools opt in
+    with Discord_SetPipeBaseName("discord-relay-ipc-") before they initialize, and from then on:
+      - a handshake is answered here and now, with what Discord told us in its last READY if we've
+        had one, so clients are connected without waiting on Discord at all
+      - every client's presence is kept, and only the winner's goes up to Discord: highest priority
+        first, then whoever changed theirs last. Anything that wouldn't change what Discord shows
+        is dropped here
+      - SET_ACTIVITY, SUBSCRIBE and UNSUBSCRIBE are answered here; other commands go up to Discord
+        and the reply goes back to whoever asked
+      - events from Discord go to every client subscribed to them
+      - a client can hand us its presence through shared memory instead of the pipe (see
+        presence_channel.h); we read it from there every pass
+    One connection can only be one application: we connect as the winner's, and reconnect when the
+    winner changes to a client of another one. Commands and events only work for clients of the
+    application we're connected as; the rest get an error back and no events until theirs wins.
+    Usage: relay [--pipe name] [--priority <application id>=<n>]...
+      --pipe      the pipe to take clients on, discord-relay-ipc-0 by default
+      --priority  clients of this application win over those of lower ones (everyone else is 0)
+*/
+
+#include "backoff.h"
+#include "connection.h"
+#include "discord_client.h"
+#include "downstream_pipe.h"
+#include "presence_channel.h"
+#include "rpc_connection.h"
+#include "serialization.h"
+#include "timer_wheel.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <set>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Opcode = RpcConnection::Opcode;
+
+static const char DefaultPipeName[] = "discord-relay-ipc-0";
+// Pipes don't tell us when there's something to read, so with nothing to do we nap this long
+// before looking again.
+constexpr int64_t IdleSleepMs{1};
+// don't let one chatty client starve the others
+constexpr int MaxFramesPerPass{16};
+// the same codes Discord uses
+constexpr int UnknownErrorCode{1000};
+constexpr int InvalidPayloadCode{4000};
+
+struct Client {
+    DownstreamPipe* pipe{nullptr};
+    unsigned id{0};
+    bool handshaken{false};
+    char appId[64]{};
+    int priority{0};
+    // a frame whose header we've read but whose body hasn't all arrived yet
+    bool haveHeader{false};
+    RpcConnection::MessageFrameHeader header{};
+    // args of the last SET_ACTIVITY, as it sent them; empty until it sends one
+    std::string presenceArgs;
+    bool hasActivity{false};
+    // Its presence channel, if it gave us one, and the nonce of the newest presence we've taken.
+    // The library puts every presence in the channel, pipe ones too, so once there's a channel
+    // anything with an older nonce has been overtaken.
+    PresenceChannel* channel{nullptr};
+    int presenceNonce{0};
+    // bumped when it connects and when its presence changes, to break ties in priority
+    uint64_t recency{0};
+    std::set<std::string> subscriptions;
+};
+
+// a command we passed on to Discord, waiting on the reply
+struct Forwarded {
+    unsigned clientId;
+    std::string nonce;
+    std::string cmd;
+};
+
+struct RelayStats {
+    uint64_t clients{0};
+    uint64_t presences{0};
+    uint64_t duplicates{0};
+    uint64_t overtaken{0};
+    uint64_t fromChannels{0};
+    uint64_t presencesSent{0};
+    uint64_t commandsForwarded{0};
+    uint64_t eventsOut{0};
+    uint64_t connectAttempts{0};
+    uint64_t connects{0};
+};
+
+static std::atomic_bool Running{true};
+static int64_t StartMs{0};
+static RelayStats Stats;
+static std::map<std::string, int> Priorities;
+
+static std::vector<Client*> Clients;
+static unsigned NextClientId{0};
+static uint64_t Recency{0};
+// something changed that might change what Discord should be showing
+static bool SyncDue{false};
+
+static RpcConnection* Upstream{nullptr};
+static Backoff ReconnectBackoff{500, 60 * 1000};
+static int64_t NextConnectMs{0};
+static int64_t HandshakeStartedMs{0};
+static int64_t LastPingMs{0};
+static bool JustConnected{false};
+// the data of Discord's last READY, handed to clients as their own
+static std::string ReadyData{"{\"v\":1}"};
+// what this session with Discord has been told so far
+static std::set<std::string> UpstreamSubscriptions;
+static std::string SentPresenceArgs;
+static std::map<int, Forwarded> Pending;
+static int NextNonce{1};
+
+// One thread does everything, so these are shared: a frame from a client is parsed in place in
+// FrameBuffer, and whatever we write goes through JsonBuffer and then OutBuffer with its header.
+static char FrameBuffer[MaxRpcFrameSize];
+static char JsonBuffer[MaxRpcFrameSize];
+static char OutBuffer[MaxRpcFrameSize];
+static JsonDocument Message;
+
+static void Log(const char* format, ...)
+{
+    printf("[%8.3f] ", (double)(MonotonicNowMs() - StartMs) / 1000.0);
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+    fflush(stdout);
+}
+
+static void Stop(int)
+{
+    Running.store(false);
+}
+
+// Writes value out into JsonBuffer; 0 if it doesn't fit.
+static size_t WriteJson(const JsonValue& value)
+{
+    JsonWriter writer(JsonBuffer, sizeof(JsonBuffer));
+    value.Accept(writer);
+    return writer.Size() < sizeof(JsonBuffer) ? writer.Size() : 0;
+}
+
+static bool SendToClient(Client& client, Opcode opcode, const char* body, size_t length)
+{
+    RpcConnection::MessageFrameHeader header{opcode, (uint32_t)length};
+    if (sizeof(header) + length > sizeof(OutBuffer)) {
+        return false;
+    }
+    // one write per frame, the way the library sends them
+    memcpy(OutBuffer, &header, sizeof(header));
+    memcpy(OutBuffer + sizeof(header), body, length);
+    return client.pipe->Write(OutBuffer, sizeof(header) + length);
+}
+
+static void SendClose(Client& client, int code, const char* message)
+{
+    JsonWriter writer(JsonBuffer, sizeof(JsonBuffer));
+    writer.StartObject();
+    writer.Key("code");
+    writer.Int(code);
+    writer.Key("message");
+    writer.String(message);
+    writer.EndObject();
+    SendToClient(client, Opcode::Close, JsonBuffer, writer.Size());
+}
+
+// The reply to a command we answer ourselves; data is a JSON object, or null for none.
+static void Reply(Client& client,
+                  const char* cmd,
+                  const char* nonce,
+                  const char* data,
+                  size_t dataLength)
+{
+    JsonWriter writer(JsonBuffer, sizeof(JsonBuffer));
+    writer.StartObject();
+    writer.Key("cmd");
+    writer.String(cmd);
+    writer.Key("data");
+    if (data && dataLength) {
+        writer.RawValue(data, dataLength, rapidjson::kObjectType);
+    }
+    else {
+        writer.Null();
+    }
+    writer.Key("evt");
+    writer.Null();
+    writer.Key("nonce");
+    if (nonce) {
+        writer.String(nonce);
+    }
+    else {
+        writer.Null();
+    }
+    writer.EndObject();
+    SendToClient(client, Opcode::Frame, JsonBuffer, writer.Size());
+}
+
+static void ReplyError(Client& client,
+                       const char* cmd,
+                       const char* nonce,
+                       int code,
+                       const char* message)
+{
+    JsonWriter writer(JsonBuffer, sizeof(JsonBuffer));
+    writer.StartObject();
+    writer.Key("cmd");
+    writer.String(cmd);
+    writer.Key("data");
+    writer.StartObject();
+    writer.Key("code");
+    writer.Int(code);
+    writer.Key("message");
+    writer.String(message);
+    writer.EndObject();
+    writer.Key("evt");
+    writer.String("ERROR");
+    writer.Key("nonce");
+    if (nonce) {
+        writer.String(nonce);
+    }
+    else {
+        writer.Null();
+    }
+    writer.EndObject();
+    SendToClient(client, Opcode::Frame, JsonBuffer, writer.Size());
+}
+
+static Client* FindClient(unsigned id)
+{
+    for (auto client : Clients) {
+        if (client->id == id) {
+            return client;
+        }
+    }
+    return nullptr;
+}
+
+static bool Beats(const Client& a, const Client& b)
+{
+    // somebody with something to show wins over somebody without, whatever their priorities
+    if (a.hasActivity != b.hasActivity) {
+        return a.hasActivity;
+    }
+    if (a.priority != b.priority) {
+        return a.priority > b.priority;
+    }
+    return a.recency > b.recency;
+}
+
+static Client* Winner()
+{
+    Client* winner = nullptr;
+    for (auto client : Clients) {
+        if (client->handshaken && client->pipe->isOpen && (!winner || Beats(*client, *winner))) {
+            winner = client;
+        }
+    }
+    return winner;
+}
+
+// Discord side
+
+template <typename WriteBody>
+static void AppendUpstream(WriteBody writeBody)
+{
+    if (!Upstream->AppendFrame(writeBody) && Upstream->FlushBatch()) {
+        Upstream->AppendFrame(writeBody);
+    }
+}
+
+// Brings Discord in line with the winner: connected as its application, showing its presence, and
+// subscribed to whatever that application's clients want between them.
+static void SyncUpstream()
+{
+    auto winner = Winner();
+    if (!winner) {
+        if (Upstream->state != RpcConnection::State::Disconnected) {
+            Upstream->CloseWithError(RpcConnection::ErrorCode::Success, "No clients left");
+        }
+        Upstream->appId[0] = 0;
+        return;
+    }
+    if (strcmp(winner->appId, Upstream->appId) != 0) {
+        Log("switching to application %s for client %u", winner->appId, winner->id);
+        if (Upstream->state != RpcConnection::State::Disconnected) {
+            Upstream->CloseWithError(RpcConnection::ErrorCode::Success, "Switching application");
+        }
+        StringCopy(Upstream->appId, winner->appId);
+        ReconnectBackoff.reset();
+        NextConnectMs = 0;
+        return;
+    }
+    if (!Upstream->IsOpen()) {
+        // we'll be back once it's connected
+        return;
+    }
+
+    std::set<std::string> wanted;
+    for (auto client : Clients) {
+        if (client->handshaken && strcmp(client->appId, Upstream->appId) == 0) {
+            wanted.insert(client->subscriptions.begin(), client->subscriptions.end());
+        }
+    }
+    for (auto& evt : wanted) {
+        if (!UpstreamSubscriptions.count(evt)) {
+            const int nonce = NextNonce++;
+            AppendUpstream([nonce, &evt](char* dest, size_t maxLen) {
+                return JsonWriteSubscribeCommand(dest, maxLen, nonce, evt.c_str());
+            });
+        }
+    }
+    for (auto& evt : UpstreamSubscriptions) {
+        if (!wanted.count(evt)) {
+            const int nonce = NextNonce++;
+            AppendUpstream([nonce, &evt](char* dest, size_t maxLen) {
+                return JsonWriteUnsubscribeCommand(dest, maxLen, nonce, evt.c_str());
+            });
+        }
+    }
+    UpstreamSubscriptions.swap(wanted);
+
+    std::string args = winner->presenceArgs;
+    if (args.empty() && !SentPresenceArgs.empty()) {
+        // the last winner left something up and this one has nothing to say; clear it
+        args = "{\"pid\":" + std::to_string(GetProcessId()) + "}";
+    }
+    if (args != SentPresenceArgs) {
+        const int nonce = NextNonce++;
+        AppendUpstream([nonce, &args](char* dest, size_t maxLen) {
+            return JsonWriteCommand(
+              dest, maxLen, nonce, "SET_ACTIVITY", nullptr, args.data(), args.size());
+        });
+        SentPresenceArgs.swap(args);
+        ++Stats.presencesSent;
+    }
+    Upstream->FlushBatch();
+}
+
+static void OnUpstreamConnect(void*, JsonDocument& readyMessage)
+{
+    auto data = GetObjMember(&readyMessage, "data");
+    if (data) {
+        const size_t length = WriteJson(*data);
+        if (length) {
+            ReadyData.assign(JsonBuffer, length);
+        }
+    }
+    auto user = GetObjMember(data, "user");
+    Log("connected to Discord as %s (%s)",
+        Upstream->appId,
+        GetStrMember(user, "username", "nobody"));
+    ++Stats.connects;
+    ReconnectBackoff.reset();
+    LastPingMs = MonotonicNowMs();
+    // a new session starts from nothing; SyncUpstream tells it everything once Open is done
+    UpstreamSubscriptions.clear();
+    SentPresenceArgs.clear();
+    JustConnected = true;
+}
+
+static void OnUpstreamDisconnect(void*, int errorCode, const char* message)
+{
+    Log("Discord connection closed (%d: %s)", errorCode, message);
+    NextConnectMs = MonotonicNowMs() + ReconnectBackoff.nextDelay();
+    // nothing is coming back for these now
+    for (auto& pending : Pending) {
+        auto client = FindClient(pending.second.clientId);
+        if (client) {
+            ReplyError(*client,
+                       pending.second.cmd.c_str(),
+                       pending.second.nonce.c_str(),
+                       UnknownErrorCode,
+                       "Lost the connection to Discord");
+        }
+    }
+    Pending.clear();
+    UpstreamSubscriptions.clear();
+    SentPresenceArgs.clear();
+}
+
+static void HandleUpstreamMessage(JsonDocument& message)
+{
+    const char* nonce = GetStrMember(&message, "nonce");
+    const char* evt = GetStrMember(&message, "evt");
+    if (nonce) {
+        auto pending = Pending.find(atoi(nonce));
+        if (pending == Pending.end()) {
+            // the reply to something of our own
+            if (evt && strcmp(evt, "ERROR") == 0) {
+                auto data = GetObjMember(&message, "data");
+                Log("Discord turned down %s: %s",
+                    GetStrMember(&message, "cmd", "a command"),
+                    GetStrMember(data, "message", ""));
+            }
+            return;
+        }
+        const Forwarded forwarded = pending->second;
+        Pending.erase(pending);
+        auto client = FindClient(forwarded.clientId);
+        if (!client) {
+            return;
+        }
+        message["nonce"].SetString(forwarded.nonce.c_str(),
+                                   (rapidjson::SizeType)forwarded.nonce.size(),
+                                   message.GetAllocator());
+        const size_t length = WriteJson(message);
+        if (length) {
+            SendToClient(*client, Opcode::Frame, JsonBuffer, length);
+        }
+        return;
+    }
+    if (!evt) {
+        return;
+    }
+    size_t length = 0;
+    for (auto client : Clients) {
+        if (!client->handshaken || strcmp(client->appId, Upstream->appId) != 0 ||
+            !client->subscriptions.count(evt)) {
+            continue;
+        }
+        if (!length) {
+            length = WriteJson(message);
+            if (!length) {
+                return;
+            }
+        }
+        if (SendToClient(*client, Opcode::Frame, JsonBuffer, length)) {
+            ++Stats.eventsOut;
+        }
+    }
+}
+
+static void UpdateUpstream()
+{
+    if (!Upstream->appId[0]) {
+        return;
+    }
+    const int64_t nowMs = MonotonicNowMs();
+    if (Upstream->state == RpcConnection::State::Disconnected) {
+        if (nowMs < NextConnectMs || !BaseConnection::ServerAvailable()) {
+            return;
+        }
+        ++Stats.connectAttempts;
+        HandshakeStartedMs = nowMs;
+        // if this attempt goes nowhere, the next one waits
+        NextConnectMs = nowMs + ReconnectBackoff.nextDelay();
+    }
+    if (!Upstream->IsOpen()) {
+        Upstream->Open();
+        if (Upstream->state == RpcConnection::State::SentHandshake &&
+            nowMs - HandshakeStartedMs > DefaultLivenessTimeoutMs) {
+            Upstream->CloseWithError(RpcConnection::ErrorCode::Unresponsive,
+                                     "Discord never answered the handshake");
+        }
+        if (!Upstream->IsOpen()) {
+            return;
+        }
+    }
+    if (JustConnected) {
+        JustConnected = false;
+        SyncUpstream();
+    }
+
+    if (Upstream->pingSentUs && nowMs - Upstream->pingSentUs / 1000 > DefaultLivenessTimeoutMs) {
+        Upstream->CloseWithError(RpcConnection::ErrorCode::Unresponsive,
+                                 "Discord stopped answering pings");
+        return;
+    }
+    if (!Upstream->pingSentUs && nowMs - LastPingMs >= DefaultPingIntervalMs) {
+        LastPingMs = nowMs;
+        Upstream->SendPing();
+    }
+
+    while (Upstream->Read(Upstream->readDocument)) {
+        HandleUpstreamMessage(Upstream->readDocument);
+    }
+}
+
+// Client side
+
+static bool HandleHandshake(Client& client)
+{
+    Message.Reset();
+    Message.ParseInsitu(FrameBuffer);
+    const char* appId = nullptr;
+    if (!Message.HasParseError() && Message.IsObject() && GetIntMember(&Message, "v") == 1) {
+        appId = GetStrMember(&Message, "client_id");
+    }
+    if (client.handshaken || !appId || !appId[0]) {
+        SendClose(client, InvalidPayloadCode, "Bad handshake");
+        return false;
+    }
+    StringCopy(client.appId, appId);
+    auto priority = Priorities.find(client.appId);
+    client.priority = priority != Priorities.end() ? priority->second : 0;
+    client.handshaken = true;
+    client.recency = ++Recency;
+    SyncDue = true;
+    Log("client %u is application %s, priority %d", client.id, client.appId, client.priority);
+
+    JsonWriter writer(JsonBuffer, sizeof(JsonBuffer));
+    writer.StartObject();
+    writer.Key("cmd");
+    writer.String("DISPATCH");
+    writer.Key("data");
+    writer.RawValue(ReadyData.data(), ReadyData.size(), rapidjson::kObjectType);
+    writer.Key("evt");
+    writer.String("READY");
+    writer.Key("nonce");
+    writer.Null();
+    // what we do that Discord doesn't; the library looks for this
+    writer.Key("relay");
+    writer.StartObject();
+    writer.Key("presence_channel");
+    writer.Int(1);
+    writer.EndObject();
+    writer.EndObject();
+    return SendToClient(client, Opcode::Frame, JsonBuffer, writer.Size());
+}
+
+// Takes args as the client's presence, unless it's been overtaken or changes nothing.
+static void TakePresence(Client& client, JsonValue* args, int nonce)
+{
+    ++Stats.presences;
+    if (client.channel && nonce < client.presenceNonce) {
+        ++Stats.overtaken;
+        return;
+    }
+    client.presenceNonce = nonce;
+    const size_t length = WriteJson(*args);
+    std::string presenceArgs(JsonBuffer, length);
+    if (presenceArgs == client.presenceArgs) {
+        ++Stats.duplicates;
+        return;
+    }
+    client.presenceArgs.swap(presenceArgs);
+    client.hasActivity = GetObjMember(args, "activity") != nullptr;
+    client.recency = ++Recency;
+    SyncDue = true;
+}
+
+static void SetActivity(Client& client, JsonValue* args, const char* nonce)
+{
+    auto activity = GetObjMember(args, "activity");
+    std::string activityJson;
+    if (activity) {
+        const size_t activityLength = WriteJson(*activity);
+        activityJson.assign(JsonBuffer, activityLength);
+    }
+    TakePresence(client, args, nonce ? atoi(nonce) : 0);
+    Reply(client, "SET_ACTIVITY", nonce, activityJson.data(), activityJson.size());
+}
+
+// The channel's latest, if there's a new one. It goes through the same JSON as a presence off the
+// pipe would, so the two compare equal when they are.
+static bool PollChannel(Client& client)
+{
+    PresenceRecord record;
+    if (!client.channel || !client.channel->Read(&record)) {
+        return false;
+    }
+    ++Stats.fromChannels;
+    DiscordRichPresence presence;
+    PresenceFromRecord(record, &presence);
+    const size_t length = JsonWriteRichPresenceObj(FrameBuffer,
+                                                   sizeof(FrameBuffer),
+                                                   record.nonce,
+                                                   record.pid,
+                                                   record.cleared ? nullptr : &presence);
+    if (length == 0 || length >= sizeof(FrameBuffer)) {
+        return false;
+    }
+    FrameBuffer[length] = 0;
+    Message.Reset();
+    Message.ParseInsitu(FrameBuffer);
+    auto args = GetObjMember(&Message, "args");
+    if (args) {
+        TakePresence(client, args, record.nonce);
+    }
+    return true;
+}
+
+static void AttachPresenceChannel(Client& client, const char* name, const char* nonce)
+{
+    auto channel = PresenceChannel::Open(name);
+    if (!channel) {
+        ReplyError(client, "ATTACH_PRESENCE_CHANNEL", nonce, UnknownErrorCode, "No such channel");
+        return;
+    }
+    PresenceChannel::Destroy(client.channel);
+    client.channel = channel;
+    Log("client %u attached presence channel %s", client.id, name);
+    Reply(client, "ATTACH_PRESENCE_CHANNEL", nonce, nullptr, 0);
+}
+
+static void Subscribe(Client& client, const char* cmd, const char* evt, const char* nonce)
+{
+    if (strcmp(cmd, "SUBSCRIBE") == 0) {
+        client.subscriptions.insert(evt);
+    }
+    else {
+        client.subscriptions.erase(evt);
+    }
+    SyncDue = true;
+    char data[128];
+    JsonWriter writer(data, sizeof(data));
+    writer.StartObject();
+    writer.Key("evt");
+    writer.String(evt);
+    writer.EndObject();
+    Reply(client, cmd, nonce, data, writer.Size() < sizeof(data) ? writer.Size() : 0);
+}
+
+static void Forward(Client& client, const char* cmd, const char* nonce)
+{
+    if (!Upstream->IsOpen() || strcmp(client.appId, Upstream->appId) != 0) {
+        ReplyError(client, cmd, nonce, UnknownErrorCode, "Not connected to Discord");
+        return;
+    }
+    if (nonce) {
+        const int relayNonce = NextNonce++;
+        Pending[relayNonce] = Forwarded{client.id, nonce, cmd};
+        const std::string relayNonceText = std::to_string(relayNonce);
+        Message["nonce"].SetString(relayNonceText.c_str(),
+                                   (rapidjson::SizeType)relayNonceText.size(),
+                                   Message.GetAllocator());
+    }
+    // our nonce can be longer than the client's, so a command that just fit its frame may not
+    // fit ours
+    const size_t length = WriteJson(Message);
+    if (!length || length > sizeof(Upstream->sendFrame.message)) {
+        if (nonce) {
+            Pending.erase(NextNonce - 1);
+        }
+        ReplyError(client, cmd, nonce, InvalidPayloadCode, "Command is too big");
+        return;
+    }
+    if (Upstream->Write(JsonBuffer, length)) {
+        ++Stats.commandsForwarded;
+    }
+}
+
+static bool HandleCommand(Client& client)
+{
+    Message.Reset();
+    Message.ParseInsitu(FrameBuffer);
+    if (Message.HasParseError() || !Message.IsObject()) {
+        SendClose(client, InvalidPayloadCode, "Payload is not a JSON object");
+        return false;
+    }
+    const char* cmd = GetStrMember(&Message, "cmd");
+    const char* nonce = GetStrMember(&Message, "nonce");
+    auto args = GetObjMember(&Message, "args");
+    if (!cmd) {
+        ReplyError(client, "", nonce, InvalidPayloadCode, "Missing cmd");
+    }
+    else if (strcmp(cmd, "SET_ACTIVITY") == 0) {
+        if (args) {
+            SetActivity(client, args, nonce);
+        }
+        else {
+            ReplyError(client, cmd, nonce, InvalidPayloadCode, "Missing args");
+        }
+    }
+    else if (strcmp(cmd, "ATTACH_PRESENCE_CHANNEL") == 0) {
+        auto name = GetStrMember(args, "name");
+        if (name) {
+            AttachPresenceChannel(client, name, nonce);
+        }
+        else {
+            ReplyError(client, cmd, nonce, InvalidPayloadCode, "Missing name");
+        }
+    }
+    else if (strcmp(cmd, "SUBSCRIBE") == 0 || strcmp(cmd, "UNSUBSCRIBE") == 0) {
+        // unlike most commands, the event goes at the top
+        auto evt = GetStrMember(&Message, "evt");
+        if (evt) {
+            Subscribe(client, cmd, evt, nonce);
+        }
+        else {
+            ReplyError(client, cmd, nonce, InvalidPayloadCode, "Missing evt");
+        }
+    }
+    else {
+        Forward(client, cmd, nonce);
+    }
+    return client.pipe->isOpen;
+}
+
+static bool HandleClientFrame(Client& client, Opcode opcode, size_t length)
+{
+    switch (opcode) {
+    case Opcode::Handshake:
+        return HandleHandshake(client);
+    case Opcode::Frame:
+        if (!client.handshaken) {
+            SendClose(client, InvalidPayloadCode, "Handshake first");
+            return false;
+        }
+        return HandleCommand(client);
+    case Opcode::Ping:
+        return SendToClient(client, Opcode::Pong, FrameBuffer, length);
+    case Opcode::Pong:
+        return true;
+    case Opcode::Close:
+    default:
+        return false;
+    }
+}
+
+// Handles whatever the client has sent, counting the frames (and presences from its channel) in
+// *frames; false once it's gone.
+static bool PollClient(Client& client, int* frames)
+{
+    for (*frames = 0; *frames < MaxFramesPerPass; ++*frames) {
+        if (!client.haveHeader) {
+            if (!client.pipe->Read(&client.header, sizeof(client.header))) {
+                break;
+            }
+            if (client.header.length >= sizeof(FrameBuffer)) {
+                SendClose(client, InvalidPayloadCode, "Frame too large");
+                return false;
+            }
+            client.haveHeader = true;
+        }
+        // unlike the library we wait for the rest of a frame; a client can be slower than Discord
+        if (client.header.length && !client.pipe->Read(FrameBuffer, client.header.length)) {
+            break;
+        }
+        client.haveHeader = false;
+        FrameBuffer[client.header.length] = 0;
+        if (!HandleClientFrame(client, client.header.opcode, client.header.length)) {
+            return false;
+        }
+    }
+    if (client.pipe->isOpen && PollChannel(client)) {
+        ++*frames;
+    }
+    return client.pipe->isOpen;
+}
+
+static void DropClient(size_t index)
+{
+    auto client = Clients[index];
+    Log("client %u left", client->id);
+    for (auto pending = Pending.begin(); pending != Pending.end();) {
+        if (pending->second.clientId == client->id) {
+            pending = Pending.erase(pending);
+        }
+        else {
+            ++pending;
+        }
+    }
+    DownstreamPipe::Destroy(client->pipe);
+    PresenceChannel::Destroy(client->channel);
+    delete client;
+    Clients.erase(Clients.begin() + index);
+    SyncDue = true;
+}
+
+static bool ParsePriority(const char* arg)
+{
+    const char* equals = strchr(arg, '=');
+    if (!equals || equals == arg || !equals[1]) {
+        return false;
+    }
+    Priorities[std::string(arg, equals - arg)] = atoi(equals + 1);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    const char* pipeName = DefaultPipeName;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--pipe") == 0 && i + 1 < argc) {
+            pipeName = argv[++i];
+        }
+        else if (strcmp(argv[i], "--priority") == 0 && i + 1 < argc && ParsePriority(argv[i + 1])) {
+            ++i;
+        }
+        else {
+            printf("usage: relay [--pipe name] [--priority <application id>=<n>]...\n");
+            return 1;
+        }
+    }
+
+    StartMs = MonotonicNowMs();
+    if (!DownstreamPipe::Listen(pipeName)) {
+        printf("couldn't listen on %s\n", pipeName);
+        return 1;
+    }
+    Upstream = RpcConnection::Create("");
+    Upstream->onConnect = OnUpstreamConnect;
+    Upstream->onDisconnect = OnUpstreamDisconnect;
+    signal(SIGINT, Stop);
+    Log("relaying %s", pipeName);
+
+    while (Running.load()) {
+        const uint64_t framesBefore = Upstream->stats.framesIn.Get();
+        bool busy = false;
+        while (auto pipe = DownstreamPipe::Accept()) {
+            auto client = new Client();
+            client->pipe = pipe;
+            client->id = ++NextClientId;
+            Clients.push_back(client);
+            ++Stats.clients;
+            Log("client %u connected", client->id);
+            busy = true;
+        }
+        for (size_t i = 0; i < Clients.size();) {
+            int frames = 0;
+            if (!PollClient(*Clients[i], &frames)) {
+                DropClient(i);
+                busy = true;
+                continue;
+            }
+            busy = busy || frames > 0;
+            ++i;
+        }
+        if (SyncDue) {
+            SyncDue = false;
+            SyncUpstream();
+            busy = true;
+        }
+        UpdateUpstream();
+        if (!busy && Upstream->stats.framesIn.Get() == framesBefore) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(IdleSleepMs));
+        }
+    }
+
+    Log("shutting down");
+    Upstream->CloseWithError(RpcConnection::ErrorCode::Success, "Relay shutting down");
+    while (!Clients.empty()) {
+        DropClient(Clients.size() - 1);
+    }
+    DownstreamPipe::StopListening();
+    RpcConnection::Destroy(Upstream);
+
+    printf("%llu clients, %llu presences in (%llu from channels, %llu duplicates, %llu overtaken), "
+           "%llu sent to Discord\n",
+           (unsigned long long)Stats.clients,
+           (unsigned long long)Stats.presences,
+           (unsigned long long)Stats.fromChannels,
+           (unsigned long long)Stats.duplicates,
+           (unsigned long long)Stats.overtaken,
+           (unsigned long long)Stats.presencesSent);
+    printf("%llu commands forwarded, %llu events out, %llu connect attempts, %llu connects\n",
+           (unsigned long long)Stats.commandsForwarded,
+           (unsigned long long)Stats.eventsOut,
+           (unsigned long long)Stats.connectAttempts,
+           (unsigned long long)Stats.connects);
+    return 0;
+}
@@ -0,0 +1,43 @@
+-- Like the latency bench, the replay tool compiles the library in directly, with its own stand-in
+-- for the platform connection in place of the pipe.
+
+project "Replay"
+    language "C++"
+    targetname("replay")
+
+    kind "ConsoleApp"
+
+    includedirs
+    {
+        ".",
+        "../rpc",
+        "../../thirdparty/rapidjson-last/include"
+    }
+
+    vpaths
+    {
+        ["Headers/**"] = "**.h",
+        ["Sources/**"] = "**.cpp",
+        ["*"] = "premake5.lua"
+    }
+
+    files
+    {
+        "premake5.lua",
+        "replay.cpp",
+        "../rpc/*.h",
+        "../rpc/*.cpp"
+    }
+
+    removefiles
+    {
+        "../rpc/connection_win.cpp",
+        "../rpc/dllmain.cpp"
+    }
+
+    DeclareCompilationFlags()
+
+    removedefines
+    {
+        "DISCORD_DYNAMIC_LIB"
+    }
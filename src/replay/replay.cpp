@@ -0,0 +1,292 @@
+/*
+    Plays a flight recording (see Discord_StartFlightRecorder) back through the library: every
+    frame Discord sent goes through RpcConnection::Read and the same dispatch as
+    Discord_UpdateConnection, and the callbacks it produces are printed. Whatever the library sends
+    back is thrown away. A stand-in connection takes the place of the pipe, so Discord doesn't need
+    to be running.
+    Usage: replay <recording> [--dump] [--bench passes]
+      --dump   also list every recorded frame, both directions
+      --bench  replay this many times without printing, and report the time per inbound frame;
+               recordings from incidents make decent corpora for the read path
+*/
+
+#include "discord_rpc.h"
+
+#include "connection.h"
+#include "flight_recorder.h"
+#include "rpc_connection.h"
+#include "timer_wheel.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static std::vector<char> Recording;
+// the inbound frames, headers and all, back to back as they came off the pipe
+static std::vector<char> Inbound;
+static size_t InboundFrames{0};
+static size_t ReadOffset{0};
+static bool Quiet{false};
+
+static const char SyntheticReady[] =
+  "{\"cmd\":\"DISPATCH\",\"data\":{\"v\":1,\"user\":{\"id\":\"0\",\"username\":\"replay\","
+  "\"discriminator\":\"0000\"}},\"evt\":\"READY\",\"nonce\":null}";
+
+// The library's side of the pipe, served from the recording.
+
+int GetProcessId()
+{
+    return 1;
+}
+
+/*static*/ BaseConnection* BaseConnection::Create()
+{
+    return new BaseConnection();
+}
+
+/*static*/ void BaseConnection::Destroy(BaseConnection*& c)
+{
+    delete c;
+    c = nullptr;
+}
+
+/*static*/ bool BaseConnection::ServerAvailable()
+{
+    return true;
+}
+
+/*static*/ void BaseConnection::SetPipeBaseName(const char*) {}
+
+bool BaseConnection::Open()
+{
+    isOpen = true;
+    return true;
+}
+
+bool BaseConnection::Close()
+{
+    isOpen = false;
+    return true;
+}
+
+bool BaseConnection::Write(const void*, size_t)
+{
+    return isOpen;
+}
+
+bool BaseConnection::Read(void* data, size_t length)
+{
+    if (!isOpen || Inbound.size() - ReadOffset < length) {
+        return false;
+    }
+    memcpy(data, Inbound.data() + ReadOffset, length);
+    ReadOffset += length;
+    return true;
+}
+
+static void AppendInbound(uint32_t opcode, const char* payload, uint32_t length)
+{
+    RpcConnection::MessageFrameHeader header{(RpcConnection::Opcode)opcode, length};
+    auto bytes = reinterpret_cast<const char*>(&header);
+    Inbound.insert(Inbound.end(), bytes, bytes + sizeof(header));
+    Inbound.insert(Inbound.end(), payload, payload + length);
+    ++InboundFrames;
+}
+
+// payloads aren't terminated
+static bool Contains(const char* data, size_t length, const char* needle)
+{
+    const size_t needleLength = strlen(needle);
+    for (size_t i = 0; i + needleLength <= length; ++i) {
+        if (!memcmp(data + i, needle, needleLength)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool LoadRecording(const char* path, bool dump)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        printf("couldn't open %s\n", path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    Recording.resize(size > 0 ? (size_t)size : 0);
+    const size_t read = Recording.empty() ? 0 : fread(Recording.data(), 1, Recording.size(), file);
+    fclose(file);
+
+    FlightRecordingHeader header{};
+    if (read >= sizeof(header)) {
+        memcpy(&header, Recording.data(), sizeof(header));
+    }
+
+    bool first = true;
+    const bool ok = ForEachFlightRecord(
+      Recording.data(), read, [&](const FlightRecord& record, const char* payload) {
+          if (dump) {
+              const int64_t offsetUs = record.timestampUs - header.createdMonotonicUs;
+              printf("%10.3f ms %s op=%u len=%-6u %.*s\n",
+                     (double)offsetUs / 1000.0,
+                     record.direction == FlightRecord::In ? "<-" : "->",
+                     record.opcode,
+                     record.length,
+                     (int)(record.length > 200 ? 200 : record.length),
+                     payload);
+          }
+          if (record.direction != FlightRecord::In) {
+              return;
+          }
+          // the ring may have lost the start of the session; the library won't go on without READY
+          if (first && (record.opcode != (uint32_t)RpcConnection::Opcode::Frame ||
+                        !Contains(payload, record.length, "\"READY\""))) {
+              AppendInbound((uint32_t)RpcConnection::Opcode::Frame,
+                            SyntheticReady,
+                            (uint32_t)(sizeof(SyntheticReady) - 1));
+          }
+          first = false;
+          AppendInbound(record.opcode, payload, record.length);
+      });
+    if (!ok) {
+        printf("%s isn't a flight recording\n", path);
+        return false;
+    }
+    if (!Quiet) {
+        printf("%s: recorded %lld, %u bytes of ring, %u inbound frames, %llu dropped\n",
+               path,
+               (long long)header.createdUnixSeconds,
+               header.dataSize,
+               (unsigned)InboundFrames,
+               (unsigned long long)header.droppedRecords);
+    }
+    return true;
+}
+
+static void HandleReady(const DiscordUser* user)
+{
+    if (!Quiet) {
+        printf("ready: %s#%s (%s)\n", user->username, user->discriminator, user->userId);
+    }
+}
+
+static void HandleDisconnected(int errorCode, const char* message)
+{
+    if (!Quiet) {
+        printf("disconnected: %d %s\n", errorCode, message);
+    }
+}
+
+static void HandleErrored(int errorCode, const char* message)
+{
+    if (!Quiet) {
+        printf("errored: %d %s\n", errorCode, message);
+    }
+}
+
+static void HandleJoinGame(const char* secret)
+{
+    if (!Quiet) {
+        printf("joinGame: %s\n", secret);
+    }
+}
+
+static void HandleSpectateGame(const char* secret)
+{
+    if (!Quiet) {
+        printf("spectateGame: %s\n", secret);
+    }
+}
+
+static void HandleJoinRequest(const DiscordUser* user)
+{
+    if (!Quiet) {
+        printf("joinRequest: %s#%s (%s)\n", user->username, user->discriminator, user->userId);
+    }
+}
+
+// Runs the library until it's read everything. A Close in the recording means a reconnect, which
+// waits out the real backoff, so give up if nothing moves for a while.
+static void ReplayOnce()
+{
+    ReadOffset = 0;
+    DiscordEventHandlers handlers;
+    memset(&handlers, 0, sizeof(handlers));
+    handlers.ready = HandleReady;
+    handlers.disconnected = HandleDisconnected;
+    handlers.errored = HandleErrored;
+    handlers.joinGame = HandleJoinGame;
+    handlers.spectateGame = HandleSpectateGame;
+    handlers.joinRequest = HandleJoinRequest;
+    Discord_Initialize("replay", &handlers, 0, nullptr);
+
+    size_t lastOffset = ReadOffset;
+    int64_t lastProgressMs = MonotonicNowMs();
+    while (ReadOffset < Inbound.size()) {
+        Discord_UpdateConnection();
+        Discord_RunCallbacks();
+        if (ReadOffset != lastOffset) {
+            lastOffset = ReadOffset;
+            lastProgressMs = MonotonicNowMs();
+        }
+        else if (MonotonicNowMs() - lastProgressMs > 70 * 1000) {
+            printf("stuck at byte %u of %u\n", (unsigned)ReadOffset, (unsigned)Inbound.size());
+            break;
+        }
+    }
+    Discord_UpdateConnection();
+    Discord_RunCallbacks();
+    Discord_Shutdown();
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = nullptr;
+    bool dump = false;
+    int passes = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--dump")) {
+            dump = true;
+        }
+        else if (!strcmp(argv[i], "--bench") && i + 1 < argc) {
+            passes = atoi(argv[++i]);
+        }
+        else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        printf("usage: replay <recording> [--dump] [--bench passes]\n");
+        return 1;
+    }
+    if (!LoadRecording(path, dump)) {
+        return 1;
+    }
+
+    if (passes <= 0) {
+        ReplayOnce();
+        return 0;
+    }
+
+    Quiet = true;
+    ReplayOnce(); // warm up
+    DiscordAllocationStats before, after;
+    Discord_GetAllocationStats(&before);
+    const int64_t startUs = MonotonicNowUs();
+    for (int pass = 0; pass < passes; ++pass) {
+        ReplayOnce();
+    }
+    const int64_t elapsedUs = MonotonicNowUs() - startUs;
+    Discord_GetAllocationStats(&after);
+    const double frames = (double)InboundFrames * passes;
+    printf("%d passes, %u frames each: %.3f us/frame, %.1f allocs/pass (client setup included)\n",
+           passes,
+           (unsigned)InboundFrames,
+           (double)elapsedUs / frames,
+           (double)(after.allocations - before.allocations) / passes);
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include "allocator.h"
+#include "discord_rpc.h"
+
+#include <atomic>
+#include <stdlib.h>
+
+// Set before anything allocates and left alone while anything's alive, so no need to guard these.
+static DiscordMallocFn MallocHook{nullptr};
+static DiscordReallocFn ReallocHook{nullptr};
+static DiscordFreeFn FreeHook{nullptr};
+static void* HookUserData{nullptr};
+
+// Cheap enough to always keep; they're how we check the steady state never allocates.
+static std::atomic<uint64_t> Allocations{0};
+static std::atomic<uint64_t> Reallocations{0};
+static std::atomic<uint64_t> Frees{0};
+static std::atomic<uint64_t> BytesRequested{0};
+
+void* DiscordMalloc(size_t size)
+{
+    Allocations.fetch_add(1, std::memory_order_relaxed);
+    BytesRequested.fetch_add(size, std::memory_order_relaxed);
+    return MallocHook ? MallocHook(size, HookUserData) : malloc(size);
+}
+
+void* DiscordRealloc(void* ptr, size_t size)
+{
+    (ptr ? Reallocations : Allocations).fetch_add(1, std::memory_order_relaxed);
+    BytesRequested.fetch_add(size, std::memory_order_relaxed);
+    return ReallocHook ? ReallocHook(ptr, size, HookUserData) : realloc(ptr, size);
+}
+
+void DiscordFree(void* ptr)
+{
+    if (!ptr) {
+        return;
+    }
+    Frees.fetch_add(1, std::memory_order_relaxed);
+    if (FreeHook) {
+        FreeHook(ptr, HookUserData);
+    }
+    else {
+        free(ptr);
+    }
+}
+
+extern "C" DISCORD_EXPORT void Discord_SetAllocator(DiscordMallocFn mallocFn,
+                                                    DiscordReallocFn reallocFn,
+                                                    DiscordFreeFn freeFn,
+                                                    void* userData)
+{
+    // all or nothing, mixing ours and theirs would end with something freed by the wrong heap
+    if (!mallocFn || !reallocFn || !freeFn) {
+        mallocFn = nullptr;
+        reallocFn = nullptr;
+        freeFn = nullptr;
+        userData = nullptr;
+    }
+    MallocHook = mallocFn;
+    ReallocHook = reallocFn;
+    FreeHook = freeFn;
+    HookUserData = userData;
+}
+
+extern "C" DISCORD_EXPORT void Discord_GetAllocationStats(DiscordAllocationStats* stats)
+{
+    if (!stats) {
+        return;
+    }
+    stats->allocations = Allocations.load(std::memory_order_relaxed);
+    stats->reallocations = Reallocations.load(std::memory_order_relaxed);
+    stats->frees = Frees.load(std::memory_order_relaxed);
+    stats->bytesRequested = BytesRequested.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+// Every heap allocation the library makes goes through these, so a game can hand us its own
+// allocator with Discord_SetAllocator. They default to malloc/realloc/free, and have malloc's
+// alignment guarantees whatever they're backed by.
+
+#include <new>
+#include <stddef.h>
+#include <utility>
+
+void* DiscordMalloc(size_t size);
+void* DiscordRealloc(void* ptr, size_t size);
+void DiscordFree(void* ptr);
+
+// new (std::nothrow) T(), just not from the global heap
+template <typename T, typename... Args>
+T* DiscordNew(Args&&... args)
+{
+    void* memory = DiscordMalloc(sizeof(T));
+    if (!memory) {
+        return nullptr;
+    }
+    return new (memory) T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+void DiscordDelete(T* object)
+{
+    if (object) {
+        object->~T();
+        DiscordFree(object);
+    }
+}
+
+// rapidjson's allocator concept on top of the hooks, to stand in for its CrtAllocator
+class HookAllocator {
+public:
+    static const bool kNeedFree = true;
+    void* Malloc(size_t size) { return size ? DiscordMalloc(size) : nullptr; }
+    void* Realloc(void* originalPtr, size_t originalSize, size_t newSize)
+    {
+        (void)originalSize;
+        if (newSize == 0) {
+            DiscordFree(originalPtr);
+            return nullptr;
+        }
+        return DiscordRealloc(originalPtr, newSize);
+    }
+    static void Free(void* ptr) { DiscordFree(ptr); }
+};
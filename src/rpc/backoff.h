@@ -1,10 +1,24 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <random>
 #include <stdint.h>
 #include <time.h>
 
+// Where each new Backoff gets its seed. Normally that's the time, but after Discord_SetRandomSeed
+// it's the seed plus how many have been handed out since, so a simulation that creates its
+// clients in the same order gets the same jitter every run.
+inline std::atomic<uint64_t> BackoffSeedBase{0};
+inline std::atomic<uint64_t> BackoffSeedsIssued{0};
+
+inline uint64_t NextBackoffSeed()
+{
+    const uint64_t base = BackoffSeedBase.load();
+    const uint64_t issued = BackoffSeedsIssued.fetch_add(1);
+    return (base ? base : (uint64_t)time(0)) + issued;
+}
+
 struct Backoff {
     int64_t minAmount;
     int64_t maxAmount;
@@ -15,12 +29,12 @@ struct Backoff {
 
     double rand01() { return randDistribution(randGenerator); }
 
-    Backoff(int64_t min, int64_t max)
+    Backoff(int64_t min, int64_t max, uint64_t seed = NextBackoffSeed())
       : minAmount(min)
       , maxAmount(max)
       , current(min)
       , fails(0)
-      , randGenerator((uint64_t)time(0))
+      , randGenerator(seed)
     {
     }
 
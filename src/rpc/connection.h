@@ -11,6 +11,12 @@ int GetProcessId();
 struct BaseConnection {
     static BaseConnection* Create();
     static void Destroy(BaseConnection*&);
+    // Is there a Discord endpoint to connect to at all? Looks without connecting, and is cheap
+    // enough to ask every pass: the answer is cached process-wide for a few milliseconds.
+    static bool ServerAvailable();
+    // Discord_SetPipeBaseName and the benchmarks point us somewhere other than "discord-ipc-" with
+    // this; we try <name>0 to <name>9. Set it before anything connects.
+    static void SetPipeBaseName(const char* baseName);
     bool isOpen{false};
     bool Open();
     bool Close();
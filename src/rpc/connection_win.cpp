@@ -1,11 +1,16 @@
+#include "allocator.h"
 #include "connection.h"
+#include "timer_wheel.h"
 
 #define WIN32_LEAN_AND_MEAN
 #define NOMCX
 #define NOSERVICE
 #define NOIME
 #include <assert.h>
+#include <atomic>
+#include <new>
 #include <windows.h>
+#include <strsafe.h>
 
 int GetProcessId()
 {
@@ -16,25 +21,65 @@ struct BaseConnectionWin : public BaseConnection {
     HANDLE pipe{INVALID_HANDLE_VALUE};
 };
 
-static BaseConnectionWin Connection;
-
 /*static*/ BaseConnection* BaseConnection::Create()
 {
-    return &Connection;
+    return DiscordNew<BaseConnectionWin>();
 }
 
 /*static*/ void BaseConnection::Destroy(BaseConnection*& c)
 {
     auto self = reinterpret_cast<BaseConnectionWin*>(c);
     self->Close();
+    DiscordDelete(self);
     c = nullptr;
 }
 
+// How stale the pipe listing may get; this bounds how long after Discord starts we notice it.
+static const int64_t ServerProbeIntervalMs = 50;
+static std::atomic<int64_t> LastServerProbeMs{0};
+static std::atomic_bool LastServerAvailable{false};
+
+static wchar_t PipeBaseName[64]{L"discord-ipc-"};
+
+/*static*/ void BaseConnection::SetPipeBaseName(const char* baseName)
+{
+    size_t i = 0;
+    for (; baseName && baseName[i] && i < sizeof(PipeBaseName) / sizeof(wchar_t) - 1; ++i) {
+        PipeBaseName[i] = (wchar_t)(unsigned char)baseName[i];
+    }
+    PipeBaseName[i] = 0;
+    // whatever we saw was for the old name
+    LastServerProbeMs.store(0);
+}
+
+/*static*/ bool BaseConnection::ServerAvailable()
+{
+    // There's no change notification for the pipe namespace, but listing it never touches a pipe
+    // instance, so unlike a connect attempt it can't eat one of Discord's listeners.
+    const int64_t nowMs = MonotonicNowMs();
+    auto lastProbe = LastServerProbeMs.load();
+    if ((lastProbe && nowMs - lastProbe < ServerProbeIntervalMs) ||
+        !LastServerProbeMs.compare_exchange_strong(lastProbe, nowMs)) {
+        return LastServerAvailable.load();
+    }
+
+    wchar_t pattern[96];
+    StringCbPrintfW(pattern, sizeof(pattern), L"\\\\.\\pipe\\%s*", PipeBaseName);
+    WIN32_FIND_DATAW findData;
+    HANDLE find = ::FindFirstFileW(pattern, &findData);
+    const bool available = find != INVALID_HANDLE_VALUE;
+    if (available) {
+        ::FindClose(find);
+    }
+    LastServerAvailable.store(available);
+    return available;
+}
+
 bool BaseConnection::Open()
 {
-    wchar_t pipeName[]{L"\\\\?\\pipe\\discord-ipc-0"};
-    const size_t pipeDigit = sizeof(pipeName) / sizeof(wchar_t) - 2;
-    pipeName[pipeDigit] = L'0';
+    wchar_t pipeName[96];
+    StringCbPrintfW(pipeName, sizeof(pipeName), L"\\\\?\\pipe\\%s0", PipeBaseName);
+    const size_t pipeDigit = wcslen(pipeName) - 1;
     auto self = reinterpret_cast<BaseConnectionWin*>(this);
     for (;;) {
         self->pipe = ::CreateFileW(
@@ -44,19 +89,15 @@ bool BaseConnection::Open()
             return true;
         }
 
+        // A busy pipe is treated like a missing one: waiting on it here would stall every other
+        // client sharing the IO thread, so try the next one and let the backoff retry later.
         auto lastError = GetLastError();
-        if (lastError == ERROR_FILE_NOT_FOUND) {
+        if (lastError == ERROR_FILE_NOT_FOUND || lastError == ERROR_PIPE_BUSY) {
             if (pipeName[pipeDigit] < L'9') {
                 pipeName[pipeDigit]++;
                 continue;
             }
         }
-        else if (lastError == ERROR_PIPE_BUSY) {
-            if (!WaitNamedPipeW(pipeName, 10000)) {
-                return false;
-            }
-            continue;
-        }
         return false;
     }
 }
@@ -0,0 +1,183 @@
+#pragma once
+
+#include "discord_rpc.h"
+
+#include "backoff.h"
+#include "handler_table.h"
+#include "io_reactor.h"
+#include "memory_config.h"
+#include "msg_queue.h"
+#include "presence_channel.h"
+#include "presence_snapshot.h"
+#include "request_table.h"
+#include "rpc_connection.h"
+#include "stats.h"
+#include "timer_wheel.h"
+
+#include <atomic>
+#include <mutex>
+#ifndef DISCORD_DISABLE_IO_THREAD
+#include <thread>
+#endif
+
+constexpr size_t MaxMessageSize{DISCORD_MAX_MESSAGE_SIZE};
+constexpr size_t MessageQueueSize{DISCORD_SEND_QUEUE_SIZE};
+constexpr size_t JoinQueueSize{DISCORD_JOIN_QUEUE_SIZE};
+// every event subscription, the presence, and attaching the presence channel for the relay
+constexpr size_t RestoreBatchMaxFrames{5};
+// How many commands back we remember send times for, to time their answers. An answer to anything
+// older than this is long overdue anyway.
+constexpr size_t SentLogSize{16};
+// Health check defaults: ping this often while connected, and give up on a connection when a ping
+// or the handshake goes this long unanswered. Discord answers both in well under a millisecond.
+constexpr uint32_t DefaultPingIntervalMs{5 * 1000};
+constexpr uint32_t DefaultLivenessTimeoutMs{15 * 1000};
+
+struct QueuedMessage {
+    size_t length;
+    int nonce;
+    char buffer[MaxMessageSize];
+
+    void Copy(const QueuedMessage& other)
+    {
+        length = other.length;
+        nonce = other.nonce;
+        if (length) {
+            memcpy(buffer, other.buffer, length);
+        }
+    }
+};
+
+struct User {
+    // snowflake (64bit int), turned into a ascii decimal string, at most 20 chars +1 null
+    // terminator = 21
+    char userId[32];
+    // 32 unicode glyphs is max name size => 4 bytes per glyph in the worst case, +1 for null
+    // terminator = 129
+    char username[344];
+    // 4 decimal digits + 1 null terminator = 5
+    char discriminator[8];
+    // optional 'a_' + md5 hex digest (32 bytes) + null terminator = 35
+    char avatar[128];
+    // Rounded way up because I'm paranoid about games breaking from future changes in these sizes
+    int64_t queuedUs;
+};
+
+struct SentCommand {
+    int nonce;
+    int64_t sentUs;
+};
+
+// Everything one connection to Discord needs. The plain Discord_* API drives a default instance of
+// this; Discord_CreateClient hands out as many more as you like, they share nothing but the pid.
+struct DiscordClient {
+    RpcConnection* connection{nullptr};
+    IoReactor* reactor{nullptr};
+    IoReactorEntry reactorEntry;
+    HandlerTable handlers;
+    std::atomic_bool wasJustConnected{false};
+    std::atomic_bool wasJustDisconnected{false};
+    std::atomic_bool gotErrorMessage{false};
+    std::atomic_bool wasJoinGame{false};
+    std::atomic_bool wasSpectateGame{false};
+    std::atomic_bool updatePresence{false};
+    char joinGameSecret[256]{};
+    char spectateGameSecret[256]{};
+    // when the IO loop raised each of the flags above, for the dispatch delay histogram
+    int64_t connectedUs{0};
+    int64_t disconnectedUs{0};
+    int64_t errorUs{0};
+    int64_t joinGameUs{0};
+    int64_t spectateGameUs{0};
+    int lastErrorCode{0};
+    char lastErrorMessage[256]{};
+    int lastDisconnectErrorCode{0};
+    char lastDisconnectErrorMessage[256]{};
+    std::mutex presenceMutex;
+    QueuedMessage queuedPresence{};
+    // nonce of the presence the IO thread took for sending, 0 if it has to be sent (again)
+    int sentPresenceNonce{0};
+    // IO thread's copy of the presence it's writing, so the game can queue another meanwhile
+    QueuedMessage sendingPresence;
+    // Only once the relay offers one (see presence_channel.h). Every presence goes in here as well,
+    // and once the relay has attached it, plain presence updates skip the pipe altogether. Created
+    // by the IO loop and written by whoever updates the presence, both under presenceMutex.
+    PresenceChannel* presenceChannel{nullptr};
+    char presenceChannelName[64]{};
+    std::atomic_bool presenceChannelAttached{false};
+    // IO thread only: the attach waiting on its answer, 0 if none is
+    int presenceChannelNonce{0};
+    // Only if the game asked for one with Discord_SetPresenceSnapshotDirectory. Every presence is
+    // saved here too, under presenceMutex; subscriptions are saved whenever the handlers change.
+    PresenceSnapshot* presenceSnapshot{nullptr};
+    // Events the snapshot had us subscribed to that our handlers don't cover (yet). They get
+    // subscribed on connect all the same, until the game updates its handlers and says what it
+    // really wants. SnapshotActivity* bits.
+    std::atomic<uint32_t> snapshotSubscriptions{0};
+    // Whether this connection has had its subscriptions sent yet. Until it has, handler changes
+    // only change what the restore batch will subscribe to; after, they're sent as they happen.
+    // The mutex keeps a handler change from landing between the batch reading the handlers and
+    // setting the flag.
+    std::mutex subscriptionMutex;
+    bool subscriptionsSent{false};
+    MsgQueue<QueuedMessage, MessageQueueSize> sendQueue;
+    MsgQueue<User, JoinQueueSize> joinAskQueue;
+    User connectedUser{};
+
+    // The wheel belongs to whoever runs this client's IO: the shared reactor, or when the user
+    // drives IO themselves, localTimers. Timers are only touched from that loop.
+    TimerWheel* timers{nullptr};
+#ifdef DISCORD_DISABLE_IO_THREAD
+    TimerWheel localTimers;
+#endif
+    Timer reconnectTimer;
+    Timer pollTimer;
+    Timer pingTimer;
+
+    // We want to auto connect, and retry on failure, but not as fast as possible. This does
+    // expoential backoff from 0.5 seconds to 1 minute
+    Backoff reconnectTimeMs{500, 60 * 1000};
+    bool connectDue{true};
+    bool waitingForServer{false};
+    int64_t handshakeStartedMs{0};
+
+    // set from anywhere with Discord_Client_SetHealthCheck, the IO loop picks them up
+    std::atomic<uint32_t> pingIntervalMs{DefaultPingIntervalMs};
+    std::atomic<uint32_t> livenessTimeoutMs{DefaultLivenessTimeoutMs};
+    std::atomic_bool pingDue{false};
+
+    // Session restore: right after READY we send every subscription and the last presence in one
+    // batch, then tick off nonces as they're answered. IO thread only.
+    int restoreNonces[RestoreBatchMaxFrames]{};
+    size_t restorePending{0};
+    int64_t restoreStartedMs{0};
+    int64_t lastRestoreMs{-1};
+    std::atomic_int nonce{1};
+    RequestTable requests;
+
+    ClientStats stats;
+    // IO thread only
+    SentCommand sentLog[SentLogSize]{};
+    size_t sentLogNext{0};
+
+    // A flight recorder started or stopped from outside waits here until the IO loop swaps it in,
+    // since the connection's recorder is the IO loop's alone.
+    std::mutex recorderMutex;
+    FlightRecorder* requestedRecorder{nullptr};
+    std::atomic_bool recorderRequested{false};
+
+    // Whether the IO is going yet. Always by the time Discord_CreateClient returns, unless it's a
+    // lazy start (Discord_SetLazyStart); then it's the first presence update or handler change
+    // that does it, and startMutex keeps two of those from both trying.
+    std::atomic_bool started{false};
+    std::mutex startMutex;
+    // what autoRegister registers; with a lazy start that happens off the caller's thread
+    char registerApplicationId[64]{};
+    char registerSteamId[64]{};
+#ifndef DISCORD_DISABLE_IO_THREAD
+    std::thread registerThread;
+#else
+    // the next Discord_Client_UpdateConnection does it
+    std::atomic_bool registerPending{false};
+#endif
+};
@@ -67,6 +67,26 @@ static LSTATUS regset(HKEY hkey,
     return ret;
 }
 
+// True if HKCU\keyName has valueName (nullptr for the default) set to exactly expected.
+static bool RegValueIs(const wchar_t* keyName, const wchar_t* valueName, const wchar_t* expected)
+{
+    HKEY key;
+    if (RegOpenKeyExW(HKEY_CURRENT_USER, keyName, 0, KEY_READ, &key) != ERROR_SUCCESS) {
+        return false;
+    }
+    wchar_t value[1024];
+    DWORD type = 0;
+    DWORD size = sizeof(value) - sizeof(wchar_t);
+    auto status = RegQueryValueExW(key, valueName, nullptr, &type, (BYTE*)value, &size);
+    RegCloseKey(key);
+    if (status != ERROR_SUCCESS || type != REG_SZ) {
+        return false;
+    }
+    // it's only terminated if whoever wrote it counted the terminator in
+    value[size / sizeof(wchar_t)] = 0;
+    return wcscmp(value, expected) == 0;
+}
+
 static void Discord_RegisterW(const wchar_t* applicationId, const wchar_t* command)
 {
     // https://msdn.microsoft.com/en-us/library/aa767914(v=vs.85).aspx
@@ -94,6 +114,20 @@ static void Discord_RegisterW(const wchar_t* applicationId, const wchar_t* comma
 
     wchar_t keyName[256];
     StringCbPrintfW(keyName, sizeof(keyName), L"Software\\Classes\\%s", protocolName);
+
+    // From the second run on everything is already there, and reading it back is a lot cheaper
+    // than writing it again: no flush, and no change notifications for whoever watches the key.
+    wchar_t iconKeyName[288];
+    StringCbPrintfW(iconKeyName, sizeof(iconKeyName), L"%s\\DefaultIcon", keyName);
+    wchar_t commandKeyName[288];
+    StringCbPrintfW(commandKeyName, sizeof(commandKeyName), L"%s\\shell\\open\\command", keyName);
+    if (RegValueIs(keyName, nullptr, protocolDescription) &&
+        RegValueIs(keyName, L"URL Protocol", L"") &&
+        RegValueIs(iconKeyName, nullptr, exeFilePath) &&
+        RegValueIs(commandKeyName, nullptr, openCommand)) {
+        return;
+    }
+
     HKEY key;
     auto status =
       RegCreateKeyExW(HKEY_CURRENT_USER, keyName, 0, nullptr, 0, KEY_WRITE, nullptr, &key, nullptr);
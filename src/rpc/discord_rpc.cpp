@@ -1,156 +1,346 @@
 #include "discord_rpc.h"
 
-#include "backoff.h"
+#include "discord_client.h"
 #include "discord_register.h"
-#include "msg_queue.h"
-#include "rpc_connection.h"
 #include "serialization.h"
+#include "trace.h"
 
 #include <atomic>
-#include <chrono>
 #include <mutex>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
 
-#ifndef DISCORD_DISABLE_IO_THREAD
-#include <condition_variable>
-#include <thread>
-#endif
+static DiscordClient* DefaultClient{nullptr};
+static int Pid{0};
+// so every client's presence channel gets a name of its own
+static std::atomic<unsigned> PresenceChannelsCreated{0};
+// names to try before giving up on a channel and sending the presence down the pipe
+constexpr int PresenceChannelNameAttempts{8};
+// empty unless the game wants its presence saved for the next process to pick up
+static char PresenceSnapshotDirectory[260]{};
+// when set, new clients put off registering, the IO thread and connecting until first used
+static bool LazyStart{false};
 
-constexpr size_t MaxMessageSize{16 * 1024};
-constexpr size_t MessageQueueSize{8};
-constexpr size_t JoinQueueSize{8};
+// While Discord isn't running we look for its pipe this often instead of backing off, so we
+// connect right after it starts without ever making a connect attempt that can't succeed.
+constexpr int64_t ServerWatchIntervalMs{50};
+// Discord answers the handshake right away, don't make it wait long for us to look.
+constexpr int64_t HandshakePollIntervalMs{10};
+// Pipe reads don't signal us, so while connected we check for messages this often.
+constexpr int64_t ReadPollIntervalMs{500};
+static_assert(ReadPollIntervalMs < TimerWheel::SlotCount,
+              "an idle poll has to fit in a lap of the timer wheel");
+// A pong normally comes right back, so look for it every millisecond at first; that keeps the RTT
+// honest without spinning for the whole timeout when Discord is wedged.
+constexpr int64_t PongFastPollMs{50};
 
-struct QueuedMessage {
-    size_t length;
-    char buffer[MaxMessageSize];
+static void SignalIOActivity(DiscordClient* client);
 
-    void Copy(const QueuedMessage& other)
-    {
-        length = other.length;
-        if (length) {
-            memcpy(buffer, other.buffer, length);
-        }
-    }
-};
-
-struct User {
-    // snowflake (64bit int), turned into a ascii decimal string, at most 20 chars +1 null
-    // terminator = 21
-    char userId[32];
-    // 32 unicode glyphs is max name size => 4 bytes per glyph in the worst case, +1 for null
-    // terminator = 129
-    char username[344];
-    // 4 decimal digits + 1 null terminator = 5
-    char discriminator[8];
-    // optional 'a_' + md5 hex digest (32 bytes) + null terminator = 35
-    char avatar[128];
-    // Rounded way up because I'm paranoid about games breaking from future changes in these sizes
-};
-
-static RpcConnection* Connection{nullptr};
-static DiscordEventHandlers QueuedHandlers{};
-static DiscordEventHandlers Handlers{};
-static std::atomic_bool WasJustConnected{false};
-static std::atomic_bool WasJustDisconnected{false};
-static std::atomic_bool GotErrorMessage{false};
-static std::atomic_bool WasJoinGame{false};
-static std::atomic_bool WasSpectateGame{false};
-static std::atomic_bool UpdatePresence{false};
-static char JoinGameSecret[256];
-static char SpectateGameSecret[256];
-static int LastErrorCode{0};
-static char LastErrorMessage[256];
-static int LastDisconnectErrorCode{0};
-static char LastDisconnectErrorMessage[256];
-static std::mutex PresenceMutex;
-static std::mutex HandlerMutex;
-static QueuedMessage QueuedPresence{};
-static MsgQueue<QueuedMessage, MessageQueueSize> SendQueue;
-static MsgQueue<User, JoinQueueSize> JoinAskQueue;
-static User connectedUser;
-
-// We want to auto connect, and retry on failure, but not as fast as possible. This does expoential
-// backoff from 0.5 seconds to 1 minute
-static Backoff ReconnectTimeMs(500, 60 * 1000);
-static auto NextConnect = std::chrono::system_clock::now();
-static int Pid{0};
-static int Nonce{1};
+static void UpdateReconnectTime(DiscordClient* client)
+{
+    client->timers->Schedule(&client->reconnectTimer,
+                             MonotonicNowMs() + client->reconnectTimeMs.nextDelay());
+}
 
-#ifndef DISCORD_DISABLE_IO_THREAD
-static void Discord_UpdateConnection(void);
-class IoThreadHolder {
-private:
-    std::atomic_bool keepRunning{true};
-    std::mutex waitForIOMutex;
-    std::condition_variable waitForIOActivity;
-    std::thread ioThread;
-
-public:
-    void Start()
+static void PollAfter(DiscordClient* client, int64_t delayMs)
+{
+    auto deadline = MonotonicNowMs() + delayMs;
+    // an earlier poll already armed covers this one
+    if (!client->pollTimer.IsArmed() || client->pollTimer.deadline > deadline) {
+        client->timers->Schedule(&client->pollTimer, deadline);
+    }
+}
+
+static void NoteSent(DiscordClient* client, int nonce, int64_t nowUs)
+{
+    auto& sent = client->sentLog[client->sentLogNext++ % SentLogSize];
+    sent.nonce = nonce;
+    sent.sentUs = nowUs;
+}
+
+static void NoteAnswered(DiscordClient* client, int nonce)
+{
+    if (nonce == 0) {
+        return;
+    }
+    for (auto& sent : client->sentLog) {
+        if (sent.nonce == nonce) {
+            const int64_t elapsedUs = MonotonicNowUs() - sent.sentUs;
+            client->stats.ackLatency.Record(elapsedUs > 0 ? (uint64_t)elapsedUs : 0);
+            sent.nonce = 0;
+            return;
+        }
+    }
+}
+
+static void NoteDispatched(DiscordClient* client, int64_t queuedUs)
+{
+    const int64_t waitedUs = MonotonicNowUs() - queuedUs;
+    client->stats.dispatchDelay.Record(waitedUs > 0 ? (uint64_t)waitedUs : 0);
+}
+
+static void NoteSendQueued(DiscordClient* client)
+{
+    client->stats.sendQueueHighWater.RaiseTo(client->sendQueue.PendingCount());
+}
+
+static uint32_t SubscriptionsOf(const DiscordEventHandlers& handlers)
+{
+    return (handlers.joinGame ? SnapshotActivityJoin : 0) |
+      (handlers.spectateGame ? SnapshotActivitySpectate : 0) |
+      (handlers.joinRequest ? SnapshotActivityJoinRequest : 0);
+}
+
+// The relay offered a presence channel; make ours if we haven't yet and tell it where to look.
+static void AppendAttachPresenceChannel(DiscordClient* client)
+{
+    PresenceChannel* channel;
     {
-        keepRunning.store(true);
-        ioThread = std::thread([&]() {
-            const std::chrono::duration<int64_t, std::milli> maxWait{500LL};
-            Discord_UpdateConnection();
-            while (keepRunning.load()) {
-                std::unique_lock<std::mutex> lock(waitForIOMutex);
-                waitForIOActivity.wait_for(lock, maxWait);
-                Discord_UpdateConnection();
+        std::lock_guard<std::mutex> guard(client->presenceMutex);
+        // The names are easy to guess, and one that's taken could be anybody's; move on to the
+        // next rather than write the presence somewhere we didn't make.
+        for (int attempt = 0; !client->presenceChannel && attempt < PresenceChannelNameAttempts;
+             ++attempt) {
+            char name[64];
+            snprintf(name,
+                     sizeof(name),
+                     "%s%d-%u",
+                     PresenceChannelPrefix,
+                     Pid,
+                     PresenceChannelsCreated.fetch_add(1));
+            client->presenceChannel = PresenceChannel::Create(name);
+            if (client->presenceChannel) {
+                StringCopy(client->presenceChannelName, name);
             }
-        });
+        }
+        channel = client->presenceChannel;
+    }
+    if (!channel) {
+        return;
+    }
+    const int nonce = client->nonce++;
+    const char* name = client->presenceChannelName;
+    if (client->connection->AppendFrame([nonce, name](char* dest, size_t maxLen) {
+            return JsonWriteAttachPresenceChannel(dest, maxLen, nonce, name);
+        })) {
+        client->presenceChannelNonce = nonce;
+        client->restoreNonces[client->restorePending++] = nonce;
     }
+}
+
+// Puts everything this session needs back in place with one write: a SUBSCRIBE for each event we
+// have a handler for, then the last presence, then the presence channel if it's the relay we've
+// reached. Nothing goes through sendQueue, so it can't overflow.
+static void RestoreSession(DiscordClient* client, bool offersPresenceChannel)
+{
+    auto connection = client->connection;
+    client->restorePending = 0;
+    client->restoreStartedMs = MonotonicNowMs();
 
-    void Notify() { waitForIOActivity.notify_all(); }
+    auto appendSubscribe = [client, connection](const char* evtName) {
+        const int nonce = client->nonce++;
+        if (connection->AppendFrame([nonce, evtName](char* dest, size_t maxLen) {
+                return JsonWriteSubscribeCommand(dest, maxLen, nonce, evtName);
+            })) {
+            client->restoreNonces[client->restorePending++] = nonce;
+        }
+    };
 
-    void Stop()
     {
-        keepRunning.exchange(false);
-        Notify();
-        if (ioThread.joinable()) {
-            ioThread.join();
+        std::lock_guard<std::mutex> guard(client->subscriptionMutex);
+        HandlerTable::ReadScope handlers(client->handlers);
+        client->subscriptionsSent = true;
+        const uint32_t subscriptions =
+          SubscriptionsOf(*handlers) | client->snapshotSubscriptions.load();
+        if (subscriptions & SnapshotActivityJoin) {
+            appendSubscribe("ACTIVITY_JOIN");
+        }
+        if (subscriptions & SnapshotActivitySpectate) {
+            appendSubscribe("ACTIVITY_SPECTATE");
+        }
+        if (subscriptions & SnapshotActivityJoinRequest) {
+            appendSubscribe("ACTIVITY_JOIN_REQUEST");
         }
     }
 
-    ~IoThreadHolder() { Stop(); }
-};
-#else
-class IoThreadHolder {
-public:
-    void Start() {}
-    void Stop() {}
-    void Notify() {}
-};
-#endif // DISCORD_DISABLE_IO_THREAD
-static IoThreadHolder* IoThread{nullptr};
+    int presenceNonce = 0;
+    {
+        std::lock_guard<std::mutex> guard(client->presenceMutex);
+        if (client->queuedPresence.length > 0) {
+            auto& presence = client->queuedPresence;
+            if (connection->AppendFrame([&presence](char* dest, size_t maxLen) {
+                    if (presence.length >= maxLen) {
+                        return (size_t)0;
+                    }
+                    memcpy(dest, presence.buffer, presence.length);
+                    return presence.length;
+                })) {
+                presenceNonce = presence.nonce;
+                client->sentPresenceNonce = presenceNonce;
+                client->restoreNonces[client->restorePending++] = presenceNonce;
+                client->updatePresence.exchange(false);
+            }
+            else {
+                // didn't fit, let the regular write path have a go
+                client->updatePresence.exchange(true);
+            }
+        }
+    }
+
+    // after the presence, so whatever's in the channel is at least as new as what the relay has
+    if (offersPresenceChannel) {
+        AppendAttachPresenceChannel(client);
+    }
+
+    if (!connection->FlushBatch()) {
+        client->restorePending = 0;
+        client->presenceChannelNonce = 0;
+        std::lock_guard<std::mutex> guard(client->presenceMutex);
+        if (client->sentPresenceNonce == presenceNonce) {
+            client->sentPresenceNonce = 0;
+        }
+        return;
+    }
+    const int64_t nowUs = MonotonicNowUs();
+    for (size_t i = 0; i < client->restorePending; ++i) {
+        NoteSent(client, client->restoreNonces[i], nowUs);
+    }
+    if (presenceNonce) {
+        client->stats.presenceSent.Add();
+        client->requests.Sent(presenceNonce, client->timers);
+    }
+    if (client->restorePending == 0) {
+        client->lastRestoreMs = 0;
+    }
+}
 
-static void UpdateReconnectTime()
+static void AckRestoreNonce(DiscordClient* client, int nonce)
 {
-    NextConnect = std::chrono::system_clock::now() +
-      std::chrono::duration<int64_t, std::milli>{ReconnectTimeMs.nextDelay()};
+    for (size_t i = 0; i < client->restorePending; ++i) {
+        if (client->restoreNonces[i] == nonce) {
+            client->restoreNonces[i] = client->restoreNonces[--client->restorePending];
+            if (client->restorePending == 0) {
+                client->lastRestoreMs = MonotonicNowMs() - client->restoreStartedMs;
+            }
+            return;
+        }
+    }
 }
 
-#ifdef DISCORD_DISABLE_IO_THREAD
-extern "C" DISCORD_EXPORT void Discord_UpdateConnection(void)
-#else
-static void Discord_UpdateConnection(void)
-#endif
+static void AdoptRequestedRecorder(DiscordClient* client)
 {
-    if (!Connection) {
+    FlightRecorder* previous;
+    {
+        std::lock_guard<std::mutex> guard(client->recorderMutex);
+        previous = client->connection->recorder;
+        client->connection->recorder = client->requestedRecorder;
+        client->requestedRecorder = nullptr;
+    }
+    FlightRecorder::Destroy(previous);
+}
+
+static void RunRegistration(DiscordClient* client)
+{
+    const int64_t startedUs = MonotonicNowUs();
+    if (client->registerSteamId[0]) {
+        Discord_RegisterSteamGame(client->registerApplicationId, client->registerSteamId);
+    }
+    else {
+        Discord_Register(client->registerApplicationId, nullptr);
+    }
+    client->stats.registerUs.Set((uint64_t)(MonotonicNowUs() - startedUs));
+}
+
+// Sends a ping when one's due and drops the connection if the last one went unanswered for too
+// long. Returns false if it closed the connection.
+static bool CheckHealth(DiscordClient* client)
+{
+    auto connection = client->connection;
+    const int64_t nowMs = MonotonicNowMs();
+    const uint32_t timeoutMs = client->livenessTimeoutMs.load();
+    if (connection->pingSentUs && timeoutMs && nowMs - connection->pingSentUs / 1000 > timeoutMs) {
+        client->stats.livenessTimeouts.Add();
+        connection->CloseWithError(RpcConnection::ErrorCode::Unresponsive,
+                                   "Discord stopped answering pings");
+        return false;
+    }
+    if (client->pingDue.exchange(false)) {
+        const uint32_t intervalMs = client->pingIntervalMs.load();
+        if (intervalMs == 0) {
+            client->timers->Cancel(&client->pingTimer);
+            return true;
+        }
+        // one at a time; a ping that's still out will hit the timeout above soon enough
+        if (!connection->pingSentUs && connection->SendPing()) {
+            client->stats.pingsSent.Add();
+            client->stats.pingSentUs.Set((uint64_t)connection->pingSentUs);
+        }
+        if (!connection->IsOpen()) {
+            return false;
+        }
+        client->timers->Schedule(&client->pingTimer, nowMs + intervalMs);
+    }
+    return true;
+}
+
+static void UpdateConnection(DiscordClient* client)
+{
+    auto connection = client->connection;
+    if (!connection) {
         return;
     }
+    DISCORD_TRACE_SCOPE("UpdateConnection");
+
+    if (client->recorderRequested.exchange(false)) {
+        AdoptRequestedRecorder(client);
+    }
 
-    if (!Connection->IsOpen()) {
-        if (std::chrono::system_clock::now() >= NextConnect) {
-            UpdateReconnectTime();
-            Connection->Open();
+    if (!connection->IsOpen()) {
+        if (connection->state == RpcConnection::State::Disconnected) {
+            if (!BaseConnection::ServerAvailable()) {
+                client->waitingForServer = true;
+                PollAfter(client, ServerWatchIntervalMs);
+                return;
+            }
+            if (client->waitingForServer) {
+                // it just showed up, whatever the backoff had in mind is moot
+                client->waitingForServer = false;
+                client->reconnectTimeMs.reset();
+                client->connectDue = true;
+            }
+            if (!client->connectDue) {
+                // the reconnect timer will let us know
+                return;
+            }
+            client->connectDue = false;
+            client->stats.connectAttempts.Add();
+            client->handshakeStartedMs = MonotonicNowMs();
+            UpdateReconnectTime(client);
+        }
+        connection->Open();
+        if (connection->state == RpcConnection::State::SentHandshake) {
+            const uint32_t timeoutMs = client->livenessTimeoutMs.load();
+            if (timeoutMs && MonotonicNowMs() - client->handshakeStartedMs > timeoutMs) {
+                client->stats.livenessTimeouts.Add();
+                connection->CloseWithError(RpcConnection::ErrorCode::Unresponsive,
+                                           "Discord never answered the handshake");
+            }
+            else {
+                PollAfter(client, HandshakePollIntervalMs);
+            }
+        }
+        else if (connection->IsOpen()) {
+            PollAfter(client, 0);
         }
     }
     else {
         // reads
 
         for (;;) {
-            JsonDocument message;
+            auto& message = connection->readDocument;
 
-            if (!Connection->Read(message)) {
+            if (!connection->Read(message)) {
                 break;
             }
 
@@ -158,13 +348,41 @@ static void Discord_UpdateConnection(void)
             const char* nonce = GetStrMember(&message, "nonce");
 
             if (nonce) {
-                // in responses only -- should use to match up response when needed.
+                // in responses only -- matched up with whatever is waiting on this nonce
+                const int nonceValue = atoi(nonce);
+                NoteAnswered(client, nonceValue);
+
+                if (client->restorePending) {
+                    AckRestoreNonce(client, nonceValue);
+                }
+
+                if (nonceValue == client->presenceChannelNonce) {
+                    client->presenceChannelNonce = 0;
+                    // turned down, it stays the pipe
+                    if (!evtName || strcmp(evtName, "ERROR") != 0) {
+                        client->presenceChannelAttached.store(true);
+                    }
+                }
 
                 if (evtName && strcmp(evtName, "ERROR") == 0) {
                     auto data = GetObjMember(&message, "data");
-                    LastErrorCode = GetIntMember(data, "code");
-                    StringCopy(LastErrorMessage, GetStrMember(data, "message", ""));
-                    GotErrorMessage.store(true);
+                    client->lastErrorCode = GetIntMember(data, "code");
+                    StringCopy(client->lastErrorMessage, GetStrMember(data, "message", ""));
+                    client->errorUs = MonotonicNowUs();
+                    client->gotErrorMessage.store(true);
+                    client->requests.Complete(nonceValue,
+                                              client->timers,
+                                              DISCORD_REQUEST_ERROR,
+                                              client->lastErrorCode,
+                                              client->lastErrorMessage);
+                }
+                else {
+                    client->requests.Complete(nonceValue,
+                                              client->timers,
+                                              DISCORD_REQUEST_OK,
+                                              0,
+                                              nullptr,
+                                              GetObjMember(&message, "data"));
                 }
             }
             else {
@@ -178,15 +396,17 @@ static void Discord_UpdateConnection(void)
                 if (strcmp(evtName, "ACTIVITY_JOIN") == 0) {
                     auto secret = GetStrMember(data, "secret");
                     if (secret) {
-                        StringCopy(JoinGameSecret, secret);
-                        WasJoinGame.store(true);
+                        StringCopy(client->joinGameSecret, secret);
+                        client->joinGameUs = MonotonicNowUs();
+                        client->wasJoinGame.store(true);
                     }
                 }
                 else if (strcmp(evtName, "ACTIVITY_SPECTATE") == 0) {
                     auto secret = GetStrMember(data, "secret");
                     if (secret) {
-                        StringCopy(SpectateGameSecret, secret);
-                        WasSpectateGame.store(true);
+                        StringCopy(client->spectateGameSecret, secret);
+                        client->spectateGameUs = MonotonicNowUs();
+                        client->wasSpectateGame.store(true);
                     }
                 }
                 else if (strcmp(evtName, "ACTIVITY_JOIN_REQUEST") == 0) {
@@ -194,8 +414,14 @@ static void Discord_UpdateConnection(void)
                     auto userId = GetStrMember(user, "id");
                     auto username = GetStrMember(user, "username");
                     auto avatar = GetStrMember(user, "avatar");
-                    auto joinReq = JoinAskQueue.GetNextAddMessage();
-                    if (userId && username && joinReq) {
+                    if (!userId || !username) {
+                        continue;
+                    }
+                    auto joinReq = client->joinAskQueue.GetNextAddMessage();
+                    if (!joinReq) {
+                        client->stats.joinQueueDrops.Add();
+                    }
+                    else {
                         StringCopy(joinReq->userId, userId);
                         StringCopy(joinReq->username, username);
                         auto discriminator = GetStrMember(user, "discriminator");
@@ -208,245 +434,745 @@ static void Discord_UpdateConnection(void)
                         else {
                             joinReq->avatar[0] = 0;
                         }
-                        JoinAskQueue.CommitAdd();
+                        joinReq->queuedUs = MonotonicNowUs();
+                        client->joinAskQueue.CommitAdd();
+                        client->stats.joinQueueHighWater.RaiseTo(
+                          client->joinAskQueue.PendingCount());
                     }
                 }
             }
         }
 
+        if (!CheckHealth(client)) {
+            return;
+        }
+
         // writes
-        if (UpdatePresence.exchange(false) && QueuedPresence.length) {
-            QueuedMessage local;
+        if (client->updatePresence.exchange(false) && client->queuedPresence.length) {
+            auto& local = client->sendingPresence;
             {
-                std::lock_guard<std::mutex> guard(PresenceMutex);
-                local.Copy(QueuedPresence);
+                std::lock_guard<std::mutex> guard(client->presenceMutex);
+                local.Copy(client->queuedPresence);
+                client->sentPresenceNonce = local.nonce;
+            }
+            if (connection->Write(local.buffer, local.length)) {
+                NoteSent(client, local.nonce, MonotonicNowUs());
+                client->stats.presenceSent.Add();
+                client->requests.Sent(local.nonce, client->timers);
+            }
+            else {
+                // if we fail to send, requeue, unless something newer was queued meanwhile
+                std::lock_guard<std::mutex> guard(client->presenceMutex);
+                if (client->queuedPresence.nonce == local.nonce) {
+                    client->sentPresenceNonce = 0;
+                    client->updatePresence.exchange(true);
+                }
+            }
+        }
+
+        while (client->sendQueue.HavePendingSends()) {
+            auto qmessage = client->sendQueue.GetNextSendMessage();
+            if (qmessage->length == 0) {
+                // abandoned after it was queued
+            }
+            else if (connection->Write(qmessage->buffer, qmessage->length)) {
+                NoteSent(client, qmessage->nonce, MonotonicNowUs());
+                client->requests.Sent(qmessage->nonce, client->timers);
             }
-            if (!Connection->Write(local.buffer, local.length)) {
-                // if we fail to send, requeue
-                std::lock_guard<std::mutex> guard(PresenceMutex);
-                QueuedPresence.Copy(local);
-                UpdatePresence.exchange(true);
+            else {
+                // these don't get requeued, so nobody's going to answer
+                client->requests.Complete(
+                  qmessage->nonce, client->timers, DISCORD_REQUEST_DISCONNECTED, 0, "Disconnected");
             }
+            client->sendQueue.CommitSend();
         }
 
-        while (SendQueue.HavePendingSends()) {
-            auto qmessage = SendQueue.GetNextSendMessage();
-            Connection->Write(qmessage->buffer, qmessage->length);
-            SendQueue.CommitSend();
+        if (connection->IsOpen()) {
+            // someone's waiting on an answer, so look for it as eagerly as for the handshake
+            const bool awaitingReply = client->restorePending || client->requests.AwaitingReply();
+            int64_t pollMs = awaitingReply ? HandshakePollIntervalMs : ReadPollIntervalMs;
+            if (connection->pingSentUs) {
+                const int64_t pingAgeMs = MonotonicNowMs() - connection->pingSentUs / 1000;
+                pollMs = pingAgeMs < PongFastPollMs ? 1 : HandshakePollIntervalMs;
+            }
+            PollAfter(client, pollMs);
         }
     }
 }
 
-static void SignalIOActivity()
+#ifdef DISCORD_DISABLE_IO_THREAD
+extern "C" DISCORD_EXPORT void Discord_Client_UpdateConnection(DiscordClient* client)
 {
-    if (IoThread != nullptr) {
-        IoThread->Notify();
+    if (client) {
+        if (client->registerPending.exchange(false)) {
+            RunRegistration(client);
+        }
+        if (!client->started.load()) {
+            return;
+        }
+        // we're the IO loop here, so we get to run the timers; firing them only sets flags
+        client->timers->Advance(MonotonicNowMs());
+        UpdateConnection(client);
+    }
+}
+
+extern "C" DISCORD_EXPORT void Discord_UpdateConnection(void)
+{
+    Discord_Client_UpdateConnection(DefaultClient);
+}
+
+extern "C" DISCORD_EXPORT uint32_t Discord_Client_NextUpdateDelayMs(DiscordClient* client)
+{
+    if (!client) {
+        return UINT32_MAX;
+    }
+    if (client->registerPending.load()) {
+        return 0;
+    }
+    const int64_t deadline = client->timers->NextDeadline();
+    if (deadline == TimerWheel::NoDeadline) {
+        return UINT32_MAX;
     }
+    const int64_t delayMs = deadline - MonotonicNowMs();
+    return delayMs <= 0 ? 0 : delayMs >= UINT32_MAX ? UINT32_MAX - 1 : (uint32_t)delayMs;
 }
 
-static bool RegisterForEvent(const char* evtName)
+extern "C" DISCORD_EXPORT uint32_t Discord_NextUpdateDelayMs(void)
 {
-    auto qmessage = SendQueue.GetNextAddMessage();
+    return Discord_Client_NextUpdateDelayMs(DefaultClient);
+}
+#endif
+
+static void SignalIOActivity(DiscordClient* client)
+{
+    // before a lazy start there's nothing to signal; starting gets the IO going anyway
+    if (client->started.load() && client->reactor != nullptr) {
+        client->reactor->Notify(&client->reactorEntry);
+    }
+}
+
+static bool RegisterForEvent(DiscordClient* client, const char* evtName)
+{
+    auto qmessage = client->sendQueue.GetNextAddMessage();
     if (qmessage) {
-        qmessage->length =
-          JsonWriteSubscribeCommand(qmessage->buffer, sizeof(qmessage->buffer), Nonce++, evtName);
-        SendQueue.CommitAdd();
-        SignalIOActivity();
+        qmessage->nonce = client->nonce++;
+        qmessage->length = JsonWriteSubscribeCommand(
+          qmessage->buffer, sizeof(qmessage->buffer), qmessage->nonce, evtName);
+        client->sendQueue.CommitAdd();
+        NoteSendQueued(client);
+        SignalIOActivity(client);
         return true;
     }
+    client->stats.sendQueueDrops.Add();
     return false;
 }
 
-static bool DeregisterForEvent(const char* evtName)
+static bool DeregisterForEvent(DiscordClient* client, const char* evtName)
 {
-    auto qmessage = SendQueue.GetNextAddMessage();
+    auto qmessage = client->sendQueue.GetNextAddMessage();
     if (qmessage) {
-        qmessage->length =
-          JsonWriteUnsubscribeCommand(qmessage->buffer, sizeof(qmessage->buffer), Nonce++, evtName);
-        SendQueue.CommitAdd();
-        SignalIOActivity();
+        qmessage->nonce = client->nonce++;
+        qmessage->length = JsonWriteUnsubscribeCommand(
+          qmessage->buffer, sizeof(qmessage->buffer), qmessage->nonce, evtName);
+        client->sendQueue.CommitAdd();
+        NoteSendQueued(client);
+        SignalIOActivity(client);
         return true;
     }
+    client->stats.sendQueueDrops.Add();
     return false;
 }
 
-extern "C" DISCORD_EXPORT void Discord_Initialize(const char* applicationId,
-                                                  DiscordEventHandlers* handlers,
-                                                  int autoRegister,
-                                                  const char* optionalSteamId)
+static void OnConnect(void* userData, JsonDocument& readyMessage)
 {
-    IoThread = new (std::nothrow) IoThreadHolder();
-    if (IoThread == nullptr) {
-        return;
-    }
-
-    if (autoRegister) {
-        if (optionalSteamId && optionalSteamId[0]) {
-            Discord_RegisterSteamGame(applicationId, optionalSteamId);
+    auto client = static_cast<DiscordClient*>(userData);
+    auto data = GetObjMember(&readyMessage, "data");
+    auto user = GetObjMember(data, "user");
+    auto userId = GetStrMember(user, "id");
+    auto username = GetStrMember(user, "username");
+    auto avatar = GetStrMember(user, "avatar");
+    if (userId && username) {
+        StringCopy(client->connectedUser.userId, userId);
+        StringCopy(client->connectedUser.username, username);
+        auto discriminator = GetStrMember(user, "discriminator");
+        if (discriminator) {
+            StringCopy(client->connectedUser.discriminator, discriminator);
+        }
+        if (avatar) {
+            StringCopy(client->connectedUser.avatar, avatar);
         }
         else {
-            Discord_Register(applicationId, nullptr);
+            client->connectedUser.avatar[0] = 0;
         }
     }
+    client->stats.connects.Add();
+    client->connectedUs = MonotonicNowUs();
+    client->wasJustConnected.exchange(true);
+    client->reconnectTimeMs.reset();
+    client->timers->Cancel(&client->reconnectTimer);
+    const uint32_t pingIntervalMs = client->pingIntervalMs.load();
+    if (pingIntervalMs) {
+        client->timers->Schedule(&client->pingTimer, MonotonicNowMs() + pingIntervalMs);
+    }
 
-    Pid = GetProcessId();
+    // only the relay says this; Discord itself never does
+    auto relay = GetObjMember(&readyMessage, "relay");
+    RestoreSession(client, GetIntMember(relay, "presence_channel") != 0);
+}
 
+static void OnDisconnect(void* userData, int err, const char* message)
+{
+    auto client = static_cast<DiscordClient*>(userData);
+    client->lastDisconnectErrorCode = err;
+    StringCopy(client->lastDisconnectErrorMessage, message);
+    client->stats.disconnects.Add();
+    client->disconnectedUs = MonotonicNowUs();
+    client->wasJustDisconnected.exchange(true);
+    // whoever we reach next has to be told about the channel all over again
+    client->presenceChannelAttached.store(false);
+    client->presenceChannelNonce = 0;
+    client->requests.FailSent(client->timers);
     {
-        std::lock_guard<std::mutex> guard(HandlerMutex);
+        // the next connection gets them all in its restore batch
+        std::lock_guard<std::mutex> guard(client->subscriptionMutex);
+        client->subscriptionsSent = false;
+    }
+    client->timers->Cancel(&client->pingTimer);
+    client->stats.pingSentUs.Set(0);
+    UpdateReconnectTime(client);
+    // keep getting serviced so we notice the reconnect timer and the pipe coming back
+    PollAfter(client, 0);
+}
+
+static void OnReconnectTimer(void* userData)
+{
+    auto client = static_cast<DiscordClient*>(userData);
+    client->connectDue = true;
+    SignalIOActivity(client);
+}
+
+static void OnPollTimer(void* userData)
+{
+    SignalIOActivity(static_cast<DiscordClient*>(userData));
+}
+
+static void OnPingTimer(void* userData)
+{
+    auto client = static_cast<DiscordClient*>(userData);
+    client->pingDue.store(true);
+    SignalIOActivity(client);
+}
+
+static void OnPong(void* userData, uint32_t rttUs)
+{
+    auto client = static_cast<DiscordClient*>(userData);
+    auto& stats = client->stats;
+    stats.pongsReceived.Add();
+    stats.pingSentUs.Set(0);
+    stats.lastRttUs.Set(rttUs);
+    stats.pingRtt.Record(rttUs);
+    // the same 1/8 smoothing TCP uses for its SRTT
+    const int64_t smoothed = (int64_t)stats.smoothedRttUs.Get();
+    stats.smoothedRttUs.Set(smoothed ? (uint64_t)(smoothed + ((int64_t)rttUs - smoothed) / 8)
+                                     : rttUs);
+}
+
+// Picks up what the last process to run this application left in its snapshot. The presence is
+// queued like one the game just set, so it goes out in the restore batch right after the handshake.
+static void OpenPresenceSnapshot(DiscordClient* client,
+                                 const char* applicationId,
+                                 const DiscordEventHandlers* handlers)
+{
+    char path[sizeof(PresenceSnapshotDirectory) + 96];
+    snprintf(path,
+             sizeof(path),
+             "%s/%s%s.snapshot",
+             PresenceSnapshotDirectory,
+             PresenceChannelPrefix,
+             applicationId);
+    client->presenceSnapshot = PresenceSnapshot::Open(path, applicationId);
+    auto snapshot = client->presenceSnapshot;
+    if (!snapshot) {
+        return;
+    }
+
+    PresenceRecord record;
+    uint32_t subscriptions = 0;
+    if (snapshot->Load(&record, &subscriptions)) {
+        DiscordRichPresence presence;
+        PresenceFromRecord(record, &presence);
+        auto& queued = client->queuedPresence;
+        queued.nonce = client->nonce++;
+        queued.length = JsonWriteRichPresenceObj(
+          queued.buffer, sizeof(queued.buffer), queued.nonce, Pid, &presence);
+        client->updatePresence.store(queued.length > 0);
+    }
+    const uint32_t ours = handlers ? SubscriptionsOf(*handlers) : 0;
+    client->snapshotSubscriptions.store(subscriptions & ~ours);
+    snapshot->SaveSubscriptions(subscriptions | ours);
+}
+
+// Gets the client's IO going: on the shared IO thread, or with DISCORD_DISABLE_IO_THREAD in
+// whatever calls Discord_Client_UpdateConnection from now on. Nothing connects until this has run.
+// False if the IO thread couldn't be had; a lazy client tries again on its next use.
+static bool StartClient(DiscordClient* client)
+{
+    if (client->started.load()) {
+        return true;
+    }
+    std::lock_guard<std::mutex> guard(client->startMutex);
+    if (client->started.load()) {
+        return true;
+    }
+    const int64_t startedUs = MonotonicNowUs();
+#ifndef DISCORD_DISABLE_IO_THREAD
+    client->reactor = IoReactor::Acquire();
+    if (client->reactor == nullptr) {
+        return false;
+    }
+    client->timers = client->reactor->Timers();
+    client->reactor->Add(&client->reactorEntry);
+#endif
+    client->stats.startUs.Set((uint64_t)(MonotonicNowUs() - startedUs));
+    // after the reactor's in place, for SignalIOActivity
+    client->started.store(true);
+    return true;
+}
+
+extern "C" DISCORD_EXPORT DiscordClient* Discord_CreateClient(const char* applicationId,
+                                                              DiscordEventHandlers* handlers,
+                                                              int autoRegister,
+                                                              const char* optionalSteamId)
+{
+    const int64_t createStartedUs = MonotonicNowUs();
+    auto client = DiscordNew<DiscordClient>();
+    if (client == nullptr) {
+        return nullptr;
+    }
+
+    client->connection = RpcConnection::Create(applicationId);
+    if (client->connection == nullptr) {
+        DiscordDelete(client);
+        return nullptr;
+    }
 
-        if (handlers) {
-            QueuedHandlers = *handlers;
+#ifdef DISCORD_DISABLE_IO_THREAD
+    client->timers = &client->localTimers;
+#endif
+    client->reconnectTimer.callback = OnReconnectTimer;
+    client->reconnectTimer.userData = client;
+    client->pollTimer.callback = OnPollTimer;
+    client->pollTimer.userData = client;
+    client->pingTimer.callback = OnPingTimer;
+    client->pingTimer.userData = client;
+
+    if (autoRegister) {
+        StringCopy(client->registerApplicationId, applicationId);
+        if (optionalSteamId && optionalSteamId[0]) {
+            StringCopy(client->registerSteamId, optionalSteamId);
+        }
+        if (!LazyStart) {
+            RunRegistration(client);
         }
         else {
-            QueuedHandlers = {};
+#ifndef DISCORD_DISABLE_IO_THREAD
+            // registry writes can take a good few milliseconds, and nothing needs them done soon
+            client->registerThread = std::thread([client]() { RunRegistration(client); });
+#else
+            client->registerPending.store(true);
+#endif
         }
+    }
 
-        Handlers = {};
+    if (!Pid) {
+        Pid = GetProcessId();
     }
 
-    if (Connection) {
-        return;
+    // published now, but no SUBSCRIBE goes out until the session is restored after READY
+    client->handlers.Publish(handlers);
+    if (PresenceSnapshotDirectory[0]) {
+        OpenPresenceSnapshot(client, applicationId, handlers);
     }
 
-    Connection = RpcConnection::Create(applicationId);
-    Connection->onConnect = [](JsonDocument& readyMessage) {
-        Discord_UpdateHandlers(&QueuedHandlers);
-        if (QueuedPresence.length > 0) {
-            UpdatePresence.exchange(true);
-            SignalIOActivity();
-        }
-        auto data = GetObjMember(&readyMessage, "data");
-        auto user = GetObjMember(data, "user");
-        auto userId = GetStrMember(user, "id");
-        auto username = GetStrMember(user, "username");
-        auto avatar = GetStrMember(user, "avatar");
-        if (userId && username) {
-            StringCopy(connectedUser.userId, userId);
-            StringCopy(connectedUser.username, username);
-            auto discriminator = GetStrMember(user, "discriminator");
-            if (discriminator) {
-                StringCopy(connectedUser.discriminator, discriminator);
-            }
-            if (avatar) {
-                StringCopy(connectedUser.avatar, avatar);
-            }
-            else {
-                connectedUser.avatar[0] = 0;
-            }
-        }
-        WasJustConnected.exchange(true);
-        ReconnectTimeMs.reset();
+    client->connection->userData = client;
+    client->connection->onConnect = OnConnect;
+    client->connection->onDisconnect = OnDisconnect;
+    client->connection->onPong = OnPong;
+
+    client->reactorEntry.update = [](void* userData) {
+        UpdateConnection(static_cast<DiscordClient*>(userData));
     };
-    Connection->onDisconnect = [](int err, const char* message) {
-        LastDisconnectErrorCode = err;
-        StringCopy(LastDisconnectErrorMessage, message);
-        WasJustDisconnected.exchange(true);
-        UpdateReconnectTime();
+    client->reactorEntry.detach = [](void* userData) {
+        auto client = static_cast<DiscordClient*>(userData);
+        client->timers->Cancel(&client->reconnectTimer);
+        client->timers->Cancel(&client->pollTimer);
+        client->timers->Cancel(&client->pingTimer);
+        client->requests.CancelAll(client->timers);
     };
+    client->reactorEntry.userData = client;
 
-    IoThread->Start();
+    if (!LazyStart && !StartClient(client)) {
+        Discord_DestroyClient(client);
+        return nullptr;
+    }
+    client->stats.createUs.Set((uint64_t)(MonotonicNowUs() - createStartedUs));
+    return client;
 }
 
-extern "C" DISCORD_EXPORT void Discord_Shutdown(void)
+extern "C" DISCORD_EXPORT void Discord_DestroyClient(DiscordClient* client)
 {
-    if (!Connection) {
+    if (!client) {
         return;
     }
-    Connection->onConnect = nullptr;
-    Connection->onDisconnect = nullptr;
-    Handlers = {};
-    QueuedPresence.length = 0;
-    UpdatePresence.exchange(false);
-    if (IoThread != nullptr) {
-        IoThread->Stop();
-        delete IoThread;
-        IoThread = nullptr;
+    client->connection->onConnect = nullptr;
+    client->connection->onDisconnect = nullptr;
+    client->connection->onPong = nullptr;
+    client->handlers.Publish(nullptr);
+    client->queuedPresence.length = 0;
+    client->updatePresence.exchange(false);
+#ifndef DISCORD_DISABLE_IO_THREAD
+    if (client->registerThread.joinable()) {
+        client->registerThread.join();
+    }
+#endif
+    if (client->reactor != nullptr) {
+        client->reactor->Remove(&client->reactorEntry);
+        IoReactor::Release(client->reactor);
+    }
+    else {
+        client->requests.CancelAll(client->timers);
     }
+    // last chance for anyone waiting on a request to clean up
+    client->requests.Dispatch();
+    // nobody runs this client's IO anymore, so the recorder is ours to clean up
+    FlightRecorder::Destroy(client->requestedRecorder);
+    PresenceChannel::Destroy(client->presenceChannel);
+    // left as it is on disk, for whatever runs next
+    PresenceSnapshot::Destroy(client->presenceSnapshot);
 
-    RpcConnection::Destroy(Connection);
+    RpcConnection::Destroy(client->connection);
+    DiscordDelete(client);
 }
 
-extern "C" DISCORD_EXPORT void Discord_UpdatePresence(const DiscordRichPresence* presence)
+extern "C" DISCORD_EXPORT int Discord_Client_UpdatePresenceEx(DiscordClient* client,
+                                                              const DiscordRichPresence* presence,
+                                                              DiscordRequestCallback callback,
+                                                              void* userData)
 {
+    if (!client) {
+        return 0;
+    }
+    int tracked = 1;
     {
-        std::lock_guard<std::mutex> guard(PresenceMutex);
-        QueuedPresence.length = JsonWriteRichPresenceObj(
-          QueuedPresence.buffer, sizeof(QueuedPresence.buffer), Nonce++, Pid, presence);
-        UpdatePresence.exchange(true);
+        std::lock_guard<std::mutex> guard(client->presenceMutex);
+        auto& queued = client->queuedPresence;
+        const int nonce = client->nonce++;
+        if (client->presenceChannel) {
+            client->presenceChannel->Write(nonce, Pid, presence);
+        }
+        if (client->presenceSnapshot) {
+            client->presenceSnapshot->SavePresence(Pid, presence);
+        }
+        if (callback) {
+            tracked = client->requests.Add(nonce, callback, userData) ? 1 : 0;
+        }
+        if (queued.length && queued.nonce != client->sentPresenceNonce) {
+            // never made it out, and now it never will
+            client->stats.presenceSuperseded.Add();
+            client->requests.Supersede(queued.nonce);
+        }
+        if (!callback && client->presenceChannelAttached.load()) {
+            // The relay takes it from the channel, and nothing is waiting on an answer. The channel
+            // is what restores it after a reconnect too, so there's nothing left to queue.
+            queued.length = 0;
+            client->updatePresence.exchange(false);
+            return tracked;
+        }
+        queued.nonce = nonce;
+        queued.length =
+          JsonWriteRichPresenceObj(queued.buffer, sizeof(queued.buffer), nonce, Pid, presence);
+        client->updatePresence.exchange(true);
     }
-    SignalIOActivity();
+    StartClient(client);
+    SignalIOActivity(client);
+    return tracked;
 }
 
-extern "C" DISCORD_EXPORT void Discord_ClearPresence(void)
+extern "C" DISCORD_EXPORT void Discord_Client_UpdatePresence(DiscordClient* client,
+                                                             const DiscordRichPresence* presence)
 {
-    Discord_UpdatePresence(nullptr);
+    Discord_Client_UpdatePresenceEx(client, presence, nullptr, nullptr);
 }
 
-extern "C" DISCORD_EXPORT void Discord_Respond(const char* userId, /* DISCORD_REPLY_ */ int reply)
+extern "C" DISCORD_EXPORT void Discord_Client_ClearPresence(DiscordClient* client)
+{
+    Discord_Client_UpdatePresence(client, nullptr);
+}
+
+extern "C" DISCORD_EXPORT int Discord_Client_RespondEx(DiscordClient* client,
+                                                       const char* userId,
+                                                       /* DISCORD_REPLY_ */ int reply,
+                                                       DiscordRequestCallback callback,
+                                                       void* userData)
 {
     // if we are not connected, let's not batch up stale messages for later
-    if (!Connection || !Connection->IsOpen()) {
+    if (!client || !client->connection->IsOpen()) {
+        return 0;
+    }
+    auto qmessage = client->sendQueue.GetNextAddMessage();
+    if (!qmessage) {
+        client->stats.sendQueueDrops.Add();
+        return 0;
+    }
+    qmessage->nonce = client->nonce++;
+    qmessage->length = JsonWriteJoinReply(
+      qmessage->buffer, sizeof(qmessage->buffer), userId, reply, qmessage->nonce);
+    int tracked = 1;
+    if (callback) {
+        tracked = client->requests.Add(qmessage->nonce, callback, userData) ? 1 : 0;
+    }
+    client->sendQueue.CommitAdd();
+    NoteSendQueued(client);
+    SignalIOActivity(client);
+    return tracked;
+}
+
+extern "C" DISCORD_EXPORT void Discord_Client_Respond(DiscordClient* client,
+                                                      const char* userId,
+                                                      /* DISCORD_REPLY_ */ int reply)
+{
+    Discord_Client_RespondEx(client, userId, reply, nullptr, nullptr);
+}
+
+extern "C" DISCORD_EXPORT int Discord_Client_SendCommandEx(DiscordClient* client,
+                                                           const char* command,
+                                                           const char* evt,
+                                                           const char* argsJson,
+                                                           size_t argsLength,
+                                                           DiscordRequestCallback callback,
+                                                           void* userData)
+{
+    if (!client || !command || !client->connection->IsOpen()) {
+        return 0;
+    }
+    const int nonce = client->nonce++;
+    if (callback && !client->requests.Add(nonce, callback, userData, true)) {
+        return 0;
+    }
+    auto qmessage = client->sendQueue.GetNextAddMessage();
+    if (!qmessage) {
+        client->stats.sendQueueDrops.Add();
+        client->requests.Drop(nonce);
+        return 0;
+    }
+    qmessage->nonce = nonce;
+    qmessage->length = JsonWriteCommand(
+      qmessage->buffer, sizeof(qmessage->buffer), nonce, command, evt, argsJson, argsLength);
+    if (qmessage->length >= sizeof(qmessage->buffer)) {
+        // truncated; the slot's already taken, so send nothing rather than half a command
+        qmessage->length = 0;
+        client->requests.Drop(nonce);
+        client->sendQueue.CommitAdd();
+        return 0;
+    }
+    client->sendQueue.CommitAdd();
+    NoteSendQueued(client);
+    SignalIOActivity(client);
+    return 1;
+}
+
+extern "C" DISCORD_EXPORT int Discord_Client_SendCommand(DiscordClient* client,
+                                                         const char* command,
+                                                         const char* argsJson,
+                                                         size_t argsLength,
+                                                         DiscordRequestCallback callback,
+                                                         void* userData)
+{
+    return Discord_Client_SendCommandEx(
+      client, command, nullptr, argsJson, argsLength, callback, userData);
+}
+
+extern "C" DISCORD_EXPORT void Discord_Client_GetAckLatency(DiscordClient* client,
+                                                            DiscordLatencyStats* stats)
+{
+    if (!stats) {
         return;
     }
-    auto qmessage = SendQueue.GetNextAddMessage();
-    if (qmessage) {
-        qmessage->length =
-          JsonWriteJoinReply(qmessage->buffer, sizeof(qmessage->buffer), userId, reply, Nonce++);
-        SendQueue.CommitAdd();
-        SignalIOActivity();
+    if (!client) {
+        *stats = {};
+        return;
     }
+    client->stats.ackLatency.Snapshot(stats);
 }
 
-extern "C" DISCORD_EXPORT void Discord_RunCallbacks(void)
+extern "C" DISCORD_EXPORT void Discord_Client_GetStats(DiscordClient* client, DiscordStats* stats)
+{
+    if (!stats) {
+        return;
+    }
+    *stats = {};
+    if (!client) {
+        return;
+    }
+    auto& connection = client->connection->stats;
+    stats->framesIn = connection.framesIn.Get();
+    stats->bytesIn = connection.bytesIn.Get();
+    stats->framesOut = connection.framesOut.Get();
+    stats->bytesOut = connection.bytesOut.Get();
+    stats->parseFailures = connection.parseFailures.Get();
+    auto& counters = client->stats;
+    stats->connectAttempts = counters.connectAttempts.Get();
+    stats->connects = counters.connects.Get();
+    stats->disconnects = counters.disconnects.Get();
+    stats->sendQueueHighWater = counters.sendQueueHighWater.Get();
+    stats->sendQueueDrops = counters.sendQueueDrops.Get();
+    stats->joinQueueHighWater = counters.joinQueueHighWater.Get();
+    stats->joinQueueDrops = counters.joinQueueDrops.Get();
+    stats->presenceSent = counters.presenceSent.Get();
+    stats->presenceSuperseded = counters.presenceSuperseded.Get();
+    counters.ackLatency.Snapshot(&stats->ackLatency);
+    counters.dispatchDelay.Snapshot(&stats->dispatchDelay);
+    stats->createUs = counters.createUs.Get();
+    stats->startUs = counters.startUs.Get();
+    stats->registerUs = counters.registerUs.Get();
+}
+
+extern "C" DISCORD_EXPORT void Discord_Client_SetHealthCheck(DiscordClient* client,
+                                                             uint32_t pingIntervalMs,
+                                                             uint32_t timeoutMs)
+{
+    if (!client) {
+        return;
+    }
+    client->pingIntervalMs.store(pingIntervalMs);
+    client->livenessTimeoutMs.store(timeoutMs);
+    // let the IO loop start, stop or reschedule pings now rather than at the next one
+    client->pingDue.store(true);
+    SignalIOActivity(client);
+}
+
+extern "C" DISCORD_EXPORT void Discord_Client_GetConnectionHealth(DiscordClient* client,
+                                                                  DiscordConnectionHealth* health)
+{
+    if (!health) {
+        return;
+    }
+    *health = {};
+    if (!client) {
+        return;
+    }
+    auto& stats = client->stats;
+    health->connected = client->connection->IsOpen() ? 1 : 0;
+    health->lastRttUs = (uint32_t)stats.lastRttUs.Get();
+    health->smoothedRttUs = (uint32_t)stats.smoothedRttUs.Get();
+    const int64_t pingSentUs = (int64_t)stats.pingSentUs.Get();
+    if (health->connected && pingSentUs) {
+        const int64_t pendingMs = (MonotonicNowUs() - pingSentUs) / 1000;
+        health->pingPendingMs = pendingMs > 0 ? (uint32_t)pendingMs : 0;
+    }
+    health->pingsSent = stats.pingsSent.Get();
+    health->pongsReceived = stats.pongsReceived.Get();
+    health->livenessTimeouts = stats.livenessTimeouts.Get();
+    stats.pingRtt.Snapshot(&health->rtt);
+}
+
+static void RequestRecorder(DiscordClient* client, FlightRecorder* recorder)
+{
+    FlightRecorder* superseded;
+    {
+        std::lock_guard<std::mutex> guard(client->recorderMutex);
+        superseded = client->requestedRecorder;
+        client->requestedRecorder = recorder;
+        client->recorderRequested.store(true);
+    }
+    FlightRecorder::Destroy(superseded);
+    SignalIOActivity(client);
+}
+
+extern "C" DISCORD_EXPORT int Discord_Client_StartFlightRecorder(DiscordClient* client,
+                                                                 const char* path,
+                                                                 uint32_t sizeBytes)
+{
+    if (!client) {
+        return 0;
+    }
+    auto recorder = FlightRecorder::Create(path, sizeBytes);
+    if (!recorder) {
+        return 0;
+    }
+    RequestRecorder(client, recorder);
+    return 1;
+}
+
+extern "C" DISCORD_EXPORT void Discord_Client_StopFlightRecorder(DiscordClient* client)
+{
+    if (client) {
+        RequestRecorder(client, nullptr);
+    }
+}
+
+extern "C" DISCORD_EXPORT void Discord_Client_RunCallbacks(DiscordClient* client)
 {
     // Note on some weirdness: internally we might connect, get other signals, disconnect any number
     // of times inbetween calls here. Externally, we want the sequence to seem sane, so any other
     // signals are book-ended by calls to ready and disconnect.
 
-    if (!Connection) {
+    if (!client) {
         return;
     }
+    DISCORD_TRACE_SCOPE("RunCallbacks");
+
+    bool wasDisconnected = client->wasJustDisconnected.exchange(false);
+    bool isConnected = client->connection->IsOpen();
 
-    bool wasDisconnected = WasJustDisconnected.exchange(false);
-    bool isConnected = Connection->IsOpen();
+    // Each dispatch reads whatever handlers are published right now; nothing is locked while the
+    // user's code runs, so a handler that blocks can't hold up Discord_UpdateHandlers.
 
     if (isConnected) {
         // if we are connected, disconnect cb first
-        std::lock_guard<std::mutex> guard(HandlerMutex);
-        if (wasDisconnected && Handlers.disconnected) {
-            Handlers.disconnected(LastDisconnectErrorCode, LastDisconnectErrorMessage);
+        HandlerTable::ReadScope handlers(client->handlers);
+        if (wasDisconnected && handlers->disconnected) {
+            NoteDispatched(client, client->disconnectedUs);
+            handlers->disconnected(client->lastDisconnectErrorCode,
+                                   client->lastDisconnectErrorMessage);
         }
     }
 
-    if (WasJustConnected.exchange(false)) {
-        std::lock_guard<std::mutex> guard(HandlerMutex);
-        if (Handlers.ready) {
-            DiscordUser du{connectedUser.userId,
-                           connectedUser.username,
-                           connectedUser.discriminator,
-                           connectedUser.avatar};
-            Handlers.ready(&du);
+    if (client->wasJustConnected.exchange(false)) {
+        HandlerTable::ReadScope handlers(client->handlers);
+        if (handlers->ready) {
+            NoteDispatched(client, client->connectedUs);
+            DiscordUser du{client->connectedUser.userId,
+                           client->connectedUser.username,
+                           client->connectedUser.discriminator,
+                           client->connectedUser.avatar};
+            handlers->ready(&du);
         }
     }
 
-    if (GotErrorMessage.exchange(false)) {
-        std::lock_guard<std::mutex> guard(HandlerMutex);
-        if (Handlers.errored) {
-            Handlers.errored(LastErrorCode, LastErrorMessage);
+    if (client->gotErrorMessage.exchange(false)) {
+        HandlerTable::ReadScope handlers(client->handlers);
+        if (handlers->errored) {
+            NoteDispatched(client, client->errorUs);
+            handlers->errored(client->lastErrorCode, client->lastErrorMessage);
         }
     }
 
-    if (WasJoinGame.exchange(false)) {
-        std::lock_guard<std::mutex> guard(HandlerMutex);
-        if (Handlers.joinGame) {
-            Handlers.joinGame(JoinGameSecret);
+    client->requests.Dispatch(&client->stats.dispatchDelay);
+
+    if (client->wasJoinGame.exchange(false)) {
+        HandlerTable::ReadScope handlers(client->handlers);
+        if (handlers->joinGame) {
+            NoteDispatched(client, client->joinGameUs);
+            handlers->joinGame(client->joinGameSecret);
         }
     }
 
-    if (WasSpectateGame.exchange(false)) {
-        std::lock_guard<std::mutex> guard(HandlerMutex);
-        if (Handlers.spectateGame) {
-            Handlers.spectateGame(SpectateGameSecret);
+    if (client->wasSpectateGame.exchange(false)) {
+        HandlerTable::ReadScope handlers(client->handlers);
+        if (handlers->spectateGame) {
+            NoteDispatched(client, client->spectateGameUs);
+            handlers->spectateGame(client->spectateGameSecret);
         }
     }
 
@@ -455,50 +1181,242 @@ extern "C" DISCORD_EXPORT void Discord_RunCallbacks(void)
     // is sent. I left it this way because I could also imagine wanting to process these all and
     // maybe show them in one common dialog and/or start fetching the avatars in parallel, and if
     // not it should be trivial for the implementer to make a queue themselves.
-    while (JoinAskQueue.HavePendingSends()) {
-        auto req = JoinAskQueue.GetNextSendMessage();
+    while (client->joinAskQueue.HavePendingSends()) {
+        auto req = client->joinAskQueue.GetNextSendMessage();
         {
-            std::lock_guard<std::mutex> guard(HandlerMutex);
-            if (Handlers.joinRequest) {
+            HandlerTable::ReadScope handlers(client->handlers);
+            if (handlers->joinRequest) {
+                NoteDispatched(client, req->queuedUs);
                 DiscordUser du{req->userId, req->username, req->discriminator, req->avatar};
-                Handlers.joinRequest(&du);
+                handlers->joinRequest(&du);
             }
         }
-        JoinAskQueue.CommitSend();
+        client->joinAskQueue.CommitSend();
     }
 
     if (!isConnected) {
         // if we are not connected, disconnect message last
-        std::lock_guard<std::mutex> guard(HandlerMutex);
-        if (wasDisconnected && Handlers.disconnected) {
-            Handlers.disconnected(LastDisconnectErrorCode, LastDisconnectErrorMessage);
+        HandlerTable::ReadScope handlers(client->handlers);
+        if (wasDisconnected && handlers->disconnected) {
+            NoteDispatched(client, client->disconnectedUs);
+            handlers->disconnected(client->lastDisconnectErrorCode,
+                                   client->lastDisconnectErrorMessage);
         }
     }
+
+    // we're outside every read scope here, a good time to free handler tables swapped out earlier
+    client->handlers.Collect();
 }
 
-extern "C" DISCORD_EXPORT void Discord_UpdateHandlers(DiscordEventHandlers* newHandlers)
+extern "C" DISCORD_EXPORT void Discord_Client_UpdateHandlers(DiscordClient* client,
+                                                             DiscordEventHandlers* newHandlers)
 {
-    if (newHandlers) {
-#define HANDLE_EVENT_REGISTRATION(handler_name, event)              \
-    if (!Handlers.handler_name && newHandlers->handler_name) {      \
-        RegisterForEvent(event);                                    \
-    }                                                               \
-    else if (Handlers.handler_name && !newHandlers->handler_name) { \
-        DeregisterForEvent(event);                                  \
+    if (!client) {
+        return;
+    }
+
+    // Whatever the snapshot subscribed us to counts as subscribed here, so events the game turns
+    // out not to want get unsubscribed; from now on the handlers alone decide.
+    const uint32_t fromSnapshot = client->snapshotSubscriptions.exchange(0);
+
+    // The diff runs under the table's write lock, so two racing updates can't both decide to
+    // (un)subscribe the same event, and under subscriptionMutex so it can't slip in between a
+    // restore batch reading the handlers and marking them sent.
+    {
+        std::lock_guard<std::mutex> guard(client->subscriptionMutex);
+        client->handlers.Publish(
+          newHandlers,
+          [client, fromSnapshot](const DiscordEventHandlers& oldHandlers,
+                                 const DiscordEventHandlers& handlers) {
+              const uint32_t after = SubscriptionsOf(handlers);
+              // while we're offline the restore batch will subscribe whatever's published by then
+              const uint32_t before =
+                client->subscriptionsSent ? SubscriptionsOf(oldHandlers) | fromSnapshot : after;
+#define HANDLE_EVENT_REGISTRATION(bit, event)    \
+    if (!(before & bit) && (after & bit)) {      \
+        RegisterForEvent(client, event);         \
+    }                                            \
+    else if ((before & bit) && !(after & bit)) { \
+        DeregisterForEvent(client, event);       \
     }
 
-        std::lock_guard<std::mutex> guard(HandlerMutex);
-        HANDLE_EVENT_REGISTRATION(joinGame, "ACTIVITY_JOIN")
-        HANDLE_EVENT_REGISTRATION(spectateGame, "ACTIVITY_SPECTATE")
-        HANDLE_EVENT_REGISTRATION(joinRequest, "ACTIVITY_JOIN_REQUEST")
+              HANDLE_EVENT_REGISTRATION(SnapshotActivityJoin, "ACTIVITY_JOIN")
+              HANDLE_EVENT_REGISTRATION(SnapshotActivitySpectate, "ACTIVITY_SPECTATE")
+              HANDLE_EVENT_REGISTRATION(SnapshotActivityJoinRequest, "ACTIVITY_JOIN_REQUEST")
 
 #undef HANDLE_EVENT_REGISTRATION
+              if (client->presenceSnapshot) {
+                  client->presenceSnapshot->SaveSubscriptions(after);
+              }
+          });
+    }
+    StartClient(client);
+}
+
+extern "C" DISCORD_EXPORT void Discord_SetClock(DiscordClockFn nowUs, void* userData)
+{
+    ClockHook = nowUs;
+    ClockHookUserData = nowUs ? userData : nullptr;
+}
 
-        Handlers = *newHandlers;
+extern "C" DISCORD_EXPORT void Discord_SetRandomSeed(uint64_t seed)
+{
+    BackoffSeedBase.store(seed);
+    BackoffSeedsIssued.store(0);
+}
+
+extern "C" DISCORD_EXPORT void Discord_SetPipeBaseName(const char* baseName)
+{
+    BaseConnection::SetPipeBaseName(baseName ? baseName : "discord-ipc-");
+}
+
+extern "C" DISCORD_EXPORT void Discord_SetPresenceSnapshotDirectory(const char* directory)
+{
+    if (directory) {
+        StringCopy(PresenceSnapshotDirectory, directory);
     }
     else {
-        std::lock_guard<std::mutex> guard(HandlerMutex);
-        Handlers = {};
+        PresenceSnapshotDirectory[0] = 0;
     }
-    return;
+}
+
+extern "C" DISCORD_EXPORT void Discord_SetLazyStart(int lazy)
+{
+    LazyStart = lazy != 0;
+}
+
+// The original single-instance API, kept as a thin wrapper over a default client.
+
+extern "C" DISCORD_EXPORT void Discord_Initialize(const char* applicationId,
+                                                  DiscordEventHandlers* handlers,
+                                                  int autoRegister,
+                                                  const char* optionalSteamId)
+{
+    if (DefaultClient) {
+        Discord_Client_UpdateHandlers(DefaultClient, handlers);
+        return;
+    }
+
+    DefaultClient = Discord_CreateClient(applicationId, handlers, autoRegister, optionalSteamId);
+}
+
+extern "C" DISCORD_EXPORT void Discord_Shutdown(void)
+{
+    Discord_DestroyClient(DefaultClient);
+    DefaultClient = nullptr;
+}
+
+extern "C" DISCORD_EXPORT void Discord_UpdatePresence(const DiscordRichPresence* presence)
+{
+    Discord_Client_UpdatePresence(DefaultClient, presence);
+}
+
+extern "C" DISCORD_EXPORT void Discord_ClearPresence(void)
+{
+    Discord_Client_ClearPresence(DefaultClient);
+}
+
+extern "C" DISCORD_EXPORT void Discord_Respond(const char* userId, /* DISCORD_REPLY_ */ int reply)
+{
+    Discord_Client_Respond(DefaultClient, userId, reply);
+}
+
+extern "C" DISCORD_EXPORT int Discord_UpdatePresenceEx(const DiscordRichPresence* presence,
+                                                       DiscordRequestCallback callback,
+                                                       void* userData)
+{
+    return Discord_Client_UpdatePresenceEx(DefaultClient, presence, callback, userData);
+}
+
+extern "C" DISCORD_EXPORT int Discord_RespondEx(const char* userId,
+                                                /* DISCORD_REPLY_ */ int reply,
+                                                DiscordRequestCallback callback,
+                                                void* userData)
+{
+    return Discord_Client_RespondEx(DefaultClient, userId, reply, callback, userData);
+}
+
+extern "C" DISCORD_EXPORT int Discord_SendCommand(const char* command,
+                                                  const char* argsJson,
+                                                  size_t argsLength,
+                                                  DiscordRequestCallback callback,
+                                                  void* userData)
+{
+    return Discord_Client_SendCommand(
+      DefaultClient, command, argsJson, argsLength, callback, userData);
+}
+
+extern "C" DISCORD_EXPORT int Discord_SendCommandEx(const char* command,
+                                                    const char* evt,
+                                                    const char* argsJson,
+                                                    size_t argsLength,
+                                                    DiscordRequestCallback callback,
+                                                    void* userData)
+{
+    return Discord_Client_SendCommandEx(
+      DefaultClient, command, evt, argsJson, argsLength, callback, userData);
+}
+
+extern "C" DISCORD_EXPORT void Discord_GetAckLatency(DiscordLatencyStats* stats)
+{
+    Discord_Client_GetAckLatency(DefaultClient, stats);
+}
+
+extern "C" DISCORD_EXPORT void Discord_GetStats(DiscordStats* stats)
+{
+    Discord_Client_GetStats(DefaultClient, stats);
+}
+
+extern "C" DISCORD_EXPORT void Discord_SetHealthCheck(uint32_t pingIntervalMs, uint32_t timeoutMs)
+{
+    Discord_Client_SetHealthCheck(DefaultClient, pingIntervalMs, timeoutMs);
+}
+
+extern "C" DISCORD_EXPORT void Discord_GetConnectionHealth(DiscordConnectionHealth* health)
+{
+    Discord_Client_GetConnectionHealth(DefaultClient, health);
+}
+
+extern "C" DISCORD_EXPORT int Discord_StartFlightRecorder(const char* path, uint32_t sizeBytes)
+{
+    return Discord_Client_StartFlightRecorder(DefaultClient, path, sizeBytes);
+}
+
+extern "C" DISCORD_EXPORT void Discord_StopFlightRecorder(void)
+{
+    Discord_Client_StopFlightRecorder(DefaultClient);
+}
+
+extern "C" DISCORD_EXPORT void Discord_GetMemoryFootprint(DiscordMemoryFootprint* footprint)
+{
+    if (!footprint) {
+        return;
+    }
+    *footprint = {};
+    // the platform connection adds a pipe handle or so on top of BaseConnection
+    footprint->clientBytes =
+      (uint32_t)(sizeof(DiscordClient) + sizeof(RpcConnection) + sizeof(BaseConnection));
+#ifndef DISCORD_DISABLE_IO_THREAD
+    footprint->sharedBytes = (uint32_t)sizeof(IoReactor);
+#endif
+    // An estimate, not a measurement: nothing big lives on the stack anymore, so it's the deepest
+    // thing we know of, a JsonWriter's nesting stack, plus room for the frames around it. The
+    // StackBench project measures the real figure, which moves with the compiler and settings.
+    footprint->ioStackBytes = (uint32_t)(sizeof(JsonWriter) + 4 * 1024);
+    footprint->maxFrameSize = (uint32_t)MaxRpcFrameSize;
+    footprint->maxMessageSize = (uint32_t)MaxMessageSize;
+    footprint->sendQueueSize = (uint32_t)MessageQueueSize;
+    footprint->joinQueueSize = (uint32_t)JoinQueueSize;
+    footprint->parseArenaSize = (uint32_t)DISCORD_PARSE_ARENA_SIZE;
+    footprint->maxPendingRequests = (uint32_t)MaxPendingRequests;
+}
+
+extern "C" DISCORD_EXPORT void Discord_RunCallbacks(void)
+{
+    Discord_Client_RunCallbacks(DefaultClient);
+}
+
+extern "C" DISCORD_EXPORT void Discord_UpdateHandlers(DiscordEventHandlers* handlers)
+{
+    Discord_Client_UpdateHandlers(DefaultClient, handlers);
 }
@@ -0,0 +1,100 @@
+#include "flight_recorder.h"
+
+#include "allocator.h"
+#include "timer_wheel.h"
+
+#include <time.h>
+
+/*static*/ FlightRecorder* FlightRecorder::Create(const char* path, size_t sizeBytes)
+{
+    if (!path || !path[0]) {
+        return nullptr;
+    }
+    if (sizeBytes < FlightRecorderMinSize) {
+        sizeBytes = FlightRecorderMinSize;
+    }
+    if (sizeBytes > UINT32_MAX - 7) {
+        sizeBytes = UINT32_MAX - 7;
+    }
+    const uint32_t dataSize = (uint32_t)((sizeBytes + 7) & ~(size_t)7);
+
+    auto recorder = DiscordNew<FlightRecorder>();
+    if (!recorder) {
+        return nullptr;
+    }
+    if (!recorder->Map(path, sizeof(FlightRecordingHeader) + dataSize)) {
+        DiscordDelete(recorder);
+        return nullptr;
+    }
+    auto base = static_cast<char*>(recorder->mapping_);
+    recorder->header_ = reinterpret_cast<FlightRecordingHeader*>(base);
+    recorder->data_ = base + sizeof(FlightRecordingHeader);
+
+    auto header = recorder->header_;
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, FlightRecordingMagic, sizeof(header->magic));
+    header->version = FlightRecordingVersion;
+    header->dataSize = dataSize;
+    header->createdUnixSeconds = (int64_t)time(nullptr);
+    header->createdMonotonicUs = MonotonicNowUs();
+    return recorder;
+}
+
+/*static*/ void FlightRecorder::Destroy(FlightRecorder*& recorder)
+{
+    if (recorder) {
+        recorder->Unmap();
+        DiscordDelete(recorder);
+        recorder = nullptr;
+    }
+}
+
+void FlightRecorder::Record(FlightRecord::Direction direction,
+                            uint32_t opcode,
+                            const void* payload,
+                            uint32_t length)
+{
+    auto header = header_;
+    const uint64_t dataSize = header->dataSize;
+    const uint64_t size = (sizeof(FlightRecord) + (uint64_t)length + 7) & ~(uint64_t)7;
+    if (size > dataSize / 2) {
+        ++header->droppedRecords;
+        return;
+    }
+
+    uint64_t head = header->head;
+    const uint64_t room = dataSize - head % dataSize;
+    // records don't wrap, so anything left before the end that's too small gets skipped
+    const uint64_t skip = room < size ? room : 0;
+
+    // let go of the oldest records until there's room for this one
+    uint64_t tail = header->tail;
+    while (head + skip + size - tail > dataSize) {
+        const uint64_t tailRoom = dataSize - tail % dataSize;
+        if (tailRoom < sizeof(FlightRecord)) {
+            tail += tailRoom;
+        }
+        else {
+            uint32_t tailSize;
+            memcpy(&tailSize, data_ + tail % dataSize, sizeof(tailSize));
+            tail += tailSize;
+        }
+    }
+    header->tail = tail;
+
+    if (skip) {
+        if (skip >= sizeof(FlightRecord)) {
+            FlightRecord padding{(uint32_t)skip, FlightRecord::Padding, 0, 0, 0};
+            memcpy(data_ + head % dataSize, &padding, sizeof(padding));
+        }
+        head += skip;
+    }
+
+    auto out = data_ + head % dataSize;
+    FlightRecord record{(uint32_t)size, direction, MonotonicNowUs(), opcode, length};
+    memcpy(out, &record, sizeof(record));
+    if (length) {
+        memcpy(out + sizeof(record), payload, length);
+    }
+    header->head = head + size;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+// Keeps the most recent IPC traffic of one connection in a memory mapped ring file, so there's
+// something to look at when a player reports presence getting stuck. Recording is a memcpy into the
+// mapping: nothing waits on the disk, and the OS still writes the pages out if the game crashes.
+//
+// File layout: a FlightRecordingHeader, then dataSize bytes of records. Records are 8 byte aligned
+// and never wrap; when one doesn't fit before the end, a padding record fills the gap and the next
+// one starts over at the beginning. head and tail count bytes ever written, so the live records run
+// from tail to head, each at (position % dataSize).
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+constexpr char FlightRecordingMagic[8]{'D', 'R', 'P', 'C', 'F', 'L', 'T', '1'};
+constexpr uint32_t FlightRecordingVersion{1};
+constexpr uint32_t FlightRecorderMinSize{64 * 1024};
+
+struct FlightRecordingHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dataSize;
+    uint64_t head;
+    uint64_t tail;
+    // lets a reader turn record timestamps (MonotonicNowUs) into wall clock time
+    int64_t createdUnixSeconds;
+    int64_t createdMonotonicUs;
+    uint64_t droppedRecords; // too big to keep
+    uint64_t reserved;
+};
+
+struct FlightRecord {
+    enum Direction : uint32_t {
+        Padding = 0,
+        In = 1,
+        Out = 2,
+    };
+    uint32_t size; // header, payload and alignment padding
+    uint32_t direction;
+    int64_t timestampUs;
+    uint32_t opcode;
+    uint32_t length;
+    // length bytes of payload follow
+};
+
+class FlightRecorder {
+    void* mapping_{nullptr};
+    FlightRecordingHeader* header_{nullptr};
+    char* data_{nullptr};
+
+    // per platform
+    bool Map(const char* path, size_t fileSize);
+    void Unmap();
+
+public:
+    FlightRecorder() = default;
+
+    // nullptr if the file can't be created or mapped; sizeBytes is rounded to something sensible
+    static FlightRecorder* Create(const char* path, size_t sizeBytes);
+    static void Destroy(FlightRecorder*&);
+
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+    // Not thread safe; whoever runs the connection's IO owns this.
+    void Record(FlightRecord::Direction direction,
+                uint32_t opcode,
+                const void* payload,
+                uint32_t length);
+};
+
+// Walks the records in a recording from oldest to newest, calling fn(const FlightRecord&, const
+// char* payload) on each. Returns false if this doesn't look like a recording at all.
+template <typename Fn>
+bool ForEachFlightRecord(const char* file, size_t fileSize, Fn fn)
+{
+    if (fileSize < sizeof(FlightRecordingHeader)) {
+        return false;
+    }
+    FlightRecordingHeader header;
+    memcpy(&header, file, sizeof(header));
+    if (memcmp(header.magic, FlightRecordingMagic, sizeof(header.magic)) != 0 ||
+        header.version != FlightRecordingVersion || header.dataSize == 0 ||
+        fileSize < sizeof(header) + header.dataSize || header.head < header.tail ||
+        header.head - header.tail > header.dataSize) {
+        return false;
+    }
+    const char* data = file + sizeof(header);
+    for (uint64_t position = header.tail; position < header.head;) {
+        const size_t offset = (size_t)(position % header.dataSize);
+        if (header.dataSize - offset < sizeof(FlightRecord)) {
+            // too little room left for even a header, so the writer went straight back to the start
+            position += header.dataSize - offset;
+            continue;
+        }
+        FlightRecord record;
+        memcpy(&record, data + offset, sizeof(record));
+        if (record.size < 8 || record.size > header.dataSize - offset) {
+            return false;
+        }
+        if (record.direction != FlightRecord::Padding &&
+            sizeof(record) + record.length <= record.size) {
+            fn(record, data + offset + sizeof(record));
+        }
+        position += record.size;
+    }
+    return true;
+}
@@ -0,0 +1,48 @@
+#include "flight_recorder.h"
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMCX
+#define NOSERVICE
+#define NOIME
+#include <windows.h>
+
+bool FlightRecorder::Map(const char* path, size_t fileSize)
+{
+    wchar_t widePath[MAX_PATH];
+    if (!::MultiByteToWideChar(CP_UTF8, 0, path, -1, widePath, MAX_PATH)) {
+        return false;
+    }
+    // a fresh recording every time; the player hands over whatever's there after an incident
+    HANDLE file = ::CreateFileW(widePath,
+                                GENERIC_READ | GENERIC_WRITE,
+                                FILE_SHARE_READ,
+                                nullptr,
+                                CREATE_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL,
+                                nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    HANDLE section = ::CreateFileMappingW(file,
+                                          nullptr,
+                                          PAGE_READWRITE,
+                                          (DWORD)((uint64_t)fileSize >> 32),
+                                          (DWORD)fileSize,
+                                          nullptr);
+    // the section keeps the file open, and the view keeps the section
+    ::CloseHandle(file);
+    if (!section) {
+        return false;
+    }
+    mapping_ = ::MapViewOfFile(section, FILE_MAP_WRITE, 0, 0, fileSize);
+    ::CloseHandle(section);
+    return mapping_ != nullptr;
+}
+
+void FlightRecorder::Unmap()
+{
+    if (mapping_) {
+        ::UnmapViewOfFile(mapping_);
+        mapping_ = nullptr;
+    }
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "discord_rpc.h"
+
+#include "allocator.h"
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+
+// Publishes the user's DiscordEventHandlers to the thread running callbacks without holding a lock
+// while user code runs. Readers pin the current epoch and read whatever snapshot is published;
+// writers copy into a fresh snapshot, swap it in and retire the old one. Retired snapshots are only
+// freed once two epochs have passed, which means no reader can still be looking at them. A writer
+// never waits for a reader: if a callback is blocked the epoch simply can't advance, and retired
+// snapshots pile up until it returns.
+
+class HandlerTable {
+    struct Snapshot {
+        DiscordEventHandlers handlers;
+        Snapshot* nextRetired;
+        uint64_t retiredEpoch;
+    };
+
+    std::atomic<Snapshot*> current_{nullptr};
+    std::atomic<uint64_t> epoch_{0};
+    std::atomic_uint readers_[2]{};
+    std::mutex writeMutex_; // writers only, never held while calling out
+    Snapshot* retired_{nullptr};
+    Snapshot empty_{};
+
+    // must hold writeMutex_
+    void TryAdvanceAndReclaim()
+    {
+        // moving to epoch e+1 requires everyone who entered during e-1 (same parity as e+1) to be
+        // gone; do it at most twice, that's all it takes to free everything that is retired
+        for (int i = 0; i < 2; ++i) {
+            auto e = epoch_.load();
+            if (readers_[(e + 1) & 1].load() != 0) {
+                break;
+            }
+            epoch_.store(e + 1);
+        }
+
+        auto e = epoch_.load();
+        Snapshot** link = &retired_;
+        while (*link) {
+            auto snapshot = *link;
+            if (snapshot->retiredEpoch + 2 <= e) {
+                *link = snapshot->nextRetired;
+                DiscordDelete(snapshot);
+            }
+            else {
+                link = &snapshot->nextRetired;
+            }
+        }
+    }
+
+public:
+    class ReadScope {
+        HandlerTable& table_;
+        unsigned slot_;
+        const Snapshot* snapshot_;
+
+    public:
+        explicit ReadScope(HandlerTable& table)
+          : table_(table)
+        {
+            for (;;) {
+                auto e = table_.epoch_.load();
+                slot_ = (unsigned)(e & 1);
+                ++table_.readers_[slot_];
+                if (table_.epoch_.load() == e) {
+                    break;
+                }
+                --table_.readers_[slot_];
+            }
+            snapshot_ = table_.current_.load();
+            if (!snapshot_) {
+                snapshot_ = &table_.empty_;
+            }
+        }
+        ~ReadScope() { --table_.readers_[slot_]; }
+
+        ReadScope(const ReadScope&) = delete;
+        ReadScope& operator=(const ReadScope&) = delete;
+
+        const DiscordEventHandlers* operator->() const { return &snapshot_->handlers; }
+        const DiscordEventHandlers& operator*() const { return snapshot_->handlers; }
+    };
+
+    HandlerTable() {}
+    ~HandlerTable()
+    {
+        DiscordDelete(current_.exchange(nullptr));
+        while (retired_) {
+            auto next = retired_->nextRetired;
+            DiscordDelete(retired_);
+            retired_ = next;
+        }
+    }
+
+    HandlerTable(const HandlerTable&) = delete;
+    HandlerTable& operator=(const HandlerTable&) = delete;
+
+    // Calls diff(oldHandlers, newHandlers) under the write lock so concurrent updates see a
+    // consistent before/after pair, then publishes. Returns false if we couldn't allocate.
+    template <typename DiffFn>
+    bool Publish(const DiscordEventHandlers* handlers, DiffFn diff)
+    {
+        auto snapshot = DiscordNew<Snapshot>();
+        if (!snapshot) {
+            return false;
+        }
+        if (handlers) {
+            snapshot->handlers = *handlers;
+        }
+
+        std::lock_guard<std::mutex> guard(writeMutex_);
+        auto old = current_.load();
+        diff(old ? old->handlers : empty_.handlers, snapshot->handlers);
+        current_.store(snapshot);
+        if (old) {
+            old->retiredEpoch = epoch_.load();
+            old->nextRetired = retired_;
+            retired_ = old;
+        }
+        TryAdvanceAndReclaim();
+        return true;
+    }
+
+    bool Publish(const DiscordEventHandlers* handlers)
+    {
+        return Publish(handlers, [](const DiscordEventHandlers&, const DiscordEventHandlers&) {});
+    }
+
+    // Opportunistic cleanup from a quiet point on the reading side; skips if a writer is busy.
+    void Collect()
+    {
+        std::unique_lock<std::mutex> guard(writeMutex_, std::try_to_lock);
+        if (guard.owns_lock() && retired_) {
+            TryAdvanceAndReclaim();
+        }
+    }
+};
@@ -0,0 +1,153 @@
+#include "io_reactor.h"
+
+#include "allocator.h"
+
+#ifndef DISCORD_DISABLE_IO_THREAD
+
+#include <algorithm>
+#include <chrono>
+
+static std::mutex ReactorMutex;
+static IoReactor* Reactor{nullptr};
+
+/*static*/ IoReactor* IoReactor::Acquire()
+{
+    std::lock_guard<std::mutex> guard(ReactorMutex);
+    if (!Reactor) {
+        Reactor = DiscordNew<IoReactor>();
+        if (!Reactor) {
+            return nullptr;
+        }
+        auto reactor = Reactor;
+        reactor->thread_ = std::thread([reactor]() { reactor->Run(); });
+    }
+    ++Reactor->refCount_;
+    return Reactor;
+}
+
+/*static*/ void IoReactor::Release(IoReactor*& reactor)
+{
+    if (!reactor) {
+        return;
+    }
+    reactor = nullptr;
+
+    std::lock_guard<std::mutex> guard(ReactorMutex);
+    if (--Reactor->refCount_ > 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> waitGuard(Reactor->waitMutex_);
+        Reactor->keepRunning_ = false;
+    }
+    Reactor->wake_.notify_all();
+    if (Reactor->thread_.joinable()) {
+        Reactor->thread_.join();
+    }
+    DiscordDelete(Reactor);
+    Reactor = nullptr;
+}
+
+void IoReactor::Run()
+{
+    // nothing should need us less often than this, but don't trust that blindly
+    const int64_t maxWaitMs{60 * 1000};
+    int64_t waitMs = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(waitMutex_);
+            wake_.wait_for(lock, std::chrono::milliseconds(waitMs), [this]() {
+                return readyHead_ != nullptr || !keepRunning_;
+            });
+            if (!keepRunning_) {
+                break;
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(serviceMutex_);
+        auto now = MonotonicNowMs();
+        // timer callbacks notify their entries, which puts them on the ready list
+        wheel_.Advance(now);
+
+        IoReactorEntry* ready;
+        {
+            std::lock_guard<std::mutex> waitGuard(waitMutex_);
+            ready = readyHead_;
+            readyHead_ = readyTail_ = nullptr;
+        }
+        while (ready) {
+            auto entry = ready;
+            ready = entry->nextReady;
+            {
+                // from here on a Notify queues it again; anything before is covered by this update
+                std::lock_guard<std::mutex> waitGuard(waitMutex_);
+                entry->nextReady = nullptr;
+                entry->ready = false;
+            }
+            entry->update(entry->userData);
+        }
+
+        auto next = wheel_.NextDeadline();
+        waitMs = next == TimerWheel::NoDeadline ? maxWaitMs : std::max<int64_t>(next - now, 0);
+        waitMs = std::min(waitMs, maxWaitMs);
+    }
+}
+
+void IoReactor::Add(IoReactorEntry* entry)
+{
+    // get it going right away; from here on it schedules itself
+    Notify(entry);
+}
+
+void IoReactor::Remove(IoReactorEntry* entry)
+{
+    // the service lock guarantees the entry isn't mid-update and isn't on a private ready list
+    std::lock_guard<std::mutex> guard(serviceMutex_);
+    if (entry->detach) {
+        entry->detach(entry->userData);
+    }
+
+    std::lock_guard<std::mutex> waitGuard(waitMutex_);
+    if (!entry->ready) {
+        return;
+    }
+    IoReactorEntry* prev = nullptr;
+    for (auto it = readyHead_; it; prev = it, it = it->nextReady) {
+        if (it == entry) {
+            if (prev) {
+                prev->nextReady = entry->nextReady;
+            }
+            else {
+                readyHead_ = entry->nextReady;
+            }
+            if (readyTail_ == entry) {
+                readyTail_ = prev;
+            }
+            break;
+        }
+    }
+    entry->nextReady = nullptr;
+    entry->ready = false;
+}
+
+void IoReactor::Notify(IoReactorEntry* entry)
+{
+    {
+        std::lock_guard<std::mutex> guard(waitMutex_);
+        if (entry->ready) {
+            return;
+        }
+        entry->ready = true;
+        entry->nextReady = nullptr;
+        if (readyTail_) {
+            readyTail_->nextReady = entry;
+        }
+        else {
+            readyHead_ = entry;
+        }
+        readyTail_ = entry;
+    }
+    wake_.notify_one();
+}
+
+#endif // DISCORD_DISABLE_IO_THREAD
@@ -0,0 +1,69 @@
+#pragma once
+
+// Drives the IO of every client in the process from one shared thread, so a thousand clients cost a
+// thousand small entries instead of a thousand threads. The thread owns a timer wheel and sleeps
+// until its next deadline; an entry gets serviced when it's notified, either by one of its timers
+// firing or by another thread queueing work for it. Idle clients cost nothing per pass.
+
+#include "timer_wheel.h"
+
+#include <stdint.h>
+
+struct IoReactorEntry {
+    void (*update)(void* userData){nullptr};
+    // called under the reactor's lock while the entry is removed, to cancel its timers
+    void (*detach)(void* userData){nullptr};
+    void* userData{nullptr};
+    IoReactorEntry* nextReady{nullptr};
+    bool ready{false};
+};
+
+#ifndef DISCORD_DISABLE_IO_THREAD
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class IoReactor {
+private:
+    std::mutex serviceMutex_; // held while timers fire and entries update
+    TimerWheel wheel_;
+    std::mutex waitMutex_;
+    std::condition_variable wake_;
+    IoReactorEntry* readyHead_{nullptr};
+    IoReactorEntry* readyTail_{nullptr};
+    bool keepRunning_{true};
+    std::thread thread_;
+    int refCount_{0};
+
+    void Run();
+
+public:
+    // The reactor is shared and reference counted; the thread starts with the first client and is
+    // joined when the last one lets go.
+    static IoReactor* Acquire();
+    static void Release(IoReactor*& reactor);
+
+    // Only touch this from inside an update, a timer callback or a detach.
+    TimerWheel* Timers() { return &wheel_; }
+
+    void Add(IoReactorEntry* entry);
+    void Remove(IoReactorEntry* entry);
+    void Notify(IoReactorEntry* entry);
+};
+
+#else
+
+class IoReactor {
+public:
+    static IoReactor* Acquire() { return nullptr; }
+    static void Release(IoReactor*&) {}
+
+    TimerWheel* Timers() { return nullptr; }
+
+    void Add(IoReactorEntry*) {}
+    void Remove(IoReactorEntry*) {}
+    void Notify(IoReactorEntry*) {}
+};
+
+#endif // DISCORD_DISABLE_IO_THREAD
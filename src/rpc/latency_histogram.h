@@ -0,0 +1,132 @@
+#pragma once
+
+#include "discord_rpc.h"
+#include "memory_config.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Log-linear (HDR style) histogram of microsecond latencies: every power of two is split into 32
+// linear sub-buckets (DISCORD_LATENCY_SUB_BUCKET_BITS, memory_config.h), so anything recorded is
+// reported to within about 3% from 1us to most of a day. Recording is a handful of relaxed atomic
+// adds from any thread; reading takes a snapshot that may be a sample or two out of date, which is
+// fine for what it's for.
+class LatencyHistogram {
+public:
+    static constexpr int SubBucketBits = DISCORD_LATENCY_SUB_BUCKET_BITS;
+    static constexpr int SubBuckets = 1 << SubBucketBits;
+    // highest bit of the largest latency told apart from the rest, 2^36us being 19 hours
+    static constexpr int TopBit = 35;
+    static constexpr int Majors = TopBit - SubBucketBits + 2;
+    static constexpr int BucketCount = Majors * SubBuckets;
+
+private:
+    std::atomic<uint64_t> buckets_[BucketCount]{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> min_{UINT64_MAX};
+    std::atomic<uint64_t> max_{0};
+
+    static int HighestBit(uint64_t value)
+    {
+#if defined(_MSC_VER) && defined(_WIN64)
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return (int)index;
+#elif defined(_MSC_VER)
+        unsigned long index;
+        if (_BitScanReverse(&index, (unsigned long)(value >> 32))) {
+            return (int)index + 32;
+        }
+        _BitScanReverse(&index, (unsigned long)value);
+        return (int)index;
+#else
+        return 63 - __builtin_clzll(value);
+#endif
+    }
+
+    static int BucketIndex(uint64_t us)
+    {
+        if (us < (uint64_t)SubBuckets) {
+            return (int)us;
+        }
+        const int msb = HighestBit(us);
+        const int major = msb - SubBucketBits + 1;
+        if (major >= Majors) {
+            return BucketCount - 1;
+        }
+        const int sub = (int)((us >> (msb - SubBucketBits)) & (SubBuckets - 1));
+        return major * SubBuckets + sub;
+    }
+
+    // middle of the bucket's range
+    static uint64_t BucketValue(int index)
+    {
+        const int major = index / SubBuckets;
+        const uint64_t sub = (uint64_t)(index % SubBuckets);
+        if (major == 0) {
+            return sub;
+        }
+        const uint64_t lower = ((uint64_t)SubBuckets + sub) << (major - 1);
+        const uint64_t width = (uint64_t)1 << (major - 1);
+        return lower + width / 2;
+    }
+
+public:
+    void Record(uint64_t us)
+    {
+        buckets_[BucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(us, std::memory_order_relaxed);
+        auto lowest = min_.load(std::memory_order_relaxed);
+        while (us < lowest &&
+               !min_.compare_exchange_weak(lowest, us, std::memory_order_relaxed)) {
+        }
+        auto highest = max_.load(std::memory_order_relaxed);
+        while (us > highest &&
+               !max_.compare_exchange_weak(highest, us, std::memory_order_relaxed)) {
+        }
+    }
+
+    void Snapshot(DiscordLatencyStats* out) const
+    {
+        *out = {};
+        // Two passes over the buckets rather than a copy of them, which would be kilobytes of
+        // stack. Anything recorded in between only pushes the percentiles' walk along sooner.
+        uint64_t total = 0;
+        for (int i = 0; i < BucketCount; ++i) {
+            total += buckets_[i].load(std::memory_order_relaxed);
+        }
+        if (!total) {
+            return;
+        }
+        out->count = total;
+        out->minUs = min_.load(std::memory_order_relaxed);
+        out->maxUs = max_.load(std::memory_order_relaxed);
+        out->meanUs = sum_.load(std::memory_order_relaxed) / total;
+
+        struct {
+            uint64_t permille;
+            uint64_t* dest;
+        } wanted[] = {{500, &out->p50Us}, {900, &out->p90Us}, {990, &out->p99Us}, {999, &out->p999Us}};
+        uint64_t seen = 0;
+        size_t next = 0;
+        for (int i = 0; i < BucketCount && next < sizeof(wanted) / sizeof(wanted[0]); ++i) {
+            seen += buckets_[i].load(std::memory_order_relaxed);
+            while (next < sizeof(wanted) / sizeof(wanted[0]) &&
+                   seen * 1000 >= wanted[next].permille * total) {
+                // a bucket's midpoint can lie outside what was actually recorded
+                uint64_t value = BucketValue(i);
+                value = value < out->minUs ? out->minUs : value;
+                value = value > out->maxUs ? out->maxUs : value;
+                *wanted[next].dest = value;
+                ++next;
+            }
+        }
+    }
+};
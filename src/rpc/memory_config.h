@@ -0,0 +1,98 @@
+#pragma once
+
+// Compile time knobs for how much memory the library holds on to. Define any of these when building
+// the library to override it. DISCORD_LOW_MEMORY picks small defaults for all of them, which is
+// plenty for something that only sets a presence (launchers, tray tools) and brings a client down
+// to a few tens of KB.
+
+#include <stddef.h>
+
+// Largest frame we can send or receive. Anything bigger coming from Discord drops the connection.
+#ifndef DISCORD_MAX_FRAME_SIZE
+#ifdef DISCORD_LOW_MEMORY
+#define DISCORD_MAX_FRAME_SIZE (8 * 1024)
+#else
+#define DISCORD_MAX_FRAME_SIZE (64 * 1024)
+#endif
+#endif
+
+// Largest command we queue up: the presence, join replies, Discord_SendCommand.
+#ifndef DISCORD_MAX_MESSAGE_SIZE
+#ifdef DISCORD_LOW_MEMORY
+#define DISCORD_MAX_MESSAGE_SIZE (4 * 1024)
+#else
+#define DISCORD_MAX_MESSAGE_SIZE (16 * 1024)
+#endif
+#endif
+
+#ifndef DISCORD_SEND_QUEUE_SIZE
+#ifdef DISCORD_LOW_MEMORY
+#define DISCORD_SEND_QUEUE_SIZE 2
+#else
+#define DISCORD_SEND_QUEUE_SIZE 8
+#endif
+#endif
+
+#ifndef DISCORD_JOIN_QUEUE_SIZE
+#ifdef DISCORD_LOW_MEMORY
+#define DISCORD_JOIN_QUEUE_SIZE 2
+#else
+#define DISCORD_JOIN_QUEUE_SIZE 8
+#endif
+#endif
+
+// Parsing starts out in a buffer this big and only allocates if a message needs more.
+#ifndef DISCORD_PARSE_ARENA_SIZE
+#ifdef DISCORD_LOW_MEMORY
+#define DISCORD_PARSE_ARENA_SIZE (4 * 1024)
+#else
+#define DISCORD_PARSE_ARENA_SIZE (32 * 1024)
+#endif
+#endif
+
+#ifndef DISCORD_MAX_PENDING_REQUESTS
+#ifdef DISCORD_LOW_MEMORY
+#define DISCORD_MAX_PENDING_REQUESTS 8
+#else
+#define DISCORD_MAX_PENDING_REQUESTS 32
+#endif
+#endif
+
+// Trace events each thread remembers, in builds with DISCORD_ENABLE_TRACING. 24 bytes apiece.
+#ifndef DISCORD_TRACE_RING_SIZE
+#ifdef DISCORD_LOW_MEMORY
+#define DISCORD_TRACE_RING_SIZE 512
+#else
+#define DISCORD_TRACE_RING_SIZE 4096
+#endif
+#endif
+
+// Timer wheel slots, each a 1 ms tick and a pointer. A lap has to be longer than the IO loop's idle
+// poll (ReadPollIntervalMs, discord_rpc.cpp), or every idle wake-up costs a trip round all of them.
+#ifndef DISCORD_TIMER_WHEEL_SLOTS
+#ifdef DISCORD_LOW_MEMORY
+#define DISCORD_TIMER_WHEEL_SLOTS 512
+#else
+#define DISCORD_TIMER_WHEEL_SLOTS 1024
+#endif
+#endif
+
+// Each power of two of the latency histograms (stats.h) is split into 2^this linear sub-buckets,
+// so figures are to within 1 / 2^this: 3% at 5. Every bit doubles the histograms, 8 KB apiece at 5.
+#ifndef DISCORD_LATENCY_SUB_BUCKET_BITS
+#ifdef DISCORD_LOW_MEMORY
+#define DISCORD_LATENCY_SUB_BUCKET_BITS 3
+#else
+#define DISCORD_LATENCY_SUB_BUCKET_BITS 5
+#endif
+#endif
+
+static_assert(DISCORD_MAX_MESSAGE_SIZE + 64 <= DISCORD_MAX_FRAME_SIZE,
+              "a queued message has to fit in a frame");
+static_assert(DISCORD_SEND_QUEUE_SIZE > 0 && DISCORD_JOIN_QUEUE_SIZE > 0 &&
+                DISCORD_MAX_PENDING_REQUESTS > 0,
+              "queues need room for at least one entry");
+static_assert(DISCORD_PARSE_ARENA_SIZE >= 1024, "parse arena is too small to be useful");
+static_assert(DISCORD_TRACE_RING_SIZE > 0, "trace rings need room for at least one event");
+static_assert(DISCORD_LATENCY_SUB_BUCKET_BITS >= 1 && DISCORD_LATENCY_SUB_BUCKET_BITS <= 7,
+              "latency histograms take 1 to 7 sub-bucket bits");
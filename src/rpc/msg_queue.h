@@ -27,6 +27,7 @@ public:
     void CommitAdd() { ++pendingSends_; }
 
     bool HavePendingSends() const { return pendingSends_.load() != 0; }
+    size_t PendingCount() const { return pendingSends_.load(); }
     ElementType* GetNextSendMessage()
     {
         auto index = (nextSend_++) % QueueSize;
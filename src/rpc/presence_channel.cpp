@@ -0,0 +1,170 @@
+#include "presence_channel.h"
+
+#include "allocator.h"
+#include "serialization.h"
+
+#include <string.h>
+
+template <size_t Len>
+static void PackString(char (&dest)[Len], const char* src)
+{
+    if (src) {
+        StringCopy(dest, src);
+    }
+    else {
+        dest[0] = 0;
+    }
+}
+
+void PackPresenceRecord(PresenceRecord* record,
+                        int nonce,
+                        int pid,
+                        const DiscordRichPresence* presence)
+{
+    record->nonce = nonce;
+    record->pid = pid;
+    record->cleared = presence ? 0 : 1;
+    if (presence) {
+        record->startTimestamp = presence->startTimestamp;
+        record->endTimestamp = presence->endTimestamp;
+        record->partySize = presence->partySize;
+        record->partyMax = presence->partyMax;
+        record->instance = presence->instance;
+        PackString(record->state, presence->state);
+        PackString(record->details, presence->details);
+        PackString(record->largeImageKey, presence->largeImageKey);
+        PackString(record->largeImageText, presence->largeImageText);
+        PackString(record->smallImageKey, presence->smallImageKey);
+        PackString(record->smallImageText, presence->smallImageText);
+        PackString(record->partyId, presence->partyId);
+        PackString(record->matchSecret, presence->matchSecret);
+        PackString(record->joinSecret, presence->joinSecret);
+        PackString(record->spectateSecret, presence->spectateSecret);
+    }
+}
+
+void TerminatePresenceRecord(PresenceRecord* record)
+{
+    record->state[sizeof(record->state) - 1] = 0;
+    record->details[sizeof(record->details) - 1] = 0;
+    record->largeImageKey[sizeof(record->largeImageKey) - 1] = 0;
+    record->largeImageText[sizeof(record->largeImageText) - 1] = 0;
+    record->smallImageKey[sizeof(record->smallImageKey) - 1] = 0;
+    record->smallImageText[sizeof(record->smallImageText) - 1] = 0;
+    record->partyId[sizeof(record->partyId) - 1] = 0;
+    record->matchSecret[sizeof(record->matchSecret) - 1] = 0;
+    record->joinSecret[sizeof(record->joinSecret) - 1] = 0;
+    record->spectateSecret[sizeof(record->spectateSecret) - 1] = 0;
+}
+
+/*static*/ PresenceChannel* PresenceChannel::Create(const char* name)
+{
+    auto channel = DiscordNew<PresenceChannel>();
+    if (!channel) {
+        return nullptr;
+    }
+    if (!channel->Map(name, sizeof(PresenceChannelHeader) + sizeof(PresenceRecord), true)) {
+        DiscordDelete(channel);
+        return nullptr;
+    }
+    auto base = static_cast<char*>(channel->mapping_);
+    channel->header_ = reinterpret_cast<PresenceChannelHeader*>(base);
+    channel->record_ = reinterpret_cast<PresenceRecord*>(base + sizeof(PresenceChannelHeader));
+
+    memset(channel->record_, 0, sizeof(PresenceRecord));
+    auto header = channel->header_;
+    memcpy(header->magic, PresenceChannelMagic, sizeof(header->magic));
+    header->version = PresenceChannelVersion;
+    header->recordSize = (uint32_t)sizeof(PresenceRecord);
+    header->sequence.store(0);
+    header->reserved = 0;
+    return channel;
+}
+
+/*static*/ PresenceChannel* PresenceChannel::Open(const char* name)
+{
+    if (!name || strncmp(name, PresenceChannelPrefix, sizeof(PresenceChannelPrefix) - 1) != 0) {
+        return nullptr;
+    }
+    auto channel = DiscordNew<PresenceChannel>();
+    if (!channel) {
+        return nullptr;
+    }
+    if (!channel->Map(name, sizeof(PresenceChannelHeader) + sizeof(PresenceRecord), false)) {
+        DiscordDelete(channel);
+        return nullptr;
+    }
+    auto base = static_cast<char*>(channel->mapping_);
+    channel->header_ = reinterpret_cast<PresenceChannelHeader*>(base);
+    channel->record_ = reinterpret_cast<PresenceRecord*>(base + sizeof(PresenceChannelHeader));
+    auto header = channel->header_;
+    if (memcmp(header->magic, PresenceChannelMagic, sizeof(header->magic)) != 0 ||
+        header->version != PresenceChannelVersion ||
+        header->recordSize != (uint32_t)sizeof(PresenceRecord)) {
+        Destroy(channel);
+        return nullptr;
+    }
+    return channel;
+}
+
+/*static*/ void PresenceChannel::Destroy(PresenceChannel*& channel)
+{
+    if (channel) {
+        channel->Unmap();
+        DiscordDelete(channel);
+        channel = nullptr;
+    }
+}
+
+void PresenceChannel::Write(int nonce, int pid, const DiscordRichPresence* presence)
+{
+    auto& sequence = header_->sequence;
+    const uint32_t start = sequence.load(std::memory_order_relaxed);
+    sequence.store(start + 1, std::memory_order_relaxed);
+    // nothing below may be seen before the odd sequence is
+    std::atomic_thread_fence(std::memory_order_release);
+
+    PackPresenceRecord(record_, nonce, pid, presence);
+
+    sequence.store(start + 2, std::memory_order_release);
+}
+
+bool PresenceChannel::Read(PresenceRecord* record)
+{
+    auto& sequence = header_->sequence;
+    const uint32_t before = sequence.load(std::memory_order_acquire);
+    if (before == lastSequence_ || (before & 1)) {
+        return false;
+    }
+    memcpy(record, record_, sizeof(*record));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence.load(std::memory_order_relaxed) != before) {
+        // it changed under us; the next pass will get the newer one
+        return false;
+    }
+    lastSequence_ = before;
+
+    // the writer is another process, and we don't take its word for anything
+    TerminatePresenceRecord(record);
+    return true;
+}
+
+void PresenceFromRecord(const PresenceRecord& record, DiscordRichPresence* presence)
+{
+    memset(presence, 0, sizeof(*presence));
+    presence->state = record.state;
+    presence->details = record.details;
+    presence->startTimestamp = record.startTimestamp;
+    presence->endTimestamp = record.endTimestamp;
+    presence->largeImageKey = record.largeImageKey;
+    presence->largeImageText = record.largeImageText;
+    presence->smallImageKey = record.smallImageKey;
+    presence->smallImageText = record.smallImageText;
+    presence->partyId = record.partyId;
+    presence->partySize = record.partySize;
+    presence->partyMax = record.partyMax;
+    presence->matchSecret = record.matchSecret;
+    presence->joinSecret = record.joinSecret;
+    presence->spectateSecret = record.spectateSecret;
+    presence->instance = (int8_t)record.instance;
+}
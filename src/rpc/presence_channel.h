@@ -0,0 +1,96 @@
+#pragma once
+
+// A client's presence handed to the relay (src/relay) through a named shared memory section
+// instead of down the pipe. The game thread packs the presence into the section -- a few memcpys,
+// no syscall and no JSON -- and the relay picks it up on its next pass and serializes it there.
+// Like the pipe, only the latest presence counts: each record carries the nonce the presence would
+// have had on the pipe, so the relay can tell which of the two it heard from last is newer.
+//
+// Section layout: a PresenceChannelHeader, then one PresenceRecord. The record is guarded by a
+// seqlock: sequence is odd while the writer is part way through, and a reader only keeps a copy
+// if sequence was the same even number before and after it copied.
+
+#include "discord_rpc.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+constexpr char PresenceChannelMagic[8]{'D', 'R', 'P', 'C', 'P', 'R', 'S', '1'};
+constexpr uint32_t PresenceChannelVersion{1};
+// the relay won't open a section by any other name
+constexpr char PresenceChannelPrefix[]{"discord-presence-"};
+
+// DiscordRichPresence packed flat, strings and all; they're cut short at the limits Discord takes.
+struct PresenceRecord {
+    int32_t nonce;
+    int32_t pid;
+    int32_t cleared; // no presence at all, the rest means nothing
+    int32_t instance;
+    int64_t startTimestamp;
+    int64_t endTimestamp;
+    int32_t partySize;
+    int32_t partyMax;
+    char state[128 + 1];
+    char details[128 + 1];
+    char largeImageKey[32 + 1];
+    char largeImageText[128 + 1];
+    char smallImageKey[32 + 1];
+    char smallImageText[128 + 1];
+    char partyId[128 + 1];
+    char matchSecret[128 + 1];
+    char joinSecret[128 + 1];
+    char spectateSecret[128 + 1];
+};
+
+struct PresenceChannelHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    // both ends are separate processes, so these had better not need a lock
+    std::atomic<uint32_t> sequence;
+    uint32_t reserved;
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "the seqlock has to work between processes");
+
+// The record's contents without the seqlock around them; the snapshot (presence_snapshot.h) keeps
+// one of these too. Pack fills it in, nullptr meaning cleared. Terminate makes sure every string
+// ends inside its array, for a copy that came from another process.
+void PackPresenceRecord(PresenceRecord* record,
+                        int nonce,
+                        int pid,
+                        const DiscordRichPresence* presence);
+void TerminatePresenceRecord(PresenceRecord* record);
+// Points presence's strings into record, so it's only good as long as record is.
+void PresenceFromRecord(const PresenceRecord& record, DiscordRichPresence* presence);
+
+class PresenceChannel {
+    void* mapping_{nullptr};
+    PresenceChannelHeader* header_{nullptr};
+    PresenceRecord* record_{nullptr};
+    // reader only: the sequence of the last record Read handed out
+    uint32_t lastSequence_{0};
+
+    // per platform; create makes a new section, otherwise it's someone else's and we only read it
+    bool Map(const char* name, size_t size, bool create);
+    void Unmap();
+
+public:
+    PresenceChannel() = default;
+
+    // The client's end: a new section called name, with nothing in it yet; only the user we run
+    // as can open it. nullptr if there's a section called name already, whoever made it.
+    static PresenceChannel* Create(const char* name);
+    // The relay's end: nullptr unless there's a section called name that looks like one of these.
+    static PresenceChannel* Open(const char* name);
+    static void Destroy(PresenceChannel*&);
+
+    PresenceChannel(const PresenceChannel&) = delete;
+    PresenceChannel& operator=(const PresenceChannel&) = delete;
+
+    // Client only, and one thread at a time. nullptr clears the presence.
+    void Write(int nonce, int pid, const DiscordRichPresence* presence);
+    // Relay only. True, with a copy in *record, if something was written since the last time.
+    bool Read(PresenceRecord* record);
+};
@@ -0,0 +1,95 @@
+#include "presence_channel.h"
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMCX
+#define NOSERVICE
+#define NOIME
+#include <windows.h>
+#include <strsafe.h>
+
+// A DACL that lets in the user we run as and nobody else; the relay runs as the same user. The
+// default one can let other accounts in the same session at the section.
+struct CurrentUserOnly {
+    alignas(TOKEN_USER) char user[sizeof(TOKEN_USER) + SECURITY_MAX_SID_SIZE];
+    alignas(ACL) char acl[sizeof(ACL) + sizeof(ACCESS_ALLOWED_ACE) + SECURITY_MAX_SID_SIZE];
+    SECURITY_DESCRIPTOR descriptor;
+    SECURITY_ATTRIBUTES attributes;
+
+    bool Build()
+    {
+        HANDLE token;
+        if (!::OpenProcessToken(::GetCurrentProcess(), TOKEN_QUERY, &token)) {
+            return false;
+        }
+        DWORD length;
+        const BOOL gotUser = ::GetTokenInformation(token, TokenUser, user, sizeof(user), &length);
+        ::CloseHandle(token);
+        if (!gotUser) {
+            return false;
+        }
+        auto list = reinterpret_cast<ACL*>(acl);
+        if (!::InitializeAcl(list, sizeof(acl), ACL_REVISION) ||
+            !::AddAccessAllowedAce(list,
+                                   ACL_REVISION,
+                                   FILE_MAP_ALL_ACCESS,
+                                   reinterpret_cast<TOKEN_USER*>(user)->User.Sid) ||
+            !::InitializeSecurityDescriptor(&descriptor, SECURITY_DESCRIPTOR_REVISION) ||
+            !::SetSecurityDescriptorDacl(&descriptor, TRUE, list, FALSE)) {
+            return false;
+        }
+        attributes.nLength = sizeof(attributes);
+        attributes.lpSecurityDescriptor = &descriptor;
+        attributes.bInheritHandle = FALSE;
+        return true;
+    }
+};
+
+bool PresenceChannel::Map(const char* name, size_t size, bool create)
+{
+    // Local\ keeps it to this login session, the same as the pipe it goes with
+    wchar_t wideName[96];
+    size_t i = 0;
+    for (; name[i] && i < sizeof(wideName) / sizeof(wchar_t) - 1; ++i) {
+        wideName[i] = (wchar_t)(unsigned char)name[i];
+    }
+    wideName[i] = 0;
+    wchar_t sectionName[128];
+    StringCbPrintfW(sectionName, sizeof(sectionName), L"Local\\%s", wideName);
+
+    HANDLE section;
+    if (create) {
+        CurrentUserOnly security;
+        if (!security.Build()) {
+            return false;
+        }
+        section = ::CreateFileMappingW(INVALID_HANDLE_VALUE,
+                                       &security.attributes,
+                                       PAGE_READWRITE,
+                                       0,
+                                       (DWORD)size,
+                                       sectionName);
+        if (section && ::GetLastError() == ERROR_ALREADY_EXISTS) {
+            // someone got to the name first, so it's theirs and not ours to write the presence in
+            ::CloseHandle(section);
+            return false;
+        }
+    }
+    else {
+        section = ::OpenFileMappingW(FILE_MAP_READ, FALSE, sectionName);
+    }
+    if (!section) {
+        return false;
+    }
+    // the view keeps the section alive for as long as either end has it mapped
+    mapping_ = ::MapViewOfFile(section, create ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+    ::CloseHandle(section);
+    return mapping_ != nullptr;
+}
+
+void PresenceChannel::Unmap()
+{
+    if (mapping_) {
+        ::UnmapViewOfFile(mapping_);
+        mapping_ = nullptr;
+    }
+}
@@ -0,0 +1,144 @@
+#include "presence_snapshot.h"
+
+#include "allocator.h"
+#include "serialization.h"
+
+#include <string.h>
+#include <time.h>
+
+/*static*/ PresenceSnapshot* PresenceSnapshot::Open(const char* path, const char* applicationId)
+{
+    if (!path || !applicationId) {
+        return nullptr;
+    }
+    auto snapshot = DiscordNew<PresenceSnapshot>();
+    if (!snapshot) {
+        return nullptr;
+    }
+    if (!snapshot->Map(path, sizeof(PresenceSnapshotHeader) + sizeof(PresenceRecord))) {
+        DiscordDelete(snapshot);
+        return nullptr;
+    }
+    auto base = static_cast<char*>(snapshot->mapping_);
+    snapshot->header_ = reinterpret_cast<PresenceSnapshotHeader*>(base);
+    snapshot->record_ = reinterpret_cast<PresenceRecord*>(base + sizeof(PresenceSnapshotHeader));
+
+    auto header = snapshot->header_;
+    if (memcmp(header->magic, PresenceSnapshotMagic, sizeof(header->magic)) != 0 ||
+        header->version != PresenceSnapshotVersion ||
+        header->recordSize != (uint32_t)sizeof(PresenceRecord) ||
+        strncmp(header->applicationId, applicationId, sizeof(header->applicationId)) != 0) {
+        // new file (all zeros), someone else's, or from an older build: start it over
+        memset(snapshot->record_, 0, sizeof(PresenceRecord));
+        snapshot->record_->cleared = 1;
+        header->version = PresenceSnapshotVersion;
+        header->recordSize = (uint32_t)sizeof(PresenceRecord);
+        StringCopy(header->applicationId, applicationId);
+        header->sequence.store(0);
+        header->subscriptions.store(0);
+        header->claim.store(0);
+        header->subscriptionsSavedUnixSeconds.store(0);
+        header->savedUnixSeconds = 0;
+        // last, so a half made header never passes the check above
+        memcpy(header->magic, PresenceSnapshotMagic, sizeof(header->magic));
+    }
+    // An odd sequence means someone's saving, or died doing it. Load won't go by the record until
+    // it's even again, and the next save sorts out which of the two it was.
+    return snapshot;
+}
+
+/*static*/ void PresenceSnapshot::Destroy(PresenceSnapshot*& snapshot)
+{
+    if (snapshot) {
+        snapshot->Unmap();
+        DiscordDelete(snapshot);
+        snapshot = nullptr;
+    }
+}
+
+static bool RecentEnough(int64_t savedUnixSeconds, int64_t now)
+{
+    const int64_t age = now - savedUnixSeconds;
+    return age >= 0 && age <= PresenceSnapshotMaxAgeSeconds;
+}
+
+bool PresenceSnapshot::Load(PresenceRecord* record, uint32_t* subscriptions)
+{
+    const int64_t now = (int64_t)time(nullptr);
+    // a game can subscribe without ever setting a presence, so these go by their own time
+    *subscriptions = RecentEnough(header_->subscriptionsSavedUnixSeconds.load(), now)
+      ? header_->subscriptions.load()
+      : 0;
+
+    auto& sequence = header_->sequence;
+    const uint32_t before = sequence.load(std::memory_order_acquire);
+    if (before & 1) {
+        return false;
+    }
+    memcpy(record, record_, sizeof(*record));
+    const int64_t savedUnixSeconds = header_->savedUnixSeconds;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence.load(std::memory_order_relaxed) != before) {
+        // someone's saving right now, so what's here is about to be stale anyway
+        return false;
+    }
+    if (!RecentEnough(savedUnixSeconds, now)) {
+        return false;
+    }
+    TerminatePresenceRecord(record);
+    return !record->cleared;
+}
+
+bool PresenceSnapshot::Claim(int pid, uint64_t* claim)
+{
+    const uint32_t now = (uint32_t)time(nullptr);
+    const uint64_t mine = ((uint64_t)(uint32_t)pid << 32) | now;
+    uint64_t current = 0;
+    if (header_->claim.compare_exchange_strong(current, mine, std::memory_order_acquire)) {
+        *claim = mine;
+        return true;
+    }
+    // Another process is saving, and theirs is as new as ours, near enough. Unless they've been at
+    // it so long they can only have died; then only one of whoever notices gets to take over.
+    if (now - (uint32_t)current <= PresenceSnapshotClaimTimeoutSeconds ||
+        !header_->claim.compare_exchange_strong(current, mine, std::memory_order_acquire)) {
+        return false;
+    }
+    *claim = mine;
+    return true;
+}
+
+void PresenceSnapshot::SavePresence(int pid, const DiscordRichPresence* presence)
+{
+    uint64_t claim;
+    if (!Claim(pid, &claim)) {
+        return;
+    }
+    // Odd while we write. It's odd already if whoever had the claim before us died part way
+    // through, or stalled; moving it on by two keeps it odd and makes sure a stalled writer's
+    // release below fails once they wake up.
+    auto& sequence = header_->sequence;
+    uint32_t start = sequence.load(std::memory_order_relaxed);
+    uint32_t writing;
+    do {
+        writing = start + ((start & 1) ? 2 : 1);
+    } while (!sequence.compare_exchange_weak(start, writing, std::memory_order_relaxed));
+    // nothing below may be seen before the odd sequence is
+    std::atomic_thread_fence(std::memory_order_release);
+
+    PackPresenceRecord(record_, 0, pid, presence);
+    header_->savedUnixSeconds = (int64_t)time(nullptr);
+
+    // If this fails we stalled long enough to have the claim taken over, and the new owner is
+    // redoing the save; leave the sequence, and the claim, to them.
+    if (sequence.compare_exchange_strong(
+          writing, writing + 1, std::memory_order_release, std::memory_order_relaxed)) {
+        header_->claim.compare_exchange_strong(claim, 0, std::memory_order_release);
+    }
+}
+
+void PresenceSnapshot::SaveSubscriptions(uint32_t subscriptions)
+{
+    header_->subscriptions.store(subscriptions);
+    header_->subscriptionsSavedUnixSeconds.store((int64_t)time(nullptr));
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+// An application's last presence and event subscriptions, kept in a small memory mapped file so the
+// next process to run it -- the game its launcher handed off to, or the game again after a crash --
+// can send them straight after the handshake instead of showing nothing until its own code gets
+// around to working the presence out again. Saving is the same handful of memcpys the presence
+// channel does (presence_channel.h); the OS writes the page out in its own time, crash or not.
+//
+// File layout: a PresenceSnapshotHeader, then one PresenceRecord under the same seqlock as the
+// channel's. A launcher and its game can easily have the file open at the same time, so unlike the
+// channel a writer first claims the record by putting its pid and the time in claim, and skips the
+// save if someone else already has it. Only a claim older than PresenceSnapshotClaimTimeoutSeconds
+// gets taken over, since a save takes microseconds and whoever made that one must have died part
+// way through.
+
+#include "presence_channel.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+constexpr char PresenceSnapshotMagic[8]{'D', 'R', 'P', 'C', 'S', 'N', 'P', '1'};
+constexpr uint32_t PresenceSnapshotVersion{2};
+// Much older than this and it's more likely to be wrong than to help; whatever the game was doing
+// a few minutes before the crash, it isn't doing now.
+constexpr int64_t PresenceSnapshotMaxAgeSeconds{5 * 60};
+constexpr uint32_t PresenceSnapshotClaimTimeoutSeconds{5};
+
+// the events a snapshot remembers being subscribed to, as bits
+constexpr uint32_t SnapshotActivityJoin{1};
+constexpr uint32_t SnapshotActivitySpectate{2};
+constexpr uint32_t SnapshotActivityJoinRequest{4};
+
+struct PresenceSnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    // the file name says this too, but the file name isn't something we wrote
+    char applicationId[64];
+    std::atomic<uint32_t> sequence;
+    // saved on their own, so they don't need the seqlock
+    std::atomic<uint32_t> subscriptions;
+    // the writer's pid in the top half, the low 32 bits of the time it claimed in the bottom; 0 if
+    // nobody's saving
+    std::atomic<uint64_t> claim;
+    std::atomic<int64_t> subscriptionsSavedUnixSeconds;
+    // written under the seqlock along with the record
+    int64_t savedUnixSeconds;
+};
+
+class PresenceSnapshot {
+    void* mapping_{nullptr};
+    PresenceSnapshotHeader* header_{nullptr};
+    PresenceRecord* record_{nullptr};
+
+    // per platform; opens the file if it's there and makes it if it isn't
+    bool Map(const char* path, size_t size);
+    void Unmap();
+    // the right to write the record; *claim is what to hand back afterwards
+    bool Claim(int pid, uint64_t* claim);
+
+public:
+    PresenceSnapshot() = default;
+
+    // nullptr if the file can't be opened or mapped. One that isn't a snapshot of applicationId's
+    // starts over empty.
+    static PresenceSnapshot* Open(const char* path, const char* applicationId);
+    static void Destroy(PresenceSnapshot*&);
+
+    PresenceSnapshot(const PresenceSnapshot&) = delete;
+    PresenceSnapshot& operator=(const PresenceSnapshot&) = delete;
+
+    // What was saved last, by us or whoever had the file before. subscriptions comes back 0 if they
+    // were saved too long ago to go by; true if there's a presence in *record worth restoring as
+    // well, which goes by its own save time.
+    bool Load(PresenceRecord* record, uint32_t* subscriptions);
+    // nullptr clears it. Callers take turns; other processes may not, see above.
+    void SavePresence(int pid, const DiscordRichPresence* presence);
+    void SaveSubscriptions(uint32_t subscriptions);
+};
@@ -0,0 +1,46 @@
+#include "presence_snapshot.h"
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMCX
+#define NOSERVICE
+#define NOIME
+#include <windows.h>
+
+bool PresenceSnapshot::Map(const char* path, size_t size)
+{
+    wchar_t widePath[MAX_PATH];
+    if (!::MultiByteToWideChar(CP_UTF8, 0, path, -1, widePath, MAX_PATH)) {
+        return false;
+    }
+    // the whole point is reading what the last process left, and the one before us may well still
+    // have it open
+    HANDLE file = ::CreateFileW(widePath,
+                                GENERIC_READ | GENERIC_WRITE,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                nullptr,
+                                OPEN_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL,
+                                nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    // grows a new (or short) file to size, with zeros
+    HANDLE section =
+      ::CreateFileMappingW(file, nullptr, PAGE_READWRITE, 0, (DWORD)size, nullptr);
+    // the section keeps the file open, and the view keeps the section
+    ::CloseHandle(file);
+    if (!section) {
+        return false;
+    }
+    mapping_ = ::MapViewOfFile(section, FILE_MAP_WRITE, 0, 0, size);
+    ::CloseHandle(section);
+    return mapping_ != nullptr;
+}
+
+void PresenceSnapshot::Unmap()
+{
+    if (mapping_) {
+        ::UnmapViewOfFile(mapping_);
+        mapping_ = nullptr;
+    }
+}
@@ -0,0 +1,213 @@
+#include "request_table.h"
+
+
+RequestTable::RequestTable()
+{
+    for (auto& entry : entries_) {
+        entry.table = this;
+        entry.timeout.userData = &entry;
+        entry.timeout.callback = [](void* userData) {
+            auto entry = static_cast<Entry*>(userData);
+            // the wheel has already let go of the timer, no need to hand it the wheel back
+            entry->table->Complete(entry->nonce, nullptr, DISCORD_REQUEST_TIMEOUT);
+        };
+    }
+}
+
+RequestTable::Entry* RequestTable::Find(int nonce)
+{
+    // nonces are handed out in sequence, so starting at nonce % capacity almost always hits first
+    const size_t start = (size_t)nonce % MaxPendingRequests;
+    for (size_t i = 0; i < MaxPendingRequests; ++i) {
+        auto& entry = entries_[(start + i) % MaxPendingRequests];
+        if (entry.nonce == nonce) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+bool RequestTable::Add(int nonce,
+                       DiscordRequestCallback callback,
+                       void* userData,
+                       bool wantsData)
+{
+    if (!callback || nonce == 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (inFlight_.load() >= MaxPendingRequests) {
+        return false;
+    }
+    auto entry = Find(0);
+    if (!entry) {
+        return false;
+    }
+    entry->nonce = nonce;
+    entry->callback = callback;
+    entry->userData = userData;
+    entry->wantsData = wantsData;
+    entry->sentUs = 0;
+    ++inFlight_;
+    return true;
+}
+
+void RequestTable::Drop(int nonce)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto entry = Find(nonce);
+    if (entry && !entry->sentUs) {
+        entry->nonce = 0;
+        entry->callback = nullptr;
+        entry->userData = nullptr;
+        --inFlight_;
+    }
+}
+
+bool RequestTable::AwaitingReply()
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (auto& entry : entries_) {
+        if (entry.nonce != 0 && entry.sentUs != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void RequestTable::Sent(int nonce, TimerWheel* timers)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto entry = Find(nonce);
+    if (entry) {
+        entry->sentUs = MonotonicNowUs();
+        timers->Schedule(&entry->timeout, MonotonicNowMs() + RequestTimeoutMs);
+    }
+}
+
+void RequestTable::CompleteLocked(Entry* entry,
+                                  TimerWheel* timers,
+                                  int status,
+                                  int errorCode,
+                                  const char* message,
+                                  const JsonValue* data)
+{
+    if (timers) {
+        timers->Cancel(&entry->timeout);
+    }
+
+    const int64_t nowUs = MonotonicNowUs();
+    uint32_t latencyUs = 0;
+    if (entry->sentUs && (status == DISCORD_REQUEST_OK || status == DISCORD_REQUEST_ERROR)) {
+        auto elapsed = nowUs - entry->sentUs;
+        latencyUs = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+    }
+
+    // inFlight_ keeps this from ever being full
+    auto completion = completions_.GetNextAddMessage();
+    completion->callback = entry->callback;
+    completion->userData = entry->userData;
+    completion->status = status;
+    completion->errorCode = errorCode;
+    completion->latencyUs = latencyUs;
+    completion->queuedUs = nowUs;
+    StringCopy(completion->message, message ? message : "");
+    completion->data = nullptr;
+    completion->dataLength = 0;
+    if (entry->wantsData && data) {
+        // Most answers are a few fields and fit in the completion. DirectStringBuffer stops
+        // quietly at the end, so filling the room means it may have been cut short.
+        const size_t room = sizeof(completion->inlineData) - 1;
+        JsonWriter inlineWriter(completion->inlineData, room);
+        if (data->Accept(inlineWriter) && inlineWriter.Size() < room) {
+            completion->data = completion->inlineData;
+            completion->dataLength = inlineWriter.Size();
+            completion->data[completion->dataLength] = 0;
+        }
+        else {
+            MallocAllocator allocator;
+            rapidjson::GenericStringBuffer<UTF8, MallocAllocator> json(&allocator);
+            rapidjson::Writer<decltype(json), UTF8, UTF8, MallocAllocator> writer(json, &allocator);
+            if (data->Accept(writer)) {
+                completion->data = (char*)DiscordMalloc(json.GetSize() + 1);
+                if (completion->data) {
+                    memcpy(completion->data, json.GetString(), json.GetSize() + 1);
+                    completion->dataLength = json.GetSize();
+                }
+            }
+        }
+    }
+    completions_.CommitAdd();
+
+    entry->nonce = 0;
+    entry->callback = nullptr;
+    entry->userData = nullptr;
+    entry->sentUs = 0;
+}
+
+void RequestTable::Complete(int nonce,
+                            TimerWheel* timers,
+                            int status,
+                            int errorCode,
+                            const char* message,
+                            const JsonValue* data)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto entry = Find(nonce);
+    if (entry) {
+        CompleteLocked(entry, timers, status, errorCode, message, data);
+    }
+}
+
+void RequestTable::Supersede(int nonce)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto entry = Find(nonce);
+    if (entry && !entry->sentUs) {
+        CompleteLocked(entry, nullptr, DISCORD_REQUEST_SUPERSEDED, 0, "Replaced before it was sent");
+    }
+}
+
+void RequestTable::FailSent(TimerWheel* timers)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (auto& entry : entries_) {
+        if (entry.nonce && entry.sentUs) {
+            CompleteLocked(&entry, timers, DISCORD_REQUEST_DISCONNECTED, 0, "Disconnected");
+        }
+    }
+}
+
+void RequestTable::CancelAll(TimerWheel* timers)
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (auto& entry : entries_) {
+        if (entry.nonce) {
+            CompleteLocked(&entry, timers, DISCORD_REQUEST_CANCELLED, 0, "Client shut down");
+        }
+    }
+}
+
+void RequestTable::Dispatch(LatencyHistogram* dispatchDelay)
+{
+    while (completions_.HavePendingSends()) {
+        auto completion = completions_.GetNextSendMessage();
+        if (dispatchDelay) {
+            const int64_t waitedUs = MonotonicNowUs() - completion->queuedUs;
+            dispatchDelay->Record(waitedUs > 0 ? (uint64_t)waitedUs : 0);
+        }
+        DiscordRequestResult result{completion->status,
+                                    completion->errorCode,
+                                    completion->message,
+                                    completion->latencyUs,
+                                    completion->data,
+                                    completion->dataLength};
+        completion->callback(&result, completion->userData);
+        if (completion->data != completion->inlineData) {
+            DiscordFree(completion->data);
+        }
+        completion->data = nullptr;
+        completions_.CommitSend();
+        --inFlight_;
+    }
+}
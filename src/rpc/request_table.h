@@ -0,0 +1,93 @@
+#pragma once
+
+#include "discord_rpc.h"
+
+#include "latency_histogram.h"
+#include "memory_config.h"
+#include "msg_queue.h"
+#include "serialization.h"
+#include "timer_wheel.h"
+
+#include <atomic>
+#include <mutex>
+
+// How long we give Discord to answer a command once it's on the wire.
+constexpr int64_t RequestTimeoutMs{5 * 1000};
+constexpr size_t MaxPendingRequests{DISCORD_MAX_PENDING_REQUESTS};
+// A response's data up to this long is kept in its completion, anything longer is allocated.
+constexpr size_t InlineResponseDataSize{256};
+
+struct RequestCompletion {
+    DiscordRequestCallback callback;
+    void* userData;
+    int status;
+    int errorCode;
+    uint32_t latencyUs;
+    int64_t queuedUs;
+    char message[256];
+    // the response's data as JSON, only kept for requests that asked for it; points at
+    // inlineData when it fits there
+    char* data;
+    size_t dataLength;
+    char inlineData[InlineResponseDataSize];
+};
+
+// Commands waiting for an answer, keyed by nonce. Anyone may Add; everything that touches timers
+// (Sent, completing a request that's been sent, FailSent) belongs to the IO loop. Completions are
+// queued and their callbacks run from Dispatch, on whichever thread runs callbacks.
+class RequestTable {
+    struct Entry {
+        RequestTable* table{nullptr};
+        int nonce{0}; // 0 means free
+        DiscordRequestCallback callback{nullptr};
+        void* userData{nullptr};
+        bool wantsData{false};
+        int64_t sentUs{0};
+        Timer timeout;
+    };
+
+    std::mutex mutex_;
+    Entry entries_[MaxPendingRequests];
+    // a slot in flight is either in entries_ or waiting in completions_, never more than capacity
+    std::atomic<size_t> inFlight_{0};
+    MsgQueue<RequestCompletion, MaxPendingRequests> completions_;
+
+    Entry* Find(int nonce);
+    void CompleteLocked(Entry* entry,
+                        TimerWheel* timers,
+                        int status,
+                        int errorCode,
+                        const char* message,
+                        const JsonValue* data = nullptr);
+
+public:
+    RequestTable();
+
+    // false if too many requests are outstanding, in which case the callback will never run
+    bool Add(int nonce,
+             DiscordRequestCallback callback,
+             void* userData,
+             bool wantsData = false);
+    // the request never made it into a queue after all; its callback won't run
+    void Drop(int nonce);
+    void Sent(int nonce, TimerWheel* timers);
+    void Complete(int nonce,
+                  TimerWheel* timers,
+                  int status,
+                  int errorCode = 0,
+                  const char* message = nullptr,
+                  const JsonValue* data = nullptr);
+    // A newer command replaced this one before it went out. Safe from any thread since an unsent
+    // request has no timer; does nothing if it was sent after all.
+    void Supersede(int nonce);
+    // the connection went away: nothing on the wire will be answered now
+    void FailSent(TimerWheel* timers);
+    // shutting down: complete everything as cancelled, Dispatch still has to run the callbacks
+    void CancelAll(TimerWheel* timers);
+
+    // dispatchDelay, if given, gets how long each completion waited for its callback
+    void Dispatch(LatencyHistogram* dispatchDelay = nullptr);
+
+    // anything on the wire that Discord hasn't answered yet
+    bool AwaitingReply();
+};
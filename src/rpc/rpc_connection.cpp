@@ -1,27 +1,40 @@
 #include "rpc_connection.h"
 #include "serialization.h"
+#include "timer_wheel.h"
+#include "trace.h"
 
 #include <atomic>
+#include <new>
 
 static const int RpcVersion = 1;
-static RpcConnection Instance;
 
 /*static*/ RpcConnection* RpcConnection::Create(const char* applicationId)
 {
-    Instance.connection = BaseConnection::Create();
-    StringCopy(Instance.appId, applicationId);
-    return &Instance;
+    auto c = DiscordNew<RpcConnection>();
+    if (!c) {
+        return nullptr;
+    }
+    c->connection = BaseConnection::Create();
+    if (!c->connection) {
+        DiscordDelete(c);
+        return nullptr;
+    }
+    StringCopy(c->appId, applicationId);
+    return c;
 }
 
 /*static*/ void RpcConnection::Destroy(RpcConnection*& c)
 {
     c->Close();
     BaseConnection::Destroy(c->connection);
+    FlightRecorder::Destroy(c->recorder);
+    DiscordDelete(c);
     c = nullptr;
 }
 
 void RpcConnection::Open()
 {
+    DISCORD_TRACE_SCOPE("RpcConnection::Open");
     if (state == State::Connected) {
         return;
     }
@@ -31,14 +44,14 @@ void RpcConnection::Open()
     }
 
     if (state == State::SentHandshake) {
-        JsonDocument message;
+        auto& message = readDocument;
         if (Read(message)) {
             auto cmd = GetStrMember(&message, "cmd");
             auto evt = GetStrMember(&message, "evt");
             if (cmd && evt && !strcmp(cmd, "DISPATCH") && !strcmp(evt, "READY")) {
                 state = State::Connected;
                 if (onConnect) {
-                    onConnect(message);
+                    onConnect(userData, message);
                 }
             }
         }
@@ -49,6 +62,9 @@ void RpcConnection::Open()
           sendFrame.message, sizeof(sendFrame.message), RpcVersion, appId);
 
         if (connection->Write(&sendFrame, sizeof(MessageFrameHeader) + sendFrame.length)) {
+            RecordSent(&sendFrame, sizeof(MessageFrameHeader) + sendFrame.length);
+            stats.framesOut.Add();
+            stats.bytesOut.Add(sizeof(MessageFrameHeader) + sendFrame.length);
             state = State::SentHandshake;
         }
         else {
@@ -60,14 +76,32 @@ void RpcConnection::Open()
 void RpcConnection::Close()
 {
     if (onDisconnect && (state == State::Connected || state == State::SentHandshake)) {
-        onDisconnect(lastErrorCode, lastErrorMessage);
+        onDisconnect(userData, lastErrorCode, lastErrorMessage);
     }
     connection->Close();
     state = State::Disconnected;
+    batchLength = 0;
+    batchFrames = 0;
+    pingSentUs = 0;
+}
+
+void RpcConnection::CloseWithError(ErrorCode errorCode, const char* message)
+{
+    lastErrorCode = (int)errorCode;
+    StringCopy(lastErrorMessage, message);
+    Close();
 }
 
 bool RpcConnection::Write(const void* data, size_t length)
 {
+    DISCORD_TRACE_SCOPE("RpcConnection::Write");
+    if (length > sizeof(sendFrame.message)) {
+        return false;
+    }
+    // a batch shares sendFrame's storage, send it first so we don't scribble over it
+    if (!FlushBatch()) {
+        return false;
+    }
     sendFrame.opcode = Opcode::Frame;
     memcpy(sendFrame.message, data, length);
     sendFrame.length = (uint32_t)length;
@@ -75,15 +109,78 @@ bool RpcConnection::Write(const void* data, size_t length)
         Close();
         return false;
     }
+    RecordSent(&sendFrame, sizeof(MessageFrameHeader) + length);
+    stats.framesOut.Add();
+    stats.bytesOut.Add(sizeof(MessageFrameHeader) + length);
+    return true;
+}
+
+bool RpcConnection::SendPing()
+{
+    if (state != State::Connected || !FlushBatch()) {
+        return false;
+    }
+    sendFrame.opcode = Opcode::Ping;
+    sendFrame.length =
+      (uint32_t)JsonWritePingObj(sendFrame.message, sizeof(sendFrame.message), ++pingNonce);
+    const size_t length = sizeof(MessageFrameHeader) + sendFrame.length;
+    if (!connection->Write(&sendFrame, length)) {
+        Close();
+        return false;
+    }
+    RecordSent(&sendFrame, length);
+    stats.framesOut.Add();
+    stats.bytesOut.Add(length);
+    pingSentUs = MonotonicNowUs();
+    return true;
+}
+
+bool RpcConnection::FlushBatch()
+{
+    if (batchLength == 0) {
+        return true;
+    }
+    DISCORD_TRACE_SCOPE("RpcConnection::FlushBatch");
+    const size_t length = batchLength;
+    const size_t frames = batchFrames;
+    batchLength = 0;
+    batchFrames = 0;
+    if (!connection->Write(&sendFrame, length)) {
+        Close();
+        return false;
+    }
+    RecordSent(&sendFrame, length);
+    stats.framesOut.Add(frames);
+    stats.bytesOut.Add(length);
     return true;
 }
 
+void RpcConnection::RecordSent(const void* frames, size_t length)
+{
+    if (!recorder) {
+        return;
+    }
+    auto frame = static_cast<const char*>(frames);
+    const auto end = frame + length;
+    while ((size_t)(end - frame) >= sizeof(MessageFrameHeader)) {
+        MessageFrameHeader header;
+        memcpy(&header, frame, sizeof(header));
+        frame += sizeof(header);
+        if (header.length > (size_t)(end - frame)) {
+            break;
+        }
+        recorder->Record(FlightRecord::Out, (uint32_t)header.opcode, frame, header.length);
+        frame += header.length;
+    }
+}
+
 bool RpcConnection::Read(JsonDocument& message)
 {
     if (state != State::Connected && state != State::SentHandshake) {
         return false;
     }
-    MessageFrame readFrame;
+    DISCORD_TRACE_SCOPE("RpcConnection::Read");
+    message.Reset();
     for (;;) {
         bool didRead = connection->Read(&readFrame, sizeof(MessageFrameHeader));
         if (!didRead) {
@@ -95,6 +192,13 @@ bool RpcConnection::Read(JsonDocument& message)
             return false;
         }
 
+        if (readFrame.length >= sizeof(readFrame.message)) {
+            lastErrorCode = (int)ErrorCode::ReadCorrupt;
+            StringCopy(lastErrorMessage, "Frame too large");
+            Close();
+            return false;
+        }
+
         if (readFrame.length > 0) {
             didRead = connection->Read(readFrame.message, readFrame.length);
             if (!didRead) {
@@ -105,6 +209,12 @@ bool RpcConnection::Read(JsonDocument& message)
             }
             readFrame.message[readFrame.length] = 0;
         }
+        stats.framesIn.Add();
+        stats.bytesIn.Add(sizeof(MessageFrameHeader) + readFrame.length);
+        if (recorder) {
+            recorder->Record(
+              FlightRecord::In, (uint32_t)readFrame.opcode, readFrame.message, readFrame.length);
+        }
 
         switch (readFrame.opcode) {
         case Opcode::Close: {
@@ -114,16 +224,39 @@ bool RpcConnection::Read(JsonDocument& message)
             Close();
             return false;
         }
-        case Opcode::Frame:
-            message.ParseInsitu(readFrame.message);
-            return true;
+        case Opcode::Frame: {
+            {
+                DISCORD_TRACE_SCOPE("ParseInsitu");
+                message.ParseInsitu(readFrame.message);
+            }
+            if (!message.HasParseError() && message.IsObject()) {
+                return true;
+            }
+            // nothing anyone could make sense of, skip it rather than hand it out half parsed
+            stats.parseFailures.Add();
+            message.Reset();
+            break;
+        }
         case Opcode::Ping:
             readFrame.opcode = Opcode::Pong;
             if (!connection->Write(&readFrame, sizeof(MessageFrameHeader) + readFrame.length)) {
                 Close();
             }
+            else {
+                RecordSent(&readFrame, sizeof(MessageFrameHeader) + readFrame.length);
+                stats.framesOut.Add();
+                stats.bytesOut.Add(sizeof(MessageFrameHeader) + readFrame.length);
+            }
             break;
         case Opcode::Pong:
+            // we only ever have the one ping out, so any pong answers it
+            if (pingSentUs) {
+                const int64_t rttUs = MonotonicNowUs() - pingSentUs;
+                pingSentUs = 0;
+                if (onPong) {
+                    onPong(userData, rttUs > UINT32_MAX ? UINT32_MAX : (uint32_t)rttUs);
+                }
+            }
             break;
         case Opcode::Handshake:
         default:
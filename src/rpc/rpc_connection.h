@@ -1,17 +1,21 @@
 #pragma once
 
 #include "connection.h"
+#include "flight_recorder.h"
+#include "memory_config.h"
 #include "serialization.h"
+#include "stats.h"
 
-// I took this from the buffer size libuv uses for named pipes; I suspect ours would usually be much
-// smaller.
-constexpr size_t MaxRpcFrameSize = 64 * 1024;
+// I took the default from the buffer size libuv uses for named pipes; I suspect ours would usually
+// be much smaller.
+constexpr size_t MaxRpcFrameSize = DISCORD_MAX_FRAME_SIZE;
 
 struct RpcConnection {
     enum class ErrorCode : int {
         Success = 0,
         PipeClosed = 1,
         ReadCorrupt = 2,
+        Unresponsive = 3,
     };
 
     enum class Opcode : uint32_t {
@@ -40,12 +44,27 @@ struct RpcConnection {
 
     BaseConnection* connection{nullptr};
     State state{State::Disconnected};
-    void (*onConnect)(JsonDocument& message){nullptr};
-    void (*onDisconnect)(int errorCode, const char* message){nullptr};
+    void* userData{nullptr};
+    void (*onConnect)(void* userData, JsonDocument& message){nullptr};
+    void (*onDisconnect)(void* userData, int errorCode, const char* message){nullptr};
+    void (*onPong)(void* userData, uint32_t rttUs){nullptr};
     char appId[64]{};
     int lastErrorCode{0};
     char lastErrorMessage[256]{};
     RpcConnection::MessageFrame sendFrame;
+    // Reads land here rather than on the stack, so the IO path fits on a small stack (fibers, say).
+    // readDocument holds the last message Read returned until the next Read.
+    RpcConnection::MessageFrame readFrame;
+    JsonDocument readDocument;
+    // bytes of frames appended to sendFrame's storage but not yet flushed, and how many frames
+    size_t batchLength{0};
+    size_t batchFrames{0};
+    ConnectionStats stats;
+    // owned, and only touched by whoever runs the IO
+    FlightRecorder* recorder{nullptr};
+    // when the ping we're waiting on a pong for went out, 0 if none is
+    int64_t pingSentUs{0};
+    int pingNonce{0};
 
     static RpcConnection* Create(const char* applicationId);
     static void Destroy(RpcConnection*&);
@@ -54,6 +73,37 @@ struct RpcConnection {
 
     void Open();
     void Close();
+    void CloseWithError(ErrorCode errorCode, const char* message);
     bool Write(const void* data, size_t length);
+    // false if we're not connected, or the write failed (which closes the connection)
+    bool SendPing();
     bool Read(JsonDocument& message);
+
+    // Batches several frames into a single write so they go out back to back. writeBody serializes
+    // a frame body into (dest, maxLen) and returns its length; AppendFrame returns false if the
+    // frame doesn't fit in what's left of the batch.
+    template <typename WriteBody>
+    bool AppendFrame(WriteBody writeBody)
+    {
+        auto batch = reinterpret_cast<char*>(&sendFrame);
+        const size_t headerSize = sizeof(MessageFrameHeader);
+        if (batchLength + headerSize >= sizeof(sendFrame)) {
+            return false;
+        }
+        const size_t maxLen = sizeof(sendFrame) - batchLength - headerSize;
+        const size_t length = writeBody(batch + batchLength + headerSize, maxLen);
+        if (length == 0 || length >= maxLen) {
+            return false;
+        }
+        MessageFrameHeader header{Opcode::Frame, (uint32_t)length};
+        memcpy(batch + batchLength, &header, headerSize);
+        batchLength += headerSize + length;
+        ++batchFrames;
+        return true;
+    }
+    bool FlushBatch();
+
+private:
+    // frames is one or more whole frames, headers included, as they went out
+    void RecordSent(const void* frames, size_t length);
 };
@@ -1,6 +1,7 @@
 #include "serialization.h"
 #include "connection.h"
 #include "discord_rpc.h"
+#include "trace.h"
 
 template <typename T>
 void NumberToString(char* dest, T number)
@@ -86,6 +87,7 @@ size_t JsonWriteRichPresenceObj(char* dest,
                                 int pid,
                                 const DiscordRichPresence* presence)
 {
+    DISCORD_TRACE_SCOPE("JsonWriteRichPresenceObj");
     JsonWriter writer(dest, maxLen);
 
     {
@@ -164,6 +166,7 @@ size_t JsonWriteRichPresenceObj(char* dest,
 
 size_t JsonWriteHandshakeObj(char* dest, size_t maxLen, int version, const char* applicationId)
 {
+    DISCORD_TRACE_SCOPE("JsonWriteHandshakeObj");
     JsonWriter writer(dest, maxLen);
 
     {
@@ -177,8 +180,22 @@ size_t JsonWriteHandshakeObj(char* dest, size_t maxLen, int version, const char*
     return writer.Size();
 }
 
+size_t JsonWritePingObj(char* dest, size_t maxLen, int nonce)
+{
+    DISCORD_TRACE_SCOPE("JsonWritePingObj");
+    JsonWriter writer(dest, maxLen);
+
+    {
+        WriteObject obj(writer);
+        JsonWriteNonce(writer, nonce);
+    }
+
+    return writer.Size();
+}
+
 size_t JsonWriteSubscribeCommand(char* dest, size_t maxLen, int nonce, const char* evtName)
 {
+    DISCORD_TRACE_SCOPE("JsonWriteSubscribeCommand");
     JsonWriter writer(dest, maxLen);
 
     {
@@ -198,6 +215,7 @@ size_t JsonWriteSubscribeCommand(char* dest, size_t maxLen, int nonce, const cha
 
 size_t JsonWriteUnsubscribeCommand(char* dest, size_t maxLen, int nonce, const char* evtName)
 {
+    DISCORD_TRACE_SCOPE("JsonWriteUnsubscribeCommand");
     JsonWriter writer(dest, maxLen);
 
     {
@@ -215,8 +233,30 @@ size_t JsonWriteUnsubscribeCommand(char* dest, size_t maxLen, int nonce, const c
     return writer.Size();
 }
 
+size_t JsonWriteAttachPresenceChannel(char* dest, size_t maxLen, int nonce, const char* name)
+{
+    DISCORD_TRACE_SCOPE("JsonWriteAttachPresenceChannel");
+    JsonWriter writer(dest, maxLen);
+
+    {
+        WriteObject obj(writer);
+
+        JsonWriteNonce(writer, nonce);
+
+        WriteKey(writer, "cmd");
+        writer.String("ATTACH_PRESENCE_CHANNEL");
+
+        WriteObject args(writer, "args");
+        WriteKey(writer, "name");
+        writer.String(name);
+    }
+
+    return writer.Size();
+}
+
 size_t JsonWriteJoinReply(char* dest, size_t maxLen, const char* userId, int reply, int nonce)
 {
+    DISCORD_TRACE_SCOPE("JsonWriteJoinReply");
     JsonWriter writer(dest, maxLen);
 
     {
@@ -243,3 +283,37 @@ size_t JsonWriteJoinReply(char* dest, size_t maxLen, const char* userId, int rep
 
     return writer.Size();
 }
+
+size_t JsonWriteCommand(char* dest,
+                        size_t maxLen,
+                        int nonce,
+                        const char* command,
+                        const char* evt,
+                        const char* argsJson,
+                        size_t argsLength)
+{
+    DISCORD_TRACE_SCOPE("JsonWriteCommand");
+    JsonWriter writer(dest, maxLen);
+
+    {
+        WriteObject obj(writer);
+
+        WriteKey(writer, "cmd");
+        writer.String(command);
+
+        if (evt) {
+            WriteKey(writer, "evt");
+            writer.String(evt);
+        }
+
+        if (argsJson && argsLength) {
+            // no need to parse something just to write it back out again
+            WriteKey(writer, "args");
+            writer.RawValue(argsJson, argsLength, rapidjson::kObjectType);
+        }
+
+        JsonWriteNonce(writer, nonce);
+    }
+
+    return writer.Size();
+}
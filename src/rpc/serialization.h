@@ -1,5 +1,8 @@
 #pragma once
 
+#include "allocator.h"
+#include "memory_config.h"
+
 #include <stdint.h>
 
 #ifndef __MINGW32__
@@ -38,6 +41,9 @@ inline size_t StringCopy(char (&dest)[Len], const char* src)
 
 size_t JsonWriteHandshakeObj(char* dest, size_t maxLen, int version, const char* applicationId);
 
+// body of a Ping frame; Discord echoes it back in the Pong
+size_t JsonWritePingObj(char* dest, size_t maxLen, int nonce);
+
 // Commands
 struct DiscordRichPresence;
 size_t JsonWriteRichPresenceObj(char* dest,
@@ -49,8 +55,20 @@ size_t JsonWriteSubscribeCommand(char* dest, size_t maxLen, int nonce, const cha
 
 size_t JsonWriteUnsubscribeCommand(char* dest, size_t maxLen, int nonce, const char* evtName);
 
+// tells the relay where to find our presence channel (presence_channel.h)
+size_t JsonWriteAttachPresenceChannel(char* dest, size_t maxLen, int nonce, const char* name);
+
 size_t JsonWriteJoinReply(char* dest, size_t maxLen, const char* userId, int reply, int nonce);
 
+// argsJson is spliced in as is, it had better be a JSON object already; evt may be null
+size_t JsonWriteCommand(char* dest,
+                        size_t maxLen,
+                        int nonce,
+                        const char* command,
+                        const char* evt,
+                        const char* argsJson,
+                        size_t argsLength);
+
 // I want to use as few allocations as I can get away with, and to do that with RapidJson, you need
 // to supply some of your own allocators for stuff rather than use the defaults
 
@@ -106,6 +124,8 @@ public:
     {
     }
     static const bool kNeedFree = false;
+    // only when nothing handed out is still in use
+    void Reset() { buffer_ = fixedBuffer_; }
 };
 
 // wonder why this isn't a thing already, maybe I missed it
@@ -133,7 +153,7 @@ public:
     size_t GetSize() const { return (size_t)(current_ - buffer_); }
 };
 
-using MallocAllocator = rapidjson::CrtAllocator;
+using MallocAllocator = HookAllocator;
 using PoolAllocator = rapidjson::MemoryPoolAllocator<MallocAllocator>;
 using UTF8 = rapidjson::UTF8<char>;
 // Writer appears to need about 16 bytes per nested object level (with 64bit size_t)
@@ -159,10 +179,10 @@ public:
 using JsonDocumentBase = rapidjson::GenericDocument<UTF8, PoolAllocator, StackAllocator>;
 class JsonDocument : public JsonDocumentBase {
 public:
-    static const int kDefaultChunkCapacity = 32 * 1024;
+    static const int kDefaultChunkCapacity = DISCORD_PARSE_ARENA_SIZE;
     // json parser will use this buffer first, then allocate more if needed; I seriously doubt we
     // send any messages that would use all of this, though.
-    char parseBuffer_[32 * 1024];
+    char parseBuffer_[DISCORD_PARSE_ARENA_SIZE];
     MallocAllocator mallocAllocator_;
     PoolAllocator poolAllocator_;
     StackAllocator stackAllocator_;
@@ -175,6 +195,15 @@ public:
       , stackAllocator_()
     {
     }
+
+    // Ready for another parse: drops the last message and whatever the pool grew to hold it. The
+    // parse stacks are all given back by the time a parse returns, so theirs can start over too.
+    void Reset()
+    {
+        SetNull();
+        poolAllocator_.Clear();
+        stackAllocator_.Reset();
+    }
 };
 
 using JsonValue = rapidjson::GenericValue<UTF8, PoolAllocator>;
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "latency_histogram.h"
+
+#include <atomic>
+#include <stdint.h>
+
+// A counter with one writer: a relaxed load and store, so bumping it costs about as much as a plain
+// increment and never a locked instruction. Anyone may read it, and gets a value at most a bump or
+// two stale.
+class StatCounter {
+    std::atomic<uint64_t> value_{0};
+
+public:
+    void Add(uint64_t amount = 1)
+    {
+        value_.store(value_.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+    void RaiseTo(uint64_t amount)
+    {
+        if (amount > value_.load(std::memory_order_relaxed)) {
+            value_.store(amount, std::memory_order_relaxed);
+        }
+    }
+    void Set(uint64_t amount) { value_.store(amount, std::memory_order_relaxed); }
+    uint64_t Get() const { return value_.load(std::memory_order_relaxed); }
+};
+
+// The same thing for a counter more than one thread bumps: every update is a locked
+// read-modify-write, so none of them get lost.
+class SharedStatCounter {
+    std::atomic<uint64_t> value_{0};
+
+public:
+    void Add(uint64_t amount = 1) { value_.fetch_add(amount, std::memory_order_relaxed); }
+    void RaiseTo(uint64_t amount)
+    {
+        auto current = value_.load(std::memory_order_relaxed);
+        while (amount > current &&
+               !value_.compare_exchange_weak(current, amount, std::memory_order_relaxed)) {
+        }
+    }
+    uint64_t Get() const { return value_.load(std::memory_order_relaxed); }
+};
+
+// Bumped by RpcConnection, so only ever from whoever runs its IO.
+struct ConnectionStats {
+    StatCounter framesIn;
+    StatCounter bytesIn;
+    StatCounter framesOut;
+    StatCounter bytesOut;
+    StatCounter parseFailures;
+};
+
+// The rest of a client's numbers. The IO loop owns most; presenceSuperseded is only written under
+// presenceMutex. Commands get queued from whichever threads the game calls us from, so the send
+// queue ones take updates from all of them.
+struct ClientStats {
+    StatCounter connectAttempts;
+    StatCounter connects;
+    StatCounter disconnects;
+    SharedStatCounter sendQueueHighWater;
+    SharedStatCounter sendQueueDrops;
+    StatCounter joinQueueHighWater;
+    StatCounter joinQueueDrops;
+    StatCounter presenceSent;
+    StatCounter presenceSuperseded;
+    // command written -> Discord's answer, for every command with a nonce
+    LatencyHistogram ackLatency;
+    // the IO loop handing over an event -> its callback starting
+    LatencyHistogram dispatchDelay;
+
+    // connection health, all from the IO loop
+    StatCounter pingsSent;
+    StatCounter pongsReceived;
+    StatCounter livenessTimeouts;
+    StatCounter pingSentUs; // of the ping still waiting on its pong, 0 if none
+    StatCounter lastRttUs;
+    StatCounter smoothedRttUs;
+    LatencyHistogram pingRtt;
+
+    // What getting going cost, in microseconds on whichever thread paid it; each is set once
+    StatCounter createUs;
+    StatCounter startUs;
+    StatCounter registerUs;
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+#include "discord_rpc.h"
+#include "memory_config.h"
+
+#include <chrono>
+#include <stdint.h>
+
+// Discord_SetClock puts a simulated clock in here. Set before anything runs and left alone after,
+// like the allocator hooks, so reading it needs no guarding.
+inline DiscordClockFn ClockHook{nullptr};
+inline void* ClockHookUserData{nullptr};
+
+// Everything timed in the library runs off this: steady_clock in microseconds, so wall clock jumps
+// can't stall or storm anything.
+inline int64_t MonotonicNowUs()
+{
+    if (ClockHook) {
+        return ClockHook(ClockHookUserData);
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Same clock in milliseconds, which is what timers are scheduled in.
+inline int64_t MonotonicNowMs()
+{
+    if (ClockHook) {
+        return ClockHook(ClockHookUserData) / 1000;
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct Timer {
+    void (*callback)(void* userData){nullptr};
+    void* userData{nullptr};
+    int64_t deadline{0};
+    Timer* prev{nullptr};
+    Timer* next{nullptr};
+    bool armed{false};
+    // in the wheel's sorted list of timers more than a lap out, not in a slot
+    bool later{false};
+
+    bool IsArmed() const { return armed; }
+};
+
+// A hashed timer wheel with 1 ms ticks. A lap (DISCORD_TIMER_WHEEL_SLOTS, memory_config.h) is
+// longer than the IO loop's idle poll, so an idle wake-up only visits the slots it slept through.
+// Slots only hold timers due within a lap; anything further out waits in a list sorted by
+// deadline, and moves into its slot once Advance brings it within a lap. Scheduling is O(1) within
+// a lap and a walk back from the end of the list beyond it, which is short and almost always
+// appended to. Advancing visits one slot per elapsed tick, capped at one lap: every slot timer is
+// due by then, in slot order, and the list goes after it in its own order. The earliest deadline
+// is cached, and only worked out again when the timer holding it goes. Not thread safe: whoever
+// runs the IO loop owns it, and callbacks run on that thread from inside Advance.
+class TimerWheel {
+public:
+    static constexpr int64_t SlotCount = DISCORD_TIMER_WHEEL_SLOTS;
+    static constexpr int64_t NoDeadline = INT64_MAX;
+
+private:
+    Timer* slots_[SlotCount]{};
+    Timer* laterHead_{nullptr};
+    Timer* laterTail_{nullptr};
+    int64_t current_; // every tick up to and including this one has been processed
+    size_t armedCount_{0};
+    // exact unless earliestStale_, in which case the next NextDeadline works it out again
+    mutable int64_t earliest_{NoDeadline};
+    mutable bool earliestStale_{false};
+
+    static int64_t SlotIndex(int64_t tick) { return ((tick % SlotCount) + SlotCount) % SlotCount; }
+
+    void Link(Timer* timer)
+    {
+        if (timer->deadline - current_ <= SlotCount) {
+            auto& head = slots_[SlotIndex(timer->deadline)];
+            timer->prev = nullptr;
+            timer->next = head;
+            if (head) {
+                head->prev = timer;
+            }
+            head = timer;
+            timer->later = false;
+        }
+        else {
+            // after the last one due no later than it, so equal deadlines keep their order
+            auto after = laterTail_;
+            while (after && after->deadline > timer->deadline) {
+                after = after->prev;
+            }
+            timer->prev = after;
+            timer->next = after ? after->next : laterHead_;
+            (timer->next ? timer->next->prev : laterTail_) = timer;
+            (after ? after->next : laterHead_) = timer;
+            timer->later = true;
+        }
+        timer->armed = true;
+        ++armedCount_;
+        if (!earliestStale_ && timer->deadline < earliest_) {
+            earliest_ = timer->deadline;
+        }
+    }
+
+    void Unlink(Timer* timer)
+    {
+        if (timer->prev) {
+            timer->prev->next = timer->next;
+        }
+        else if (timer->later) {
+            laterHead_ = timer->next;
+        }
+        else {
+            slots_[SlotIndex(timer->deadline)] = timer->next;
+        }
+        if (timer->next) {
+            timer->next->prev = timer->prev;
+        }
+        else if (timer->later) {
+            laterTail_ = timer->prev;
+        }
+        timer->prev = timer->next = nullptr;
+        timer->armed = false;
+        if (--armedCount_ == 0) {
+            earliest_ = NoDeadline;
+            earliestStale_ = false;
+        }
+        else if (timer->deadline == earliest_) {
+            earliestStale_ = true;
+        }
+    }
+
+    // Anything a callback schedules lands after now (Advance moves current_ first), so the only
+    // way it can upset the walk is by cancelling the timer we were going to look at next; start
+    // the slot over only then.
+    void FireDue(int64_t slot, int64_t now)
+    {
+        auto timer = slots_[slot];
+        while (timer) {
+            auto next = timer->next;
+            if (timer->deadline > now) {
+                timer = next;
+                continue;
+            }
+            Unlink(timer);
+            timer->callback(timer->userData);
+            if (next && !(next->armed && !next->later && SlotIndex(next->deadline) == slot)) {
+                next = slots_[slot];
+            }
+            timer = next;
+        }
+    }
+
+    // brings everything from the list that's now within a lap into its slot
+    void MoveDueLater()
+    {
+        while (laterHead_ && laterHead_->deadline - current_ <= SlotCount) {
+            auto timer = laterHead_;
+            // Unlink and Link would count it out and back in, and could mark earliest_ stale
+            laterHead_ = timer->next;
+            (laterHead_ ? laterHead_->prev : laterTail_) = nullptr;
+            auto& head = slots_[SlotIndex(timer->deadline)];
+            timer->prev = nullptr;
+            timer->next = head;
+            if (head) {
+                head->prev = timer;
+            }
+            head = timer;
+            timer->later = false;
+        }
+    }
+
+public:
+    explicit TimerWheel(int64_t nowMs = MonotonicNowMs())
+      : current_(nowMs)
+    {
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // (Re)arms the timer; a deadline that's already passed fires on the next Advance.
+    void Schedule(Timer* timer, int64_t deadlineMs)
+    {
+        if (timer->armed) {
+            Unlink(timer);
+        }
+        timer->deadline = deadlineMs > current_ ? deadlineMs : current_ + 1;
+        Link(timer);
+    }
+
+    void Cancel(Timer* timer)
+    {
+        if (timer->armed) {
+            Unlink(timer);
+        }
+    }
+
+    void Advance(int64_t nowMs)
+    {
+        if (nowMs <= current_) {
+            return;
+        }
+        const int64_t from = current_;
+        current_ = nowMs;
+        if (!armedCount_ || (!earliestStale_ && earliest_ > nowMs)) {
+            MoveDueLater();
+            return;
+        }
+        if (nowMs - from < SlotCount) {
+            // whatever comes out of the list is due after nowMs, so the walk passes it by
+            MoveDueLater();
+            for (int64_t tick = from + 1; tick <= nowMs && armedCount_; ++tick) {
+                FireDue(SlotIndex(tick), nowMs);
+            }
+            return;
+        }
+        // A lap or more at once, after a clock jump or a long stall. Every slot timer is due, and
+        // going round from the tick after from takes them in deadline order; the list is all due
+        // after them.
+        for (int64_t tick = from + 1; tick <= from + SlotCount && armedCount_; ++tick) {
+            FireDue(SlotIndex(tick), nowMs);
+        }
+        while (laterHead_ && laterHead_->deadline <= nowMs) {
+            auto timer = laterHead_;
+            Unlink(timer);
+            timer->callback(timer->userData);
+        }
+        MoveDueLater();
+    }
+
+    // Earliest armed deadline, or NoDeadline
+    int64_t NextDeadline() const
+    {
+        if (earliestStale_) {
+            // Every slot timer is due within a lap, and each slot within one tick of it, so the
+            // first slot in use from here on has the earliest; the list only counts without one.
+            earliest_ = laterHead_ ? laterHead_->deadline : NoDeadline;
+            for (int64_t tick = current_ + 1; tick <= current_ + SlotCount; ++tick) {
+                auto timer = slots_[SlotIndex(tick)];
+                if (timer) {
+                    earliest_ = timer->deadline;
+                    for (; timer; timer = timer->next) {
+                        if (timer->deadline < earliest_) {
+                            earliest_ = timer->deadline;
+                        }
+                    }
+                    break;
+                }
+            }
+            earliestStale_ = false;
+        }
+        return earliest_;
+    }
+
+    size_t ArmedCount() const { return armedCount_; }
+};
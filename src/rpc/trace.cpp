@@ -0,0 +1,177 @@
+#include "discord_rpc.h"
+
+#include "trace.h"
+
+#ifdef DISCORD_ENABLE_TRACING
+
+#include "allocator.h"
+#include "connection.h"
+
+#include <chrono>
+#include <stdarg.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+thread_local TraceRing* CurrentTraceRing{nullptr};
+
+// every ring ever made, newest first; only ever pushed onto
+static std::atomic<TraceRing*> TraceRings{nullptr};
+static std::atomic<uint32_t> NextTraceThreadId{1};
+
+namespace {
+// hands the thread's ring back when it exits
+struct TraceRingRelease {
+    TraceRing* ring{nullptr};
+    ~TraceRingRelease()
+    {
+        if (ring) {
+            CurrentTraceRing = nullptr;
+            ring->owned.store(false, std::memory_order_release);
+        }
+    }
+};
+} // namespace
+
+int64_t TraceTicks()
+{
+#ifdef _WIN32
+    LARGE_INTEGER now;
+    ::QueryPerformanceCounter(&now);
+    return now.QuadPart;
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+static double TraceTicksPerUs()
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    ::QueryPerformanceFrequency(&frequency);
+    return (double)frequency.QuadPart / 1e6;
+#else
+    using Period = std::chrono::steady_clock::period;
+    return (double)Period::den / (double)Period::num / 1e6;
+#endif
+}
+
+TraceRing* AcquireTraceRing()
+{
+    static thread_local TraceRingRelease release;
+
+    TraceRing* ring = nullptr;
+    for (auto r = TraceRings.load(std::memory_order_acquire); r; r = r->next) {
+        bool expected = false;
+        if (r->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            ring = r;
+            break;
+        }
+    }
+    if (!ring) {
+        ring = DiscordNew<TraceRing>();
+        if (!ring) {
+            return nullptr;
+        }
+        ring->owned.store(true, std::memory_order_relaxed);
+        ring->next = TraceRings.load(std::memory_order_relaxed);
+        while (!TraceRings.compare_exchange_weak(
+          ring->next, ring, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+    // a fresh id, so this thread's events can be told apart from the ones the ring's last owner
+    // left behind
+    ring->threadId = NextTraceThreadId.fetch_add(1, std::memory_order_relaxed);
+    release.ring = ring;
+    CurrentTraceRing = ring;
+    return ring;
+}
+
+namespace {
+// Appends whole pieces only, always keeping room to close the JSON off.
+struct TraceJsonWriter {
+    static constexpr size_t Reserve{4};
+    char* dest;
+    size_t size;
+    size_t used{0};
+
+    bool Append(const char* format, ...)
+    {
+        if (used + Reserve >= size) {
+            return false;
+        }
+        va_list args;
+        va_start(args, format);
+        const int length = vsnprintf(dest + used, size - used - Reserve, format, args);
+        va_end(args);
+        if (length < 0 || (size_t)length >= size - used - Reserve) {
+            dest[used] = 0;
+            return false;
+        }
+        used += (size_t)length;
+        return true;
+    }
+};
+} // namespace
+
+extern "C" DISCORD_EXPORT size_t Discord_ExportTrace(char* buffer, size_t bufferSize)
+{
+    static const char Header[] = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    if (!buffer || bufferSize < sizeof(Header) + TraceJsonWriter::Reserve) {
+        return 0;
+    }
+    TraceJsonWriter out{buffer, bufferSize};
+    out.Append("%s", Header);
+
+    const double ticksPerUs = TraceTicksPerUs();
+    const int pid = GetProcessId();
+    bool first = true;
+    bool full = false;
+    for (auto ring = TraceRings.load(std::memory_order_acquire); ring && !full;
+         ring = ring->next) {
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        for (uint64_t i = head > TraceRingSize ? head - TraceRingSize : 0; i < head; ++i) {
+            const TraceEvent event = ring->events[i % TraceRingSize];
+            // the owner may have lapped us while we copied; once head reaches i + TraceRingSize it
+            // could be part way through rewriting this slot. The fence keeps the copy from being
+            // read after the head it's checked against.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (ring->head.load(std::memory_order_relaxed) - i >= TraceRingSize) {
+                continue;
+            }
+            if (!out.Append("%s{\"name\":\"%s\",\"cat\":\"discord\",\"ph\":\"X\",\"ts\":%.3f,"
+                            "\"dur\":%.3f,\"pid\":%d,\"tid\":%u}",
+                            first ? "" : ",",
+                            event.name,
+                            (double)event.start / ticksPerUs,
+                            (double)event.duration / ticksPerUs,
+                            pid,
+                            event.threadId)) {
+                full = true;
+                break;
+            }
+            first = false;
+        }
+    }
+
+    // Append left room for this
+    buffer[out.used++] = ']';
+    buffer[out.used++] = '}';
+    buffer[out.used] = 0;
+    return out.used;
+}
+
+#else
+
+extern "C" DISCORD_EXPORT size_t Discord_ExportTrace(char* buffer, size_t bufferSize)
+{
+    if (buffer && bufferSize) {
+        buffer[0] = 0;
+    }
+    return 0;
+}
+
+#endif
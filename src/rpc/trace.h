@@ -0,0 +1,89 @@
+#pragma once
+
+// Trace scopes for lining library work up against a game's own profiler. Build with
+// DISCORD_ENABLE_TRACING (premake --tracing) and every DISCORD_TRACE_SCOPE records its start and
+// duration into a ring buffer owned by the calling thread; Discord_ExportTrace turns whatever the
+// rings hold into Chrome trace JSON. Without it, the scopes compile to nothing.
+//
+// Recording is two clock reads and a few stores into the thread's own ring, no locks or atomic
+// read-modify-writes, so a scope costs a few tens of ns. Names must be string literals, since only
+// the pointer is kept.
+
+#ifdef DISCORD_ENABLE_TRACING
+
+#include "memory_config.h"
+
+#include <atomic>
+#include <stdint.h>
+
+constexpr size_t TraceRingSize{DISCORD_TRACE_RING_SIZE};
+
+struct TraceEvent {
+    const char* name;
+    int64_t start;
+    int64_t duration;
+    // per event, since a recycled ring still holds its last owner's
+    uint32_t threadId;
+};
+
+// Written only by the thread that owns it; Discord_ExportTrace reads from wherever it's called and
+// throws away anything that got overwritten while it looked. Rings are never freed: when a thread
+// exits its ring goes back up for grabs, so the count tops out at the most threads ever tracing at
+// once.
+struct TraceRing {
+    std::atomic<uint64_t> head{0};
+    std::atomic_bool owned{false};
+    uint32_t threadId{0};
+    TraceRing* next{nullptr};
+    TraceEvent events[TraceRingSize];
+};
+
+extern thread_local TraceRing* CurrentTraceRing;
+TraceRing* AcquireTraceRing();
+
+// QueryPerformanceCounter on Windows, steady_clock elsewhere; ticks until export
+int64_t TraceTicks();
+
+inline void TraceRecord(const char* name, int64_t start, int64_t end)
+{
+    auto ring = CurrentTraceRing ? CurrentTraceRing : AcquireTraceRing();
+    if (!ring) {
+        return;
+    }
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    // pairs with the export's fence: an exporter that sees any of this slot being rewritten sees
+    // the head that says so as well
+    std::atomic_thread_fence(std::memory_order_release);
+    auto& event = ring->events[head % TraceRingSize];
+    event.name = name;
+    event.start = start;
+    event.duration = end - start;
+    event.threadId = ring->threadId;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+struct TraceScope {
+    const char* name;
+    int64_t start;
+
+    explicit TraceScope(const char* scopeName)
+      : name(scopeName)
+      , start(TraceTicks())
+    {
+    }
+    ~TraceScope() { TraceRecord(name, start, TraceTicks()); }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#define DISCORD_TRACE_CONCAT_(a, b) a##b
+#define DISCORD_TRACE_CONCAT(a, b) DISCORD_TRACE_CONCAT_(a, b)
+#define DISCORD_TRACE_SCOPE(name) \
+    TraceScope DISCORD_TRACE_CONCAT(traceScope, __LINE__) { name }
+
+#else
+
+#define DISCORD_TRACE_SCOPE(name) (void)0
+
+#endif